@@ -0,0 +1,173 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+/// <summary>
+/// Type used to accumulate covered measures: 64-bit for integers, at least double for floating point
+/// </summary>
+template<typename Type>
+using CoverageMeasure = std::conditional_t<std::is_integral_v<Type>, std::int64_t, std::common_type_t<Type, double>>;
+
+namespace coverage_detail {
+
+	/// <summary>
+	/// Segment tree over compressed coordinates that keeps the total length covered by at least one interval
+	/// </summary>
+	template<typename Type>
+	class SegmentTree {
+		using Measure = CoverageMeasure<Type>;
+
+		std::vector<Type> coords;
+		std::vector<int> count;
+		std::vector<Measure> covered;
+
+		void update(std::size_t node, std::size_t lo, std::size_t hi, std::size_t from, std::size_t to, int delta) {
+			if (to <= lo || hi <= from) return;
+			if (from <= lo && hi <= to) {
+				count[node] += delta;
+			}
+			else {
+				std::size_t mid = (lo + hi) / 2;
+				update(2 * node, lo, mid, from, to, delta);
+				update(2 * node + 1, mid, hi, from, to, delta);
+			}
+
+			if (count[node] > 0) covered[node] = Measure(coords[hi]) - Measure(coords[lo]);
+			else if (hi - lo == 1) covered[node] = 0;
+			else covered[node] = covered[2 * node] + covered[2 * node + 1];
+		}
+	public:
+		/// <summary>
+		/// Takes sorted, unique interval end points
+		/// </summary>
+		explicit SegmentTree(std::vector<Type> sorted_coords)
+			: coords{ std::move(sorted_coords) }, count(4 * coords.size() + 4), covered(4 * coords.size() + 4)
+		{ }
+
+		/// <summary>
+		/// Adds (delta = 1) or removes (delta = -1) the interval [lo, hi]
+		/// </summary>
+		void Update(Type lo, Type hi, int delta) {
+			std::size_t from = std::lower_bound(coords.begin(), coords.end(), lo) - coords.begin();
+			std::size_t to = std::lower_bound(coords.begin(), coords.end(), hi) - coords.begin();
+			if (from < to) update(1, 0, coords.size() - 1, from, to, delta);
+		}
+
+		/// <summary>
+		/// Returns the length covered by the current intervals
+		/// </summary>
+		Measure Covered() const {
+			return covered[1];
+		}
+	};
+
+	template<typename Type>
+	struct Event {
+		Type at, lo, hi;
+		int delta;
+	};
+
+	/// <summary>
+	/// Builds sweep events along X (or along Y when transposed) for the non-degenerate rectangles
+	/// </summary>
+	template<typename Type>
+	std::vector<Event<Type>> events(std::span<const Rect<Type>> rects, bool transposed, std::vector<Type>& coords) {
+		std::vector<Event<Type>> result;
+		result.reserve(2 * rects.size());
+		coords.clear();
+		coords.reserve(2 * rects.size());
+
+		for (decltype(auto) r : rects) {
+			if (r.width == 0 || r.height == 0) continue;
+
+			Type from = transposed ? r.Bottom() : r.Left();
+			Type to = transposed ? r.Top() : r.Right();
+			Type lo = transposed ? r.Left() : r.Bottom();
+			Type hi = transposed ? r.Right() : r.Top();
+
+			result.push_back({ from, lo, hi, 1 });
+			result.push_back({ to, lo, hi, -1 });
+			coords.push_back(lo);
+			coords.push_back(hi);
+		}
+
+		// Openings go before closings at the same coordinate, so touching rectangles have no edge between them
+		std::sort(result.begin(), result.end(), [](const Event<Type>& a, const Event<Type>& b) {
+			return a.at < b.at || (a.at == b.at && a.delta > b.delta);
+		});
+		std::sort(coords.begin(), coords.end());
+		coords.erase(std::unique(coords.begin(), coords.end()), coords.end());
+		return result;
+	}
+
+	/// <summary>
+	/// Total length of the union boundary that is perpendicular to the sweep direction
+	/// </summary>
+	template<typename Type>
+	CoverageMeasure<Type> boundary(std::span<const Rect<Type>> rects, bool transposed) {
+		std::vector<Type> coords;
+		auto sweep = events(rects, transposed, coords);
+		if (sweep.empty()) return 0;
+
+		SegmentTree<Type> tree(std::move(coords));
+		CoverageMeasure<Type> total = 0;
+		for (decltype(auto) e : sweep) {
+			auto before = tree.Covered();
+			tree.Update(e.lo, e.hi, e.delta);
+			auto after = tree.Covered();
+			total += after > before ? after - before : before - after;
+		}
+		return total;
+	}
+}
+
+/// <summary>
+/// Returns the area covered by the union of the rectangles (overlaps counted once).
+/// Sweep line over X with a coordinate-compressed segment tree over Y, O(N log N)
+/// </summary>
+template<typename Type>
+CoverageMeasure<Type> CoveredArea(std::span<const Rect<Type>> rects) {
+	using Measure = CoverageMeasure<Type>;
+
+	std::vector<Type> coords;
+	auto sweep = coverage_detail::events(rects, false, coords);
+	if (sweep.empty()) return 0;
+
+	coverage_detail::SegmentTree<Type> tree(std::move(coords));
+	Measure area = 0;
+	for (std::size_t i = 0; i < sweep.size(); ++i) {
+		if (i > 0) area += tree.Covered() * (Measure(sweep[i].at) - Measure(sweep[i - 1].at));
+		tree.Update(sweep[i].lo, sweep[i].hi, sweep[i].delta);
+	}
+	return area;
+}
+
+/// <summary>
+/// Returns the perimeter of the union of the rectangles, holes included.
+/// Rectangles with zero width or height do not cover anything and are ignored
+/// </summary>
+template<typename Type>
+CoverageMeasure<Type> CoveredPerimeter(std::span<const Rect<Type>> rects) {
+	return coverage_detail::boundary(rects, false) + coverage_detail::boundary(rects, true);
+}
+
+/// <summary>
+/// Overload for rectangles stored in a vector
+/// </summary>
+template<typename Type>
+CoverageMeasure<Type> CoveredArea(const std::vector<Rect<Type>>& rects) {
+	return CoveredArea(std::span<const Rect<Type>>(rects));
+}
+
+/// <summary>
+/// Overload for rectangles stored in a vector
+/// </summary>
+template<typename Type>
+CoverageMeasure<Type> CoveredPerimeter(const std::vector<Rect<Type>>& rects) {
+	return CoveredPerimeter(std::span<const Rect<Type>>(rects));
+}
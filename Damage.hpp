@@ -0,0 +1,276 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include "Coverage.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <set>
+#include <stdexcept> // for std::invalid_argument
+#include <utility>
+#include <vector>
+
+/// <summary>
+/// Collects damaged rectangles of a frame and keeps them as at most K covering boxes.
+/// A new rectangle is dropped if a box already contains it; otherwise it is merged into the nearby box
+/// that wastes the least area, or becomes a box of its own while fewer than K exist. When all K are taken,
+/// the cheapest of merging it into a box and merging two neighbouring boxes to make room is chosen.
+/// Boxes are ordered by the Morton code of their centers and neighbours in that order keep their merge cost
+/// in a sorted set; an insertion only looks at `probe` neighbours, so it costs O(log K + probe)
+/// and a frame of N rectangles O(N log K)
+/// </summary>
+template<typename Type>
+class DamageAccumulator {
+	static_assert(std::is_arithmetic_v<Type>, "Type must be arithmetic");
+
+	using Measure = CoverageMeasure<Type>;
+	using Key = std::pair<std::uint64_t, std::uint32_t>; // Morton code, slot
+	using Order = std::set<Key>;
+
+	struct Box {
+		Rect<Type> rect;
+		std::uint64_t code;
+		bool alive;
+		bool has_next; // Cost of merging with the next box in Morton order is in `pairs`
+		Measure next_waste;
+	};
+
+	std::size_t max_rects, probe;
+	std::vector<Box> boxes;
+	std::vector<std::uint32_t> unused;
+	Order order;
+	std::set<std::pair<Measure, std::uint32_t>> pairs; // Merge cost, first box of the pair
+	std::uint32_t last = 0; // Most recently grown box, checked first
+	std::vector<std::uint32_t> nearby; // Scratch for Insert
+
+	/// <summary>
+	/// Order-preserving map of a coordinate to 32 bits (the top bits of the IEEE pattern for floating point)
+	/// </summary>
+	static std::uint32_t ordered_bits(Type v) {
+		if constexpr (std::is_floating_point_v<Type>) {
+			std::uint64_t bits = std::bit_cast<std::uint64_t>(static_cast<double>(v));
+			bits = (bits >> 63) ? ~bits : bits | (std::uint64_t{ 1 } << 63);
+			return static_cast<std::uint32_t>(bits >> 32);
+		}
+		else {
+			long long x = static_cast<long long>(v);
+			x = std::clamp<long long>(x, std::numeric_limits<std::int32_t>::min(), std::numeric_limits<std::int32_t>::max());
+			return static_cast<std::uint32_t>(static_cast<std::int32_t>(x)) ^ 0x80000000u;
+		}
+	}
+
+	static std::uint64_t spread(std::uint32_t v) {
+		std::uint64_t x = v;
+		x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+		x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+		x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+		x = (x | (x << 2)) & 0x3333333333333333ull;
+		x = (x | (x << 1)) & 0x5555555555555555ull;
+		return x;
+	}
+
+	static std::uint64_t morton(const Rect<Type>& r) {
+		return spread(ordered_bits(r.Left() + r.width / 2)) | (spread(ordered_bits(r.Bottom() + r.height / 2)) << 1);
+	}
+
+	static Measure area(const Rect<Type>& r) {
+		return static_cast<Measure>(r.width) * static_cast<Measure>(r.height);
+	}
+
+	/// <summary>
+	/// Area of the merged box not covered by either rectangle
+	/// </summary>
+	static Measure waste(const Rect<Type>& box, const Rect<Type>& r) {
+		Measure covered = area(box) + area(r) - (box.Overlaps(r) ? area(box.Intersect(r)) : Measure{});
+		return area(box.Union(r)) - covered;
+	}
+
+	void unlink(std::uint32_t slot) {
+		Box& box = boxes[slot];
+		if (box.has_next) pairs.erase({ box.next_waste, slot });
+		box.has_next = false;
+	}
+
+	void link(typename Order::iterator it) {
+		auto next = std::next(it);
+		if (next == order.end()) return;
+		Box& box = boxes[it->second];
+		box.next_waste = waste(box.rect, boxes[next->second].rect);
+		box.has_next = true;
+		pairs.insert({ box.next_waste, it->second });
+	}
+
+	std::uint32_t add(const Rect<Type>& r) {
+		std::uint32_t slot;
+		if (!unused.empty()) {
+			slot = unused.back();
+			unused.pop_back();
+		}
+		else {
+			slot = static_cast<std::uint32_t>(boxes.size());
+			boxes.emplace_back();
+		}
+		boxes[slot] = { r, morton(r), true, false, Measure{} };
+
+		auto it = order.insert({ boxes[slot].code, slot }).first;
+		if (it != order.begin()) {
+			auto prev = std::prev(it);
+			unlink(prev->second);
+			link(prev);
+		}
+		link(it);
+		return slot;
+	}
+
+	void remove(std::uint32_t slot) {
+		unlink(slot);
+		auto it = order.erase(order.find({ boxes[slot].code, slot }));
+		if (it != order.begin()) {
+			auto prev = std::prev(it);
+			unlink(prev->second);
+			link(prev);
+		}
+		boxes[slot].alive = false;
+		unused.push_back(slot);
+	}
+
+	/// <summary>
+	/// Grows a box by r and swallows the nearby boxes it now contains
+	/// </summary>
+	void grow(std::uint32_t slot, const Rect<Type>& r) {
+		Rect<Type> merged = boxes[slot].rect.Union(r);
+		remove(slot);
+		for (std::uint32_t other : nearby) {
+			if (other != slot && boxes[other].alive && merged.Contains(boxes[other].rect)) remove(other);
+		}
+		last = add(merged);
+	}
+public:
+	/// <summary>
+	/// max_rects - the K limit; probe - how many neighbouring boxes an insertion may examine
+	/// </summary>
+	explicit DamageAccumulator(std::size_t max_rects = 16, std::size_t probe = 8)
+		: max_rects{ max_rects }, probe{ probe }
+	{
+		if (max_rects == 0 || probe == 0)
+			throw std::invalid_argument("The box limit and the probe budget must be positive.");
+		boxes.reserve(max_rects + 1);
+		nearby.reserve(probe + 1);
+	}
+
+	/// <summary>
+	/// Adds a damaged rectangle; rectangles of zero area are ignored
+	/// </summary>
+	void Insert(const Rect<Type>& r) {
+		if (r.width == 0 || r.height == 0) return;
+		if (last < boxes.size() && boxes[last].alive && boxes[last].rect.Contains(r)) return;
+
+		// Gather up to `probe` boxes around r in Morton order, alternating between the two directions
+		nearby.clear();
+		auto after = order.lower_bound({ morton(r), 0 });
+		auto before = after;
+		while (nearby.size() < probe && (after != order.end() || before != order.begin())) {
+			if (after != order.end()) nearby.push_back((after++)->second);
+			if (nearby.size() < probe && before != order.begin()) nearby.push_back((--before)->second);
+		}
+		if (last < boxes.size() && boxes[last].alive) nearby.push_back(last);
+
+		std::uint32_t best = 0;
+		Measure best_waste = std::numeric_limits<Measure>::max();
+		for (std::uint32_t slot : nearby) {
+			const Rect<Type>& box = boxes[slot].rect;
+			if (box.Contains(r)) {
+				last = slot;
+				return;
+			}
+			Measure w = waste(box, r);
+			if (w < best_waste) {
+				best_waste = w;
+				best = slot;
+			}
+		}
+
+		// Merging for free (r is adjacent to or overlaps a box along a whole side) is always taken
+		if (nearby.empty() || (best_waste > 0 && order.size() < max_rects)) {
+			last = add(r);
+			return;
+		}
+		if (best_waste <= 0 || pairs.empty() || pairs.begin()->first >= best_waste) {
+			grow(best, r);
+			return;
+		}
+
+		// Cheaper to merge the closest pair of boxes and give r a box of its own
+		std::uint32_t first = pairs.begin()->second;
+		auto it = order.find({ boxes[first].code, first });
+		std::uint32_t second = std::next(it)->second;
+		Rect<Type> merged = boxes[first].rect.Union(boxes[second].rect);
+		remove(first);
+		remove(second);
+		last = add(merged);
+		if (!merged.Contains(r)) last = add(r);
+	}
+
+	/// <summary>
+	/// Moves the boxes of the frame into out (reusing its storage) and starts a new frame
+	/// </summary>
+	void Flush(std::vector<Rect<Type>>& out) {
+		out.clear();
+		for (decltype(auto) key : order) out.push_back(boxes[key.second].rect);
+		Clear();
+	}
+
+	/// <summary>
+	/// Returns the boxes of the frame and starts a new frame
+	/// </summary>
+	std::vector<Rect<Type>> Flush() {
+		std::vector<Rect<Type>> out;
+		out.reserve(order.size());
+		Flush(out);
+		return out;
+	}
+
+	void Clear() {
+		boxes.clear();
+		unused.clear();
+		order.clear();
+		pairs.clear();
+		last = 0;
+	}
+
+	/// <summary>
+	/// Current boxes in Morton order
+	/// </summary>
+	std::vector<Rect<Type>> Rects() const {
+		std::vector<Rect<Type>> out;
+		out.reserve(order.size());
+		for (decltype(auto) key : order) out.push_back(boxes[key.second].rect);
+		return out;
+	}
+
+	/// <summary>
+	/// Number of boxes
+	/// </summary>
+	std::size_t Size() const {
+		return order.size();
+	}
+
+	bool Empty() const {
+		return order.empty();
+	}
+
+	std::size_t MaxRects() const {
+		return max_rects;
+	}
+
+	/// <summary>
+	/// Sum of the box areas, i.e. what will be redrawn (boxes may overlap)
+	/// </summary>
+	Measure Area() const {
+		Measure total{};
+		for (decltype(auto) key : order) total += area(boxes[key.second].rect);
+		return total;
+	}
+};
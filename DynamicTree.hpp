@@ -0,0 +1,363 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept> // for std::invalid_argument
+#include <vector>
+
+/// <summary>
+/// Dynamic AABB tree for rectangles that move, insert and disappear between queries.
+/// Every leaf stores a fat box: the rectangle grown by a margin. Moving a rectangle inside its fat box
+/// costs nothing; only when it leaves the box is the leaf removed and reinserted, in O(log N).
+/// Insertion picks the sibling that least grows the perimeters on the way down (a surface area heuristic),
+/// and the nodes on the way back up are rebalanced by AVL rotations unless disabled.
+/// Nodes live in one array and freed nodes are reused, so ids stay small and stable
+/// </summary>
+template<typename Type>
+class DynamicTree {
+	static_assert(std::is_arithmetic_v<Type>, "Type must be arithmetic");
+
+	static constexpr std::int32_t null = -1;
+
+	// What a query reads is kept apart from the rest, so a visited node costs one cache line at most
+	struct Node {
+		Rect<Type> box; // Leaves: the fat box. Inner nodes: union of the children
+		std::int32_t child1, child2;
+	};
+
+	struct Link {
+		Rect<Type> rect; // Leaves: the rectangle itself
+		std::int32_t parent; // Free nodes: the next free node
+		std::int32_t height; // Leaves: 0. Free nodes: -1
+	};
+
+	std::vector<Node> nodes;
+	std::vector<Link> links;
+	std::int32_t root = null;
+	std::int32_t free_list = null;
+	std::size_t count = 0;
+	Type margin;
+	bool rotate;
+
+	static double cost(const Rect<Type>& r) {
+		return static_cast<double>(r.width) + static_cast<double>(r.height);
+	}
+
+	bool is_leaf(std::int32_t id) const {
+		return nodes[id].child1 == null;
+	}
+
+	std::int32_t allocate() {
+		if (free_list == null) {
+			nodes.push_back({ Rect<Type>(), null, null });
+			links.push_back({ Rect<Type>(), null, 0 });
+			return static_cast<std::int32_t>(nodes.size() - 1);
+		}
+		std::int32_t id = free_list;
+		free_list = links[id].parent;
+		links[id].parent = nodes[id].child1 = nodes[id].child2 = null;
+		links[id].height = 0;
+		return id;
+	}
+
+	void release(std::int32_t id) {
+		links[id].parent = free_list;
+		links[id].height = -1;
+		free_list = id;
+	}
+
+	Rect<Type> fatten(const Rect<Type>& r) const {
+		return Rect<Type>(Point<Type>(r.Left() - margin, r.Bottom() - margin), r.width + 2 * margin, r.height + 2 * margin);
+	}
+
+	void check(std::size_t id) const {
+		if (id >= nodes.size() || links[id].height != 0)
+			throw std::invalid_argument("No rectangle with this id.");
+	}
+
+	/// <summary>
+	/// Recomputes the boxes and heights from a node up to the root, rotating where unbalanced
+	/// </summary>
+	void refit(std::int32_t id) {
+		while (id != null) {
+			if (rotate) id = balance(id);
+			Node& node = nodes[id];
+			links[id].height = 1 + std::max(links[node.child1].height, links[node.child2].height);
+			node.box = nodes[node.child1].box.Union(nodes[node.child2].box);
+			id = links[id].parent;
+		}
+	}
+
+	void insert_leaf(std::int32_t leaf) {
+		if (root == null) {
+			root = leaf;
+			links[leaf].parent = null;
+			return;
+		}
+
+		// Descend while it is cheaper to push the leaf into a child than to pair it with the node itself
+		const Rect<Type> box = nodes[leaf].box;
+		std::int32_t index = root;
+		while (!is_leaf(index)) {
+			const Node& node = nodes[index];
+			double area = cost(node.box);
+			double combined = cost(node.box.Union(box));
+			double pair_here = 2 * combined;
+			double inheritance = 2 * (combined - area); // Paid by every ancestor of a deeper sibling
+
+			auto descend = [&](std::int32_t child) {
+				const Node& c = nodes[child];
+				double grown = cost(c.box.Union(box));
+				return (is_leaf(child) ? grown : grown - cost(c.box)) + inheritance;
+			};
+			double cost1 = descend(node.child1), cost2 = descend(node.child2);
+			if (pair_here < cost1 && pair_here < cost2) break;
+			index = cost1 < cost2 ? node.child1 : node.child2;
+		}
+
+		std::int32_t sibling = index;
+		std::int32_t parent = allocate();
+		std::int32_t old_parent = links[sibling].parent;
+		nodes[parent] = { box.Union(nodes[sibling].box), sibling, leaf };
+		links[parent].parent = old_parent;
+		links[parent].height = links[sibling].height + 1;
+		links[sibling].parent = parent;
+		links[leaf].parent = parent;
+
+		if (old_parent == null) root = parent;
+		else if (nodes[old_parent].child1 == sibling) nodes[old_parent].child1 = parent;
+		else nodes[old_parent].child2 = parent;
+
+		refit(old_parent);
+	}
+
+	void remove_leaf(std::int32_t leaf) {
+		if (leaf == root) {
+			root = null;
+			return;
+		}
+
+		std::int32_t parent = links[leaf].parent;
+		std::int32_t grandparent = links[parent].parent;
+		std::int32_t sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+		release(parent);
+
+		links[sibling].parent = grandparent;
+		if (grandparent == null) {
+			root = sibling;
+			return;
+		}
+		if (nodes[grandparent].child1 == parent) nodes[grandparent].child1 = sibling;
+		else nodes[grandparent].child2 = sibling;
+		refit(grandparent);
+	}
+
+	/// <summary>
+	/// If one subtree of a is more than one level taller than the other, lifts its root into the place of a.
+	/// Returns the node now in that place
+	/// </summary>
+	std::int32_t balance(std::int32_t a) {
+		if (is_leaf(a) || links[a].height < 2) return a;
+
+		std::int32_t b = nodes[a].child1, c = nodes[a].child2;
+		std::int32_t diff = links[c].height - links[b].height;
+		if (diff > 1) return lift(a, c, b, false);
+		if (diff < -1) return lift(a, b, c, true);
+		return a;
+	}
+
+	/// <summary>
+	/// Puts `up` (a child of a) in the place of a; a keeps `other` and the shorter child of up
+	/// </summary>
+	std::int32_t lift(std::int32_t a, std::int32_t up, std::int32_t other, bool up_is_first) {
+		std::int32_t f = nodes[up].child1, g = nodes[up].child2;
+
+		nodes[up].child1 = a;
+		links[up].parent = links[a].parent;
+		links[a].parent = up;
+		std::int32_t grandparent = links[up].parent;
+		if (grandparent == null) root = up;
+		else if (nodes[grandparent].child1 == a) nodes[grandparent].child1 = up;
+		else nodes[grandparent].child2 = up;
+
+		// The taller grandchild stays with `up`, the shorter one moves under a in place of `up`
+		std::int32_t keep = links[f].height > links[g].height ? f : g;
+		std::int32_t give = keep == f ? g : f;
+		nodes[up].child2 = keep;
+		(up_is_first ? nodes[a].child1 : nodes[a].child2) = give;
+		links[give].parent = a;
+
+		nodes[a].box = nodes[other].box.Union(nodes[give].box);
+		links[a].height = 1 + std::max(links[other].height, links[give].height);
+		nodes[up].box = nodes[a].box.Union(nodes[keep].box);
+		links[up].height = 1 + std::max(links[a].height, links[keep].height);
+		return up;
+	}
+
+	template<typename Descend, typename Accept, typename F>
+	void search(Descend&& descend, Accept&& accept, F&& f) const {
+		if (root == null) return;
+
+		// Depth is logarithmic while rotations are on, so the stack stays small
+		std::vector<std::int32_t> stack{ root };
+		while (!stack.empty()) {
+			std::int32_t id = stack.back();
+			stack.pop_back();
+
+			const Node& node = nodes[id];
+			if (!descend(node.box)) continue;
+			if (node.child1 == null) {
+				if (accept(links[id].rect)) f(static_cast<std::size_t>(id));
+				continue;
+			}
+			stack.push_back(node.child1);
+			stack.push_back(node.child2);
+		}
+	}
+
+public:
+	/// <summary>
+	/// margin - how far a rectangle may move beyond its position at insertion before its leaf is reinserted;
+	/// rotate - rebalance the tree after every insertion and removal
+	/// </summary>
+	explicit DynamicTree(Type margin = 0, bool rotate = true)
+		: margin{ margin }, rotate{ rotate }
+	{
+		if (margin < 0)
+			throw std::invalid_argument("Margin must be non-negative.");
+	}
+
+	/// <summary>
+	/// Adds a rectangle and returns its id. Ids of removed rectangles are reused
+	/// </summary>
+	std::size_t Insert(const Rect<Type>& r) {
+		std::int32_t leaf = allocate();
+		links[leaf].rect = r;
+		nodes[leaf].box = fatten(r);
+		insert_leaf(leaf);
+		++count;
+		return static_cast<std::size_t>(leaf);
+	}
+
+	/// <summary>
+	/// Removes a rectangle; throws std::invalid_argument for an unknown id
+	/// </summary>
+	void Remove(std::size_t id) {
+		check(id);
+		std::int32_t leaf = static_cast<std::int32_t>(id);
+		remove_leaf(leaf);
+		release(leaf);
+		--count;
+	}
+
+	/// <summary>
+	/// Updates the position of a rectangle. The tree is only changed if the rectangle left its fat box;
+	/// returns true in that case
+	/// </summary>
+	bool Move(std::size_t id, const Rect<Type>& r) {
+		check(id);
+		std::int32_t leaf = static_cast<std::int32_t>(id);
+		links[leaf].rect = r;
+		if (nodes[leaf].box.Contains(r)) return false;
+
+		remove_leaf(leaf);
+		nodes[leaf].box = fatten(r);
+		insert_leaf(leaf);
+		return true;
+	}
+
+	/// <summary>
+	/// Moves a rectangle by the given vector, as Rect::Move does
+	/// </summary>
+	bool Move(std::size_t id, const Point<Type>& movement) {
+		check(id);
+		Rect<Type> r = links[id].rect;
+		r.Move(movement);
+		return Move(id, r);
+	}
+
+	/// <summary>
+	/// Returns the rectangle with the given id
+	/// </summary>
+	const Rect<Type>& Get(std::size_t id) const {
+		check(id);
+		return links[id].rect;
+	}
+
+	/// <summary>
+	/// Returns the fat box of the rectangle with the given id
+	/// </summary>
+	const Rect<Type>& FatBox(std::size_t id) const {
+		check(id);
+		return nodes[id].box;
+	}
+
+	/// <summary>
+	/// Returns the number of rectangles
+	/// </summary>
+	std::size_t Size() const {
+		return count;
+	}
+
+	bool Empty() const {
+		return count == 0;
+	}
+
+	/// <summary>
+	/// Returns the number of levels below the root (0 for a single rectangle or an empty tree)
+	/// </summary>
+	std::size_t Height() const {
+		return root == null ? 0 : static_cast<std::size_t>(links[root].height);
+	}
+
+	/// <summary>
+	/// Returns the box of the root, which contains every fat box (Rect() for an empty tree)
+	/// </summary>
+	Rect<Type> Bounds() const {
+		return root == null ? Rect<Type>() : nodes[root].box;
+	}
+
+	void Clear() {
+		nodes.clear();
+		links.clear();
+		root = free_list = null;
+		count = 0;
+	}
+
+	/// <summary>
+	/// Calls f(id) for every rectangle that overlaps the window
+	/// </summary>
+	template<typename F>
+	void Search(const Rect<Type>& window, F&& f) const {
+		auto overlaps = [&](const Rect<Type>& box) { return box.Overlaps(window); };
+		search(overlaps, overlaps, f);
+	}
+
+	/// <summary>
+	/// Returns the ids of the rectangles that overlap the window
+	/// </summary>
+	std::vector<std::size_t> Search(const Rect<Type>& window) const {
+		std::vector<std::size_t> result;
+		Search(window, [&](std::size_t id) { result.push_back(id); });
+		return result;
+	}
+
+	/// <summary>
+	/// Calls f(id) for every rectangle that contains the point
+	/// </summary>
+	template<typename F>
+	void SearchPoint(const Point<Type>& p, F&& f) const {
+		auto contains = [&](const Rect<Type>& box) { return box.Contains(p); };
+		search(contains, contains, f);
+	}
+
+	/// <summary>
+	/// Returns the ids of the rectangles that contain the point
+	/// </summary>
+	std::vector<std::size_t> SearchPoint(const Point<Type>& p) const {
+		std::vector<std::size_t> result;
+		SearchPoint(p, [&](std::size_t id) { result.push_back(id); });
+		return result;
+	}
+};
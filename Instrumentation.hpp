@@ -0,0 +1,382 @@
+﻿#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// Opt-in instrumentation of the hot paths. Build with RECTANGLE_INSTRUMENT defined (CMake option of the same name)
+// to count calls and record latencies; otherwise RECT_PROBE expands to nothing and costs nothing.
+#ifdef RECTANGLE_INSTRUMENT
+#define RECT_PROBE_CONCAT_(a, b) a##b
+#define RECT_PROBE_CONCAT(a, b) RECT_PROBE_CONCAT_(a, b)
+#define RECT_PROBE(probe) ::instrumentation::Scope RECT_PROBE_CONCAT(rect_probe_, __LINE__)(::instrumentation::Probe::probe)
+#else
+#define RECT_PROBE(probe) ((void)0)
+#endif
+
+namespace instrumentation {
+
+	/// <summary>
+	/// Instrumented code paths
+	/// </summary>
+	enum class Probe : unsigned {
+		RectConstruct,
+		RectIntersect,
+		RectUnion,
+		RectContains,
+		ReadFile,
+		WriteFile,
+		ChoiceRect,
+		Count
+	};
+
+	constexpr std::size_t probe_count = static_cast<std::size_t>(Probe::Count);
+
+	constexpr std::array<std::string_view, probe_count> probe_names{
+		"Rect::Rect", "Rect::Intersect", "Rect::Union", "Rect::Contains", "read_file", "write_file", "choice_rect" };
+
+	// Latency histogram: bucket b counts calls that took [2^b, 2^(b+1)) ns, bucket 0 also takes 0 ns
+	constexpr std::size_t bucket_count = 40;
+
+	// Trace events kept per thread; older ones are overwritten
+	constexpr std::size_t trace_capacity = std::size_t{ 1 } << 15;
+
+	/// <summary>
+	/// Indicates whether the build records anything
+	/// </summary>
+	constexpr bool Enabled() {
+#ifdef RECTANGLE_INSTRUMENT
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	/// <summary>
+	/// Histogram bucket of a latency
+	/// </summary>
+	constexpr std::size_t Bucket(std::uint64_t ns) {
+		std::size_t bucket = 0;
+		while (bucket + 1 < bucket_count && (ns >> (bucket + 1)) != 0) ++bucket;
+		return bucket;
+	}
+
+	/// <summary>
+	/// Merged counters of one probe
+	/// </summary>
+	struct ProbeStats {
+		std::uint64_t calls = 0;
+		std::uint64_t total_ns = 0;
+		std::uint64_t max_ns = 0;
+		std::array<std::uint64_t, bucket_count> histogram{};
+
+		/// <summary>
+		/// Adds one call; for counters kept by a single thread outside the probes
+		/// </summary>
+		void Add(std::uint64_t ns) {
+			++calls;
+			total_ns += ns;
+			max_ns = std::max(max_ns, ns);
+			++histogram[Bucket(ns)];
+		}
+
+		double MeanNs() const {
+			return calls == 0 ? 0 : static_cast<double>(total_ns) / calls;
+		}
+
+		/// <summary>
+		/// Upper bound of the histogram bucket holding the given fraction of calls (0..1)
+		/// </summary>
+		std::uint64_t PercentileNs(double p) const {
+			std::uint64_t target = static_cast<std::uint64_t>(p * calls + 0.5), seen = 0;
+			for (std::size_t b = 0; b < bucket_count; ++b) {
+				seen += histogram[b];
+				if (seen >= target && seen > 0) return std::uint64_t{ 1 } << (b + 1);
+			}
+			return max_ns;
+		}
+	};
+
+	struct TraceEvent {
+		Probe probe;
+		std::uint32_t thread;
+		std::int64_t start_ns; // Since program start
+		std::int64_t duration_ns;
+	};
+
+	namespace detail {
+		using Clock = std::chrono::steady_clock;
+
+		// Trace timestamps are relative to program start
+		inline const Clock::time_point epoch = Clock::now();
+
+		// Incremented by Reset; every thread zeroes its own counters when it sees a new value
+		inline std::atomic<std::uint64_t> reset_generation{ 0 };
+
+		/// <summary>
+		/// One trace event guarded by a sequence number (seqlock): odd while the owner rewrites the slot and
+		/// 2 * (n + 1) once event number n is complete. A reader keeps the fields only if the number was the
+		/// expected one both before and after it copied them, so an event torn by a concurrent write is dropped
+		/// </summary>
+		struct TraceSlot {
+			std::atomic<std::uint64_t> sequence{ 0 };
+			std::atomic<Probe> probe{ Probe::Count };
+			std::atomic<std::int64_t> start_ns{ 0 };
+			std::atomic<std::int64_t> duration_ns{ 0 };
+		};
+
+		/// <summary>
+		/// Counters owned by one thread. Only the owner writes them, so plain load + store is enough;
+		/// the atomics only make concurrent reads well-defined. Reset does not touch them either: the owner
+		/// zeroes them itself on its next call, and until then readers skip counters of an older generation
+		/// </summary>
+		struct ThreadData {
+			std::uint32_t thread = 0;
+			std::array<std::atomic<std::uint64_t>, probe_count> calls{};
+			std::array<std::atomic<std::uint64_t>, probe_count> total_ns{};
+			std::array<std::atomic<std::uint64_t>, probe_count> max_ns{};
+			std::array<std::array<std::atomic<std::uint64_t>, bucket_count>, probe_count> histogram{};
+			std::unique_ptr<TraceSlot[]> trace = std::make_unique<TraceSlot[]>(trace_capacity);
+			std::atomic<std::uint64_t> trace_written{ 0 };
+			std::atomic<std::uint64_t> trace_first{ 0 }; // First event of the current generation
+			std::atomic<std::uint64_t> generation{ 0 };  // Reset generation the counters belong to
+
+			/// <summary>
+			/// Called by the owner only: zeroes the counters if a Reset happened since its last call
+			/// </summary>
+			void sync(std::uint64_t current) {
+				if (generation.load(std::memory_order_relaxed) == current) return;
+				for (std::size_t p = 0; p < probe_count; ++p) {
+					calls[p].store(0, std::memory_order_relaxed);
+					total_ns[p].store(0, std::memory_order_relaxed);
+					max_ns[p].store(0, std::memory_order_relaxed);
+					for (decltype(auto) b : histogram[p]) b.store(0, std::memory_order_relaxed);
+				}
+				// The trace keeps counting, so slots of older events never match a newer sequence number
+				trace_first.store(trace_written.load(std::memory_order_relaxed), std::memory_order_relaxed);
+				generation.store(current, std::memory_order_release);
+			}
+
+			/// <summary>
+			/// Indicates whether the counters were zeroed after the latest Reset; readers ignore them otherwise
+			/// </summary>
+			bool up_to_date() const {
+				return generation.load(std::memory_order_acquire) == reset_generation.load(std::memory_order_relaxed);
+			}
+
+			void add_to(std::array<ProbeStats, probe_count>& stats) const {
+				for (std::size_t p = 0; p < probe_count; ++p) {
+					stats[p].calls += calls[p].load(std::memory_order_relaxed);
+					stats[p].total_ns += total_ns[p].load(std::memory_order_relaxed);
+					stats[p].max_ns = std::max(stats[p].max_ns, max_ns[p].load(std::memory_order_relaxed));
+					for (std::size_t b = 0; b < bucket_count; ++b) {
+						stats[p].histogram[b] += histogram[p][b].load(std::memory_order_relaxed);
+					}
+				}
+			}
+
+			void write_trace(Probe probe, std::int64_t start_ns, std::int64_t duration_ns) {
+				std::uint64_t n = trace_written.load(std::memory_order_relaxed);
+				TraceSlot& slot = trace[n % trace_capacity];
+				slot.sequence.store(2 * n + 1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+				slot.probe.store(probe, std::memory_order_relaxed);
+				slot.start_ns.store(start_ns, std::memory_order_relaxed);
+				slot.duration_ns.store(duration_ns, std::memory_order_relaxed);
+				slot.sequence.store(2 * n + 2, std::memory_order_release);
+				trace_written.store(n + 1, std::memory_order_release);
+			}
+
+			/// <summary>
+			/// Appends the most recent events; safe while the owner keeps recording
+			/// </summary>
+			void copy_trace(std::vector<TraceEvent>& out) const {
+				std::uint64_t written = trace_written.load(std::memory_order_acquire);
+				std::uint64_t first = std::max(trace_first.load(std::memory_order_relaxed),
+					written > trace_capacity ? written - trace_capacity : 0);
+				for (std::uint64_t i = first; i < written; ++i) {
+					const TraceSlot& slot = trace[i % trace_capacity];
+					const std::uint64_t expected = 2 * i + 2;
+					// Being rewritten or already holding a newer event
+					if (slot.sequence.load(std::memory_order_acquire) != expected) continue;
+					TraceEvent e{ slot.probe.load(std::memory_order_relaxed), thread,
+						slot.start_ns.load(std::memory_order_relaxed), slot.duration_ns.load(std::memory_order_relaxed) };
+					std::atomic_thread_fence(std::memory_order_acquire);
+					if (slot.sequence.load(std::memory_order_relaxed) != expected) continue;
+					out.push_back(e);
+				}
+			}
+		};
+
+		/// <summary>
+		/// All live threads plus the totals of threads that have already exited
+		/// </summary>
+		struct Registry {
+			std::mutex mutex;
+			std::vector<ThreadData*> live;
+			std::array<ProbeStats, probe_count> retired{};
+			std::vector<TraceEvent> retired_trace;
+			std::uint32_t next_thread = 1;
+		};
+
+		/// <summary>
+		/// Never destroyed: pool workers may exit after static destructors have run, and their ThreadHandle still folds into it
+		/// </summary>
+		inline Registry& registry() {
+			static Registry& r = *new Registry;
+			return r;
+		}
+
+		/// <summary>
+		/// Registers the thread's counters on first use and folds them into the registry when the thread exits
+		/// </summary>
+		struct ThreadHandle {
+			ThreadData* data = new ThreadData();
+
+			ThreadHandle() {
+				Registry& r = registry();
+				std::lock_guard lock(r.mutex);
+				data->thread = r.next_thread++;
+				r.live.push_back(data);
+			}
+
+			~ThreadHandle() {
+				Registry& r = registry();
+				std::lock_guard lock(r.mutex);
+				if (data->up_to_date()) {
+					data->add_to(r.retired);
+					data->copy_trace(r.retired_trace);
+				}
+				std::erase(r.live, data);
+				delete data;
+			}
+		};
+
+		inline ThreadData& local() {
+			thread_local ThreadHandle handle;
+			return *handle.data;
+		}
+
+		inline void bump(std::atomic<std::uint64_t>& counter, std::uint64_t by) {
+			counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+		}
+	}
+
+	/// <summary>
+	/// Adds one call of the probe that ran from start to end
+	/// </summary>
+	inline void Record(Probe probe, detail::Clock::time_point start, detail::Clock::time_point end) {
+		detail::ThreadData& d = detail::local();
+		d.sync(detail::reset_generation.load(std::memory_order_relaxed));
+		std::size_t p = static_cast<std::size_t>(probe);
+		std::uint64_t ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+		std::size_t bucket = Bucket(ns);
+
+		detail::bump(d.calls[p], 1);
+		detail::bump(d.total_ns[p], ns);
+		detail::bump(d.histogram[p][bucket], 1);
+		if (ns > d.max_ns[p].load(std::memory_order_relaxed)) d.max_ns[p].store(ns, std::memory_order_relaxed);
+
+		d.write_trace(probe, std::chrono::duration_cast<std::chrono::nanoseconds>(start - detail::epoch).count(), static_cast<std::int64_t>(ns));
+	}
+
+	/// <summary>
+	/// Times the enclosing scope
+	/// </summary>
+	class Scope {
+		Probe probe;
+		detail::Clock::time_point start;
+	public:
+		explicit Scope(Probe probe)
+			: probe{ probe }, start{ detail::Clock::now() }
+		{ }
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+		~Scope() {
+			Record(probe, start, detail::Clock::now());
+		}
+	};
+
+	/// <summary>
+	/// Merges the counters of all threads
+	/// </summary>
+	inline std::array<ProbeStats, probe_count> Snapshot() {
+		detail::Registry& r = detail::registry();
+		std::lock_guard lock(r.mutex);
+		std::array<ProbeStats, probe_count> stats = r.retired;
+		for (decltype(auto) d : r.live) {
+			if (d->up_to_date()) d->add_to(stats);
+		}
+		return stats;
+	}
+
+	/// <summary>
+	/// Zeroes all counters and drops the recorded trace. Other threads' counters are not written here:
+	/// each thread zeroes its own on its next call, and Snapshot and WriteChromeTrace ignore them until then
+	/// </summary>
+	inline void Reset() {
+		detail::Registry& r = detail::registry();
+		std::lock_guard lock(r.mutex);
+		r.retired = {};
+		r.retired_trace.clear();
+		detail::reset_generation.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/// <summary>
+	/// Prints a table of calls and latencies for every probe that was hit
+	/// </summary>
+	inline void PrintStatistics(std::ostream& out) {
+		if (!Enabled()) {
+			out << "Instrumentation is disabled; rebuild with RECTANGLE_INSTRUMENT\n";
+			return;
+		}
+
+		auto stats = Snapshot();
+		out << std::left << std::setw(20) << "probe" << std::right << std::setw(14) << "calls" << std::setw(12) << "mean ns"
+			<< std::setw(12) << "p50 ns" << std::setw(12) << "p99 ns" << std::setw(14) << "max ns" << '\n';
+		for (std::size_t p = 0; p < probe_count; ++p) {
+			const ProbeStats& s = stats[p];
+			if (s.calls == 0) continue;
+			out << std::left << std::setw(20) << probe_names[p] << std::right << std::setw(14) << s.calls
+				<< std::setw(12) << std::fixed << std::setprecision(1) << s.MeanNs()
+				<< std::setw(12) << s.PercentileNs(0.5) << std::setw(12) << s.PercentileNs(0.99) << std::setw(14) << s.max_ns << '\n';
+		}
+	}
+
+	/// <summary>
+	/// Writes the recorded events in the Chrome trace-event JSON format (chrome://tracing, Perfetto).
+	/// Threads may keep recording meanwhile: an event they are overwriting at that moment is left out
+	/// </summary>
+	inline void WriteChromeTrace(std::ostream& out) {
+		std::vector<TraceEvent> events;
+		{
+			detail::Registry& r = detail::registry();
+			std::lock_guard lock(r.mutex);
+			events = r.retired_trace;
+			for (decltype(auto) d : r.live) {
+				if (d->up_to_date()) d->copy_trace(events);
+			}
+		}
+
+		out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		for (std::size_t i = 0; i < events.size(); ++i) {
+			const TraceEvent& e = events[i];
+			std::size_t p = static_cast<std::size_t>(e.probe);
+			out << (i == 0 ? "\n" : ",\n") << "{\"name\":\"" << probe_names[p] << "\",\"cat\":\""
+				<< (e.probe < Probe::ReadFile ? "geometry" : "interface") << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+				<< std::fixed << std::setprecision(3) << ",\"ts\":" << e.start_ns / 1000.0 << ",\"dur\":" << e.duration_ns / 1000.0 << '}';
+		}
+		out << "\n]}\n";
+	}
+}
@@ -0,0 +1,386 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <stdexcept> // for std::invalid_argument
+#include <vector>
+
+/// <summary>
+/// Size of an item to be packed
+/// </summary>
+struct PackSize {
+	int width = 0;
+	int height = 0;
+};
+
+/// <summary>
+/// Placement rule of MaxRectsBin
+/// </summary>
+enum class MaxRectsHeuristic {
+	BestShortSideFit, // Free rectangle whose shorter leftover side is smallest
+	BestAreaFit       // Free rectangle with the least leftover area
+};
+
+/// <summary>
+/// Result of packing a list of items into one bin
+/// </summary>
+struct PackResult {
+	// Placement of every input item in input order; empty if the item did not fit
+	std::vector<std::optional<Rect<int>>> rects;
+	std::size_t packed = 0;
+	// Used area / bin area
+	double occupancy = 0;
+};
+
+namespace pack_detail {
+	inline void check_size(int width, int height) {
+		if (width < 0 || height < 0)
+			throw std::invalid_argument("Width and height must be non-negative.");
+	}
+
+	/// <summary>
+	/// Inserts the items in the given order and reports placements in input order
+	/// </summary>
+	template<typename Bin, typename Less>
+	std::vector<std::optional<Rect<int>>> insert_sorted(Bin& bin, std::span<const PackSize> sizes, Less less) {
+		for (decltype(auto) s : sizes) check_size(s.width, s.height);
+
+		std::vector<std::size_t> order(sizes.size());
+		std::iota(order.begin(), order.end(), std::size_t{ 0 });
+		std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+			return less(sizes[a], sizes[b]);
+		});
+
+		std::vector<std::optional<Rect<int>>> result(sizes.size());
+		for (std::size_t i : order) result[i] = bin.Insert(sizes[i].width, sizes[i].height);
+		return result;
+	}
+}
+
+/// <summary>
+/// MaxRects bin packer: keeps the list of maximal free rectangles (they may overlap each other)
+/// and puts every item into the bottom-left corner of the best free rectangle.
+/// Packs denser than SkylineBin, but every insertion scans the free list, which grows with the number
+/// of items, so tens of thousands of items in one bin take seconds. Items of zero area are placed
+/// at the origin of the bin and take no space
+/// </summary>
+class MaxRectsBin {
+	int width, height;
+	MaxRectsHeuristic heuristic;
+	std::int64_t used_area = 0;
+	std::vector<Rect<int>> free;
+	std::vector<Rect<int>> new_free; // Scratch for place()
+
+	// Interiors overlap; touching edges do not cut a free rectangle
+	static bool overlaps(const Rect<int>& a, const Rect<int>& b) {
+		return a.Left() < b.Right() && a.Right() > b.Left() && a.Bottom() < b.Top() && a.Top() > b.Bottom();
+	}
+
+	/// <summary>
+	/// Adds a piece of a split free rectangle unless another piece already contains it
+	/// </summary>
+	void add_new_free(const Rect<int>& r) {
+		for (std::size_t i = 0; i < new_free.size();) {
+			if (new_free[i].Contains(r)) return;
+			if (r.Contains(new_free[i])) {
+				new_free[i] = new_free.back();
+				new_free.pop_back();
+			}
+			else ++i;
+		}
+		new_free.push_back(r);
+	}
+
+	/// <summary>
+	/// Cuts the used rectangle out of a free one; returns false if they do not overlap
+	/// </summary>
+	bool split(const Rect<int>& f, const Rect<int>& used) {
+		if (!overlaps(f, used)) return false;
+
+		if (used.Left() > f.Left()) add_new_free(Rect<int>(f.Left(), f.Bottom(), used.Left() - f.Left(), f.height));
+		if (used.Right() < f.Right()) add_new_free(Rect<int>(used.Right(), f.Bottom(), f.Right() - used.Right(), f.height));
+		if (used.Bottom() > f.Bottom()) add_new_free(Rect<int>(f.Left(), f.Bottom(), f.width, used.Bottom() - f.Bottom()));
+		if (used.Top() < f.Top()) add_new_free(Rect<int>(f.Left(), used.Top(), f.width, f.Top() - used.Top()));
+		return true;
+	}
+
+	void place(const Rect<int>& used) {
+		new_free.clear();
+		for (std::size_t i = 0; i < free.size();) {
+			if (split(free[i], used)) {
+				free[i] = free.back();
+				free.pop_back();
+			}
+			else ++i;
+		}
+
+		// A new piece lies inside the free rectangle it was cut from, so an untouched free rectangle
+		// can only contain a new piece, never the other way round
+		std::size_t old_count = free.size();
+		for (decltype(auto) r : new_free) {
+			bool contained = false;
+			for (std::size_t i = 0; i < old_count && !contained; ++i) contained = free[i].Contains(r);
+			if (!contained) free.push_back(r);
+		}
+
+		used_area += static_cast<std::int64_t>(used.width) * used.height;
+	}
+public:
+	MaxRectsBin(int width, int height, MaxRectsHeuristic heuristic = MaxRectsHeuristic::BestShortSideFit)
+		: width{ width }, height{ height }, heuristic{ heuristic }
+	{
+		pack_detail::check_size(width, height);
+		if (width > 0 && height > 0) free.push_back(Rect<int>(0, 0, width, height));
+	}
+
+	/// <summary>
+	/// Places one item; returns its position or nothing if no free rectangle can hold it
+	/// </summary>
+	std::optional<Rect<int>> Insert(int w, int h) {
+		pack_detail::check_size(w, h);
+		if (w == 0 || h == 0) {
+			if (w > width || h > height) return std::nullopt;
+			return Rect<int>(0, 0, w, h);
+		}
+
+		const Rect<int>* best = nullptr;
+		std::int64_t best_primary = 0, best_secondary = 0;
+		for (decltype(auto) f : free) {
+			if (f.width < w || f.height < h) continue;
+
+			std::int64_t dw = f.width - w, dh = f.height - h;
+			std::int64_t primary, secondary;
+			if (heuristic == MaxRectsHeuristic::BestShortSideFit) {
+				primary = std::min(dw, dh);
+				secondary = std::max(dw, dh);
+			}
+			else {
+				primary = static_cast<std::int64_t>(f.width) * f.height - static_cast<std::int64_t>(w) * h;
+				secondary = std::min(dw, dh);
+			}
+
+			if (!best || primary < best_primary || (primary == best_primary && secondary < best_secondary)) {
+				best = &f;
+				best_primary = primary;
+				best_secondary = secondary;
+				if (primary == 0 && secondary == 0) break; // Exact fit
+			}
+		}
+		if (!best) return std::nullopt;
+
+		Rect<int> used(best->origin, w, h);
+		place(used);
+		return used;
+	}
+
+	/// <summary>
+	/// Places a list of items into the bin (which may already hold others), largest side first.
+	/// Returns placements in input order
+	/// </summary>
+	std::vector<std::optional<Rect<int>>> Insert(std::span<const PackSize> sizes) {
+		return pack_detail::insert_sorted(*this, sizes, [](const PackSize& a, const PackSize& b) {
+			int a_long = std::max(a.width, a.height), b_long = std::max(b.width, b.height);
+			if (a_long != b_long) return a_long > b_long;
+			return std::min(a.width, a.height) > std::min(b.width, b.height);
+		});
+	}
+
+	/// <summary>
+	/// Current maximal free rectangles
+	/// </summary>
+	const std::vector<Rect<int>>& FreeRects() const {
+		return free;
+	}
+
+	std::int64_t UsedArea() const {
+		return used_area;
+	}
+
+	/// <summary>
+	/// Used area / bin area
+	/// </summary>
+	double Occupancy() const {
+		std::int64_t area = static_cast<std::int64_t>(width) * height;
+		return area == 0 ? 0 : static_cast<double>(used_area) / area;
+	}
+
+	int Width() const {
+		return width;
+	}
+
+	int Height() const {
+		return height;
+	}
+};
+
+/// <summary>
+/// Skyline bin packer (bottom-left rule): the used part of the bin is described by its upper outline,
+/// and every item goes where its top edge ends up lowest. Faster than MaxRects and uses less memory,
+/// but space below overhangs is lost. Items of zero area are placed at the origin of the bin and take no space
+/// </summary>
+class SkylineBin {
+	struct Segment {
+		int x, y, width;
+	};
+
+	int width, height;
+	std::int64_t used_area = 0;
+	std::vector<Segment> skyline;
+
+	/// <summary>
+	/// Lowest y at which an item of width w starting at segment i rests on the skyline; nothing if it does not fit
+	/// </summary>
+	std::optional<int> fit(std::size_t i, int w, int h) const {
+		if (skyline[i].x > width - w) return std::nullopt;
+
+		int y = skyline[i].y;
+		for (int left = w; left > 0; left -= skyline[i].width, ++i) {
+			y = std::max(y, skyline[i].y);
+			if (y > height - h) return std::nullopt;
+		}
+		return y;
+	}
+
+	void place(std::size_t i, const Rect<int>& used) {
+		skyline.insert(skyline.begin() + i, Segment{ used.Left(), used.Top(), used.width });
+
+		// Cut the segments now covered by the new one
+		std::size_t j = i + 1;
+		while (j < skyline.size()) {
+			int covered = used.Right() - skyline[j].x;
+			if (covered <= 0) break;
+			if (covered < skyline[j].width) {
+				skyline[j].x += covered;
+				skyline[j].width -= covered;
+				break;
+			}
+			++j;
+		}
+		skyline.erase(skyline.begin() + i + 1, skyline.begin() + j);
+
+		// Merge neighbours of equal height
+		if (i + 1 < skyline.size() && skyline[i + 1].y == skyline[i].y) {
+			skyline[i].width += skyline[i + 1].width;
+			skyline.erase(skyline.begin() + i + 1);
+		}
+		if (i > 0 && skyline[i - 1].y == skyline[i].y) {
+			skyline[i - 1].width += skyline[i].width;
+			skyline.erase(skyline.begin() + i);
+		}
+
+		used_area += static_cast<std::int64_t>(used.width) * used.height;
+	}
+public:
+	SkylineBin(int width, int height)
+		: width{ width }, height{ height }
+	{
+		pack_detail::check_size(width, height);
+		if (width > 0) skyline.push_back(Segment{ 0, 0, width });
+	}
+
+	/// <summary>
+	/// Places one item; returns its position or nothing if it does not fit anywhere on the skyline
+	/// </summary>
+	std::optional<Rect<int>> Insert(int w, int h) {
+		pack_detail::check_size(w, h);
+		if (w == 0 || h == 0) {
+			if (w > width || h > height) return std::nullopt;
+			return Rect<int>(0, 0, w, h);
+		}
+
+		std::size_t best = skyline.size();
+		int best_y = 0, best_top = 0, best_width = 0;
+		for (std::size_t i = 0; i < skyline.size(); ++i) {
+			auto y = fit(i, w, h);
+			if (!y) continue;
+
+			int top = *y + h;
+			if (best == skyline.size() || top < best_top || (top == best_top && skyline[i].width < best_width)) {
+				best = i;
+				best_y = *y;
+				best_top = top;
+				best_width = skyline[i].width;
+			}
+		}
+		if (best == skyline.size()) return std::nullopt;
+
+		Rect<int> used(skyline[best].x, best_y, w, h);
+		place(best, used);
+		return used;
+	}
+
+	/// <summary>
+	/// Places a list of items into the bin (which may already hold others), tallest first.
+	/// Returns placements in input order
+	/// </summary>
+	std::vector<std::optional<Rect<int>>> Insert(std::span<const PackSize> sizes) {
+		return pack_detail::insert_sorted(*this, sizes, [](const PackSize& a, const PackSize& b) {
+			if (a.height != b.height) return a.height > b.height;
+			return a.width > b.width;
+		});
+	}
+
+	/// <summary>
+	/// Number of segments of the outline
+	/// </summary>
+	std::size_t SkylineSize() const {
+		return skyline.size();
+	}
+
+	std::int64_t UsedArea() const {
+		return used_area;
+	}
+
+	/// <summary>
+	/// Used area / bin area
+	/// </summary>
+	double Occupancy() const {
+		std::int64_t area = static_cast<std::int64_t>(width) * height;
+		return area == 0 ? 0 : static_cast<double>(used_area) / area;
+	}
+
+	int Width() const {
+		return width;
+	}
+
+	int Height() const {
+		return height;
+	}
+};
+
+/// <summary>
+/// Packing algorithm for Pack
+/// </summary>
+enum class PackMethod {
+	MaxRectsBestShortSideFit,
+	MaxRectsBestAreaFit,
+	Skyline
+};
+
+/// <summary>
+/// Packs the items into an empty bin of the given size
+/// </summary>
+inline PackResult Pack(std::span<const PackSize> sizes, int width, int height, PackMethod method = PackMethod::MaxRectsBestShortSideFit) {
+	PackResult result;
+	if (method == PackMethod::Skyline) {
+		SkylineBin bin(width, height);
+		result.rects = bin.Insert(sizes);
+		result.occupancy = bin.Occupancy();
+	}
+	else {
+		MaxRectsBin bin(width, height, method == PackMethod::MaxRectsBestAreaFit ? MaxRectsHeuristic::BestAreaFit : MaxRectsHeuristic::BestShortSideFit);
+		result.rects = bin.Insert(sizes);
+		result.occupancy = bin.Occupancy();
+	}
+	result.packed = static_cast<std::size_t>(std::count_if(result.rects.begin(), result.rects.end(),
+		[](const std::optional<Rect<int>>& r) { return r.has_value(); }));
+	return result;
+}
+
+inline PackResult Pack(const std::vector<PackSize>& sizes, int width, int height, PackMethod method = PackMethod::MaxRectsBestShortSideFit) {
+	return Pack(std::span<const PackSize>(sizes), width, height, method);
+}
@@ -0,0 +1,225 @@
+﻿#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/// <summary>
+/// Returns the number of worker threads to use when the caller passes 0
+/// </summary>
+inline std::size_t HardwareThreads() {
+	unsigned n = std::thread::hardware_concurrency();
+	return n == 0 ? 1 : n;
+}
+
+/// <summary>
+/// Persistent pool behind ParallelFor. Every participant starts with a contiguous share of the tasks and
+/// takes them from the front; a participant that runs out steals the back half of another one's share.
+/// Workers are created on first use and sleep between jobs, so short parallel loops do not pay for thread start-up.
+/// One job runs at a time; ParallelFor called from inside a job runs serially
+/// </summary>
+class ThreadPool {
+	// Remaining tasks of one participant: begin in the low 32 bits, end in the high 32 bits
+	struct alignas(64) Share {
+		std::atomic<std::uint64_t> bounds{ 0 };
+	};
+
+	static std::uint64_t pack(std::uint64_t begin, std::uint64_t end) {
+		return begin | (end << 32);
+	}
+
+	std::mutex job_mutex; // Serializes jobs
+
+	std::mutex mutex;
+	std::condition_variable wake, finished;
+	std::vector<std::thread> workers;
+	std::unique_ptr<Share[]> shares;
+	std::size_t share_count = 0;
+	std::uint64_t generation = 0;
+	std::size_t participants = 0, running = 0;
+	bool stop = false;
+
+	// Current job
+	void (*invoke)(void*, std::size_t, std::size_t) = nullptr;
+	void* context = nullptr;
+	std::size_t offset = 0;
+	std::atomic<bool> cancelled{ false };
+	std::exception_ptr error;
+
+	static bool& inside_job() {
+		thread_local bool inside = false;
+		return inside;
+	}
+
+	bool pop(std::size_t id, std::size_t& task) {
+		std::atomic<std::uint64_t>& own = shares[id].bounds;
+		std::uint64_t b = own.load(std::memory_order_relaxed);
+		while (true) {
+			std::uint64_t begin = b & 0xFFFFFFFFu, end = b >> 32;
+			if (begin >= end) return false;
+			if (own.compare_exchange_weak(b, pack(begin + 1, end), std::memory_order_acq_rel)) {
+				task = begin;
+				return true;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Moves the back half of a victim's share (or its last task) into the thief's empty share
+	/// </summary>
+	bool steal(std::size_t thief, std::size_t victim) {
+		std::atomic<std::uint64_t>& from = shares[victim].bounds;
+		std::uint64_t b = from.load(std::memory_order_relaxed);
+		while (true) {
+			std::uint64_t begin = b & 0xFFFFFFFFu, end = b >> 32;
+			if (begin >= end) return false;
+			std::uint64_t mid = begin + (end - begin) / 2;
+			if (from.compare_exchange_weak(b, pack(begin, mid), std::memory_order_acq_rel)) {
+				shares[thief].bounds.store(pack(mid, end), std::memory_order_release);
+				return true;
+			}
+		}
+	}
+
+	void work(std::size_t id) {
+		inside_job() = true;
+		try {
+			std::size_t task;
+			while (!cancelled.load(std::memory_order_relaxed)) {
+				if (pop(id, task)) {
+					invoke(context, offset + task, id);
+					continue;
+				}
+				bool stolen = false;
+				for (std::size_t k = 1; k < participants && !stolen; ++k) stolen = steal(id, (id + k) % participants);
+				if (!stolen) break;
+			}
+		}
+		catch (...) {
+			std::lock_guard lock(mutex);
+			if (!error) error = std::current_exception();
+			cancelled = true;
+		}
+		inside_job() = false;
+	}
+
+	void worker_loop(std::size_t id) {
+		std::uint64_t seen = 0;
+		while (true) {
+			{
+				std::unique_lock lock(mutex);
+				wake.wait(lock, [&] { return stop || generation != seen; });
+				if (stop) return;
+				seen = generation;
+				if (id >= participants) continue;
+			}
+			work(id);
+			std::lock_guard lock(mutex);
+			if (--running == 0) finished.notify_one();
+		}
+	}
+
+	/// <summary>
+	/// Runs tasks [first, first + count) with count below 2^32
+	/// </summary>
+	void run_slice(std::size_t first, std::size_t count, std::size_t threads) {
+		{
+			std::lock_guard lock(mutex);
+			while (workers.size() + 1 < threads) {
+				std::size_t id = workers.size() + 1;
+				workers.emplace_back([this, id] { worker_loop(id); });
+			}
+			if (share_count < threads) {
+				shares = std::make_unique<Share[]>(threads);
+				share_count = threads;
+			}
+			for (std::size_t i = 0; i < threads; ++i) {
+				shares[i].bounds.store(pack(count * i / threads, count * (i + 1) / threads), std::memory_order_relaxed);
+			}
+			offset = first;
+			participants = threads;
+			running = threads - 1;
+			++generation;
+		}
+		wake.notify_all();
+
+		work(0);
+
+		std::unique_lock lock(mutex);
+		finished.wait(lock, [&] { return running == 0; });
+	}
+
+public:
+	ThreadPool() = default;
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	~ThreadPool() {
+		{
+			std::lock_guard lock(mutex);
+			stop = true;
+		}
+		wake.notify_all();
+		for (decltype(auto) t : workers) t.join();
+	}
+
+	/// <summary>
+	/// The pool used by ParallelFor
+	/// </summary>
+	static ThreadPool& Shared() {
+		static ThreadPool pool;
+		return pool;
+	}
+
+	/// <summary>
+	/// Indicates whether the calling thread is running a task of a pool job
+	/// </summary>
+	static bool InsideJob() {
+		return inside_job();
+	}
+
+	/// <summary>
+	/// Calls f(task, worker) for every task in [0, tasks) on `threads` participants (the caller is worker 0).
+	/// The first exception thrown by a task cancels the rest and is rethrown here
+	/// </summary>
+	template<typename F>
+	void Run(std::size_t tasks, std::size_t threads, F& f) {
+		std::lock_guard job(job_mutex);
+		invoke = [](void* ctx, std::size_t task, std::size_t worker) { (*static_cast<F*>(ctx))(task, worker); };
+		context = const_cast<void*>(static_cast<const void*>(&f));
+		cancelled = false;
+		error = nullptr;
+
+		constexpr std::size_t max_slice = 0xFFFFFFFFu;
+		for (std::size_t first = 0; first < tasks && !cancelled; first += max_slice) {
+			run_slice(first, std::min(max_slice, tasks - first), threads);
+		}
+
+		if (error) std::rethrow_exception(error);
+	}
+};
+
+/// <summary>
+/// Calls f(task, worker) for every task in [0, tasks) on up to `threads` threads (0 = all cores).
+/// Runs on the shared work-stealing ThreadPool, so uneven tasks still balance across workers.
+/// The first exception thrown by a task is rethrown in the calling thread
+/// </summary>
+template<typename F>
+void ParallelFor(std::size_t tasks, std::size_t threads, F&& f) {
+	if (threads == 0) threads = HardwareThreads();
+	threads = std::min(threads, tasks);
+
+	if (threads <= 1 || ThreadPool::InsideJob()) {
+		for (std::size_t t = 0; t < tasks; ++t) f(t, std::size_t{ 0 });
+		return;
+	}
+
+	ThreadPool::Shared().Run(tasks, threads, f);
+}
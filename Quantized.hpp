@@ -0,0 +1,351 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include "Parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <stdexcept> // for std::invalid_argument
+#include <type_traits>
+#include <vector>
+
+/// <summary>
+/// Rectangles quantized to Code-bit integer coordinates relative to a frame (the bounding box of the set),
+/// as in the quantized AABBs of a BVH. A uint16_t box takes 8 bytes and a uint8_t box 4 bytes, against 32 for Rect&lt;double&gt;.
+/// Encoding is conservative: the left and bottom edges are rounded down and the right and top edges up,
+/// so the decoded rectangle always contains the original. The overlap and containment tests compare codes
+/// against thresholds prepared once per query; they give exactly the answer of the decoded rectangle,
+/// i.e. they may report false positives but never miss a rectangle
+/// </summary>
+template<typename Type, typename Code = std::uint16_t>
+class QuantizedRects {
+	static_assert(std::is_arithmetic_v<Type>, "Type must be arithmetic");
+	static_assert(std::is_unsigned_v<Code> && sizeof(Code) <= 4, "Code must be an unsigned integer of at most 32 bits");
+
+public:
+	struct Box {
+		Code left, bottom, right, top;
+	};
+
+	/// <summary>
+	/// Thresholds of a query window on both axes, see Prepare
+	/// </summary>
+	struct Window {
+		// A box overlaps the window iff right >= x_from, left <= x_to (and the same along Y);
+		// it contains the window iff left <= x_in, right >= x_out
+		std::int64_t x_from, x_to, x_in, x_out;
+		std::int64_t y_from, y_to, y_in, y_out;
+	};
+
+	/// <summary>
+	/// Number of steps between the edges of the frame; codes run from 0 to Levels()
+	/// </summary>
+	static constexpr std::int64_t Levels() {
+		return std::numeric_limits<Code>::max();
+	}
+
+private:
+	/// <summary>
+	/// Code c stands for the edge low + c * step, rounded down for left/bottom edges and up for right/top edges
+	/// </summary>
+	struct Axis {
+		Type low{}, high{};
+		double origin = 0, step = 0;
+
+		Axis() = default;
+
+		Axis(Type low, Type high)
+			: low{ low }, high{ high }, origin{ static_cast<double>(low) },
+			step{ (static_cast<double>(high) - static_cast<double>(low)) / static_cast<double>(Levels()) }
+		{ }
+
+		static Type round_down(double v) {
+			if constexpr (std::is_integral_v<Type>) return static_cast<Type>(std::floor(v));
+			else {
+				Type t = static_cast<Type>(v);
+				return t > v ? std::nextafter(t, -std::numeric_limits<Type>::infinity()) : t;
+			}
+		}
+
+		static Type round_up(double v) {
+			if constexpr (std::is_integral_v<Type>) return static_cast<Type>(std::ceil(v));
+			else {
+				Type t = static_cast<Type>(v);
+				return t < v ? std::nextafter(t, std::numeric_limits<Type>::infinity()) : t;
+			}
+		}
+
+		// Both are non-decreasing in c, lower(0) == low and upper(Levels()) == high
+		Type lower(std::int64_t c) const {
+			double v = origin + static_cast<double>(c) * step;
+			return v >= static_cast<double>(high) ? high : std::max(low, round_down(v));
+		}
+
+		Type upper(std::int64_t c) const {
+			if (c == Levels()) return high;
+			double v = origin + static_cast<double>(c) * step;
+			return v >= static_cast<double>(high) ? high : std::max(low, std::min(high, round_up(v)));
+		}
+
+		std::int64_t estimate(Type x) const {
+			if (step <= 0) return 0;
+			double c = (static_cast<double>(x) - origin) / step;
+			return static_cast<std::int64_t>(std::clamp(c, 0.0, static_cast<double>(Levels())));
+		}
+
+		/// <summary>
+		/// Last code in [-1, Levels()] for which pred holds, pred being true up to some code and false after it
+		/// (pred(-1) is taken as true). Gallops from the guess, so a good guess costs a couple of evaluations
+		/// </summary>
+		template<typename Pred>
+		static std::int64_t last_true(std::int64_t guess, Pred&& pred) {
+			std::int64_t lo, hi, stride = 1;
+			if (pred(guess)) {
+				lo = guess;
+				hi = guess + 1;
+				while (hi <= Levels() && pred(hi)) {
+					lo = hi;
+					stride *= 2;
+					hi = lo + stride;
+				}
+				hi = std::min(hi, Levels() + 1);
+			}
+			else {
+				hi = guess;
+				lo = guess - 1;
+				while (lo >= 0 && !pred(lo)) {
+					hi = lo;
+					stride *= 2;
+					lo = hi - stride;
+				}
+				lo = std::max<std::int64_t>(lo, -1);
+			}
+			while (hi - lo > 1) {
+				std::int64_t mid = lo + (hi - lo) / 2;
+				(pred(mid) ? lo : hi) = mid;
+			}
+			return lo;
+		}
+
+		/// <summary>
+		/// Last code whose lower edge is at or before x (-1 if none)
+		/// </summary>
+		std::int64_t code_down(Type x) const {
+			if (x < low) return -1;
+			return last_true(estimate(x), [&](std::int64_t c) { return lower(c) <= x; });
+		}
+
+		/// <summary>
+		/// First code whose upper edge is at or after x (Levels() + 1 if none)
+		/// </summary>
+		std::int64_t code_up(Type x) const {
+			if (x > high) return Levels() + 1;
+			return last_true(estimate(x), [&](std::int64_t c) { return upper(c) < x; }) + 1;
+		}
+	};
+
+	Axis x, y;
+	std::vector<Box> boxes;
+
+	// Boxes per task of the batched decode
+	static constexpr std::size_t block = 4096;
+
+	/// <summary>
+	/// Width such that from + width >= to in Type arithmetic
+	/// </summary>
+	static Type extent(Type from, Type to) {
+		Type w = to - from;
+		if constexpr (std::is_floating_point_v<Type>) {
+			while (from + w < to) w = std::nextafter(w, std::numeric_limits<Type>::infinity());
+		}
+		return w;
+	}
+
+	Box encode(const Rect<Type>& r) const {
+		if (r.Left() < x.low || r.Right() > x.high || r.Bottom() < y.low || r.Top() > y.high)
+			throw std::invalid_argument("The rectangle lies outside the frame.");
+		return { static_cast<Code>(x.code_down(r.Left())), static_cast<Code>(y.code_down(r.Bottom())),
+			static_cast<Code>(x.code_up(r.Right())), static_cast<Code>(y.code_up(r.Top())) };
+	}
+
+	static bool overlaps(const Box& b, const Window& w) {
+		return b.right >= w.x_from && b.left <= w.x_to && b.top >= w.y_from && b.bottom <= w.y_to;
+	}
+
+	static bool contains(const Box& b, const Window& w) {
+		return b.left <= w.x_in && b.right >= w.x_out && b.bottom <= w.y_in && b.top >= w.y_out;
+	}
+
+public:
+	/// <summary>
+	/// Creates an empty set with a zero frame
+	/// </summary>
+	QuantizedRects() = default;
+
+	/// <summary>
+	/// Creates an empty set; Push accepts rectangles lying inside the frame
+	/// </summary>
+	explicit QuantizedRects(const Rect<Type>& frame)
+		: x{ frame.Left(), frame.Right() }, y{ frame.Bottom(), frame.Top() }
+	{ }
+
+	/// <summary>
+	/// Encodes the rectangles with their bounding box as the frame
+	/// </summary>
+	explicit QuantizedRects(std::span<const Rect<Type>> rects, std::size_t threads = 0) {
+		if (rects.empty()) return;
+		Type left = rects[0].Left(), bottom = rects[0].Bottom(), right = rects[0].Right(), top = rects[0].Top();
+		for (decltype(auto) r : rects) {
+			left = std::min(left, r.Left());
+			bottom = std::min(bottom, r.Bottom());
+			right = std::max(right, r.Right());
+			top = std::max(top, r.Top());
+		}
+		x = Axis(left, right);
+		y = Axis(bottom, top);
+
+		boxes.resize(rects.size());
+		ParallelFor((rects.size() + block - 1) / block, threads, [&](std::size_t task, std::size_t) {
+			std::size_t end = std::min(rects.size(), (task + 1) * block);
+			for (std::size_t i = task * block; i < end; ++i) boxes[i] = encode(rects[i]);
+		});
+	}
+
+	explicit QuantizedRects(const std::vector<Rect<Type>>& rects, std::size_t threads = 0)
+		: QuantizedRects(std::span<const Rect<Type>>(rects), threads)
+	{ }
+
+	/// <summary>
+	/// Encodes a rectangle and appends it; throws std::invalid_argument if it lies outside the frame
+	/// </summary>
+	void Push(const Rect<Type>& r) {
+		boxes.push_back(encode(r));
+	}
+
+	std::size_t Size() const {
+		return boxes.size();
+	}
+
+	bool Empty() const {
+		return boxes.empty();
+	}
+
+	/// <summary>
+	/// Bytes taken by the boxes
+	/// </summary>
+	std::size_t MemoryBytes() const {
+		return boxes.size() * sizeof(Box);
+	}
+
+	/// <summary>
+	/// Rectangle the codes are relative to (its right and top edges are never below those of the frame)
+	/// </summary>
+	Rect<Type> Frame() const {
+		return Rect<Type>(Point<Type>(x.low, y.low), extent(x.low, x.high), extent(y.low, y.high));
+	}
+
+	const std::vector<Box>& Boxes() const {
+		return boxes;
+	}
+
+	/// <summary>
+	/// Returns the decoded rectangle, which contains the encoded one
+	/// </summary>
+	Rect<Type> Decode(std::size_t i) const {
+		const Box& b = boxes[i];
+		Type left = x.lower(b.left), bottom = y.lower(b.bottom);
+		return Rect<Type>(Point<Type>(left, bottom), extent(left, x.upper(b.right)), extent(bottom, y.upper(b.top)));
+	}
+
+	/// <summary>
+	/// Decodes all rectangles into out (resized to Size()) on up to `threads` threads (0 = all cores)
+	/// </summary>
+	void Decode(std::vector<Rect<Type>>& out, std::size_t threads = 0) const {
+		out.resize(boxes.size());
+		ParallelFor((boxes.size() + block - 1) / block, threads, [&](std::size_t task, std::size_t) {
+			std::size_t end = std::min(boxes.size(), (task + 1) * block);
+			for (std::size_t i = task * block; i < end; ++i) out[i] = Decode(i);
+		});
+	}
+
+	std::vector<Rect<Type>> Decode() const {
+		std::vector<Rect<Type>> out;
+		Decode(out);
+		return out;
+	}
+
+	/// <summary>
+	/// Computes the code thresholds of a window; a window may lie partly or wholly outside the frame
+	/// </summary>
+	Window Prepare(const Rect<Type>& window) const {
+		return { x.code_up(window.Left()), x.code_down(window.Right()), x.code_down(window.Left()), x.code_up(window.Right()),
+			y.code_up(window.Bottom()), y.code_down(window.Top()), y.code_down(window.Bottom()), y.code_up(window.Top()) };
+	}
+
+	/// <summary>
+	/// Indicates whether the decoded rectangle i overlaps the window (always true if the original does)
+	/// </summary>
+	bool MayOverlap(std::size_t i, const Window& window) const {
+		return overlaps(boxes[i], window);
+	}
+
+	/// <summary>
+	/// Indicates whether the decoded rectangle i contains the window (always true if the original does)
+	/// </summary>
+	bool MayContain(std::size_t i, const Window& window) const {
+		return contains(boxes[i], window);
+	}
+
+	/// <summary>
+	/// Calls f(index) for every rectangle whose decoded form overlaps the window:
+	/// a superset of the rectangles that overlap it
+	/// </summary>
+	template<typename F>
+	void Search(const Rect<Type>& window, F&& f) const {
+		Window w = Prepare(window);
+		for (std::size_t i = 0; i < boxes.size(); ++i) {
+			if (overlaps(boxes[i], w)) f(i);
+		}
+	}
+
+	std::vector<std::size_t> Search(const Rect<Type>& window) const {
+		std::vector<std::size_t> result;
+		Search(window, [&](std::size_t i) { result.push_back(i); });
+		return result;
+	}
+
+	/// <summary>
+	/// Calls f(index) for every rectangle whose decoded form contains the point:
+	/// a superset of the rectangles that contain it
+	/// </summary>
+	template<typename F>
+	void SearchPoint(const Point<Type>& p, F&& f) const {
+		Search(Rect<Type>(p, 0, 0), f);
+	}
+
+	std::vector<std::size_t> SearchPoint(const Point<Type>& p) const {
+		std::vector<std::size_t> result;
+		SearchPoint(p, [&](std::size_t i) { result.push_back(i); });
+		return result;
+	}
+
+	/// <summary>
+	/// Calls f(index) for every rectangle whose decoded form contains r:
+	/// a superset of the rectangles that contain it
+	/// </summary>
+	template<typename F>
+	void SearchContaining(const Rect<Type>& r, F&& f) const {
+		Window w = Prepare(r);
+		for (std::size_t i = 0; i < boxes.size(); ++i) {
+			if (contains(boxes[i], w)) f(i);
+		}
+	}
+
+	std::vector<std::size_t> SearchContaining(const Rect<Type>& r) const {
+		std::vector<std::size_t> result;
+		SearchContaining(r, [&](std::size_t i) { result.push_back(i); });
+		return result;
+	}
+};
@@ -0,0 +1,329 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <span>
+#include <stdexcept> // for std::invalid_argument
+#include <vector>
+
+/// <summary>
+/// Static R-tree over a set of rectangles, bulk-loaded with Sort-Tile-Recursive packing.
+/// All nodes live in one flat array, level by level from the leaves up to the root
+/// </summary>
+template<typename Type>
+class RTree {
+	static_assert(std::is_arithmetic_v<Type>, "Type must be arithmetic");
+public:
+	/// <summary>
+	/// Bounding box of a subtree (or of an item on the leaf level)
+	/// </summary>
+	struct Entry {
+		Rect<Type> box;
+		// Leaf level: index of the rectangle in the input. Upper levels: position of the first child
+		std::size_t index;
+	};
+
+	/// <summary>
+	/// Result of a nearest-neighbour query
+	/// </summary>
+	struct Neighbor {
+		std::size_t index;
+		double distance;
+	};
+
+	/// <summary>
+	/// Working memory of Nearest. Keep one per thread and pass it to every query:
+	/// once it has grown, queries do not allocate
+	/// </summary>
+	class NearestScratch {
+		friend class RTree;
+
+		struct Candidate {
+			double distance2;
+			std::size_t pos, level;
+
+			bool operator>(const Candidate& other) const {
+				return distance2 > other.distance2;
+			}
+		};
+		std::vector<Candidate> heap;
+	};
+
+private:
+	std::size_t node_size = 16;
+	std::size_t count = 0;
+	std::vector<Entry> entries;
+	// levels[l] is the end of level l in entries (level 0 = items)
+	std::vector<std::size_t> levels;
+
+	static double center_x(const Rect<Type>& r) {
+		return static_cast<double>(r.Left()) + static_cast<double>(r.width) / 2;
+	}
+	static double center_y(const Rect<Type>& r) {
+		return static_cast<double>(r.Bottom()) + static_cast<double>(r.height) / 2;
+	}
+
+	/// <summary>
+	/// Orders one level into tiles: vertical slices by center X, then runs by center Y inside each slice
+	/// </summary>
+	void sort_tiles(std::size_t begin, std::size_t end) {
+		auto first = entries.begin() + begin;
+		auto last = entries.begin() + end;
+		std::size_t n = end - begin;
+		std::size_t nodes = (n + node_size - 1) / node_size;
+		std::size_t slices = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(nodes))));
+		std::size_t slice_len = slices * node_size;
+
+		std::sort(first, last, [](const Entry& a, const Entry& b) {
+			return center_x(a.box) < center_x(b.box);
+		});
+		for (std::size_t s = 0; s < n; s += slice_len) {
+			std::sort(first + s, first + std::min(n, s + slice_len), [](const Entry& a, const Entry& b) {
+				return center_y(a.box) < center_y(b.box);
+			});
+		}
+	}
+
+	template<typename Descend, typename Accept, typename F>
+	void search(Descend&& descend, Accept&& accept, F&& f) const {
+		if (entries.empty()) return;
+
+		struct Frame {
+			std::size_t pos, level;
+		};
+		// Depth is logarithmic, so the stack stays small
+		std::vector<Frame> stack{ { entries.size() - 1, levels.size() - 1 } };
+
+		while (!stack.empty()) {
+			Frame frame = stack.back();
+			stack.pop_back();
+
+			const Entry& e = entries[frame.pos];
+			if (frame.level == 0) {
+				if (accept(e.box)) f(e.index);
+				continue;
+			}
+			if (!descend(e.box)) continue;
+
+			std::size_t child_end = std::min(e.index + node_size, levels[frame.level - 1]);
+			for (std::size_t c = e.index; c < child_end; ++c) {
+				stack.push_back({ c, frame.level - 1 });
+			}
+		}
+	}
+
+public:
+	/// <summary>
+	/// Creates an empty tree
+	/// </summary>
+	RTree() = default;
+
+	/// <summary>
+	/// Builds the tree over the rectangles; the callbacks of the queries receive indices into rects
+	/// </summary>
+	explicit RTree(std::span<const Rect<Type>> rects, std::size_t node_size = 16)
+		: node_size{ node_size }, count{ rects.size() }
+	{
+		if (node_size < 2)
+			throw std::invalid_argument("Node size must be at least 2.");
+		if (rects.empty()) return;
+
+		entries.reserve(rects.size() + rects.size() / (node_size - 1) + 1);
+		for (std::size_t i = 0; i < rects.size(); ++i) {
+			entries.push_back({ rects[i], i });
+		}
+
+		std::size_t begin = 0, end = entries.size();
+		levels.push_back(end);
+
+		// A lone item still gets a root node above it, so the root is never a leaf entry
+		do {
+			sort_tiles(begin, end);
+			for (std::size_t first = begin; first < end; first += node_size) {
+				std::size_t last = std::min(first + node_size, end);
+				Rect<Type> box = entries[first].box;
+				for (std::size_t c = first + 1; c < last; ++c) {
+					box = box.Union(entries[c].box);
+				}
+				entries.push_back({ box, first });
+			}
+			begin = end;
+			end = entries.size();
+			levels.push_back(end);
+		} while (end - begin > 1);
+	}
+
+	/// <summary>
+	/// Returns the number of indexed rectangles
+	/// </summary>
+	std::size_t Size() const {
+		return count;
+	}
+
+	bool Empty() const {
+		return count == 0;
+	}
+
+	/// <summary>
+	/// Returns the number of levels including the leaf level
+	/// </summary>
+	std::size_t Height() const {
+		return levels.size();
+	}
+
+	/// <summary>
+	/// Returns the bounding box of all rectangles
+	/// </summary>
+	Rect<Type> Bounds() const {
+		return entries.empty() ? Rect<Type>() : entries.back().box;
+	}
+
+	/// <summary>
+	/// Returns the flat node array (leaf entries first, root last)
+	/// </summary>
+	const std::vector<Entry>& Entries() const {
+		return entries;
+	}
+
+	/// <summary>
+	/// Returns the end offsets of every level in Entries()
+	/// </summary>
+	const std::vector<std::size_t>& Levels() const {
+		return levels;
+	}
+
+	/// <summary>
+	/// Returns the number of children per node
+	/// </summary>
+	std::size_t NodeSize() const {
+		return node_size;
+	}
+
+	/// <summary>
+	/// Calls f(index) for every rectangle that overlaps the window
+	/// </summary>
+	template<typename F>
+	void Search(const Rect<Type>& window, F&& f) const {
+		auto overlaps = [&](const Rect<Type>& box) { return box.Overlaps(window); };
+		search(overlaps, overlaps, f);
+	}
+
+	/// <summary>
+	/// Returns the indices of the rectangles that overlap the window
+	/// </summary>
+	std::vector<std::size_t> Search(const Rect<Type>& window) const {
+		std::vector<std::size_t> result;
+		Search(window, [&](std::size_t i) { result.push_back(i); });
+		return result;
+	}
+
+	/// <summary>
+	/// Calls f(index) for every rectangle that contains the point
+	/// </summary>
+	template<typename F>
+	void SearchPoint(const Point<Type>& p, F&& f) const {
+		auto contains = [&](const Rect<Type>& box) { return box.Contains(p); };
+		search(contains, contains, f);
+	}
+
+	/// <summary>
+	/// Returns the indices of the rectangles that contain the point
+	/// </summary>
+	std::vector<std::size_t> SearchPoint(const Point<Type>& p) const {
+		std::vector<std::size_t> result;
+		SearchPoint(p, [&](std::size_t i) { result.push_back(i); });
+		return result;
+	}
+
+	/// <summary>
+	/// Calls f(index) for every rectangle lying entirely inside the window
+	/// </summary>
+	template<typename F>
+	void SearchContained(const Rect<Type>& window, F&& f) const {
+		search([&](const Rect<Type>& box) { return box.Overlaps(window); },
+			[&](const Rect<Type>& box) { return window.Contains(box); }, f);
+	}
+
+	/// <summary>
+	/// Returns the indices of the rectangles lying entirely inside the window
+	/// </summary>
+	std::vector<std::size_t> SearchContained(const Rect<Type>& window) const {
+		std::vector<std::size_t> result;
+		SearchContained(window, [&](std::size_t i) { result.push_back(i); });
+		return result;
+	}
+
+	/// <summary>
+	/// Calls f(index) for every rectangle that contains the given rectangle
+	/// </summary>
+	template<typename F>
+	void SearchContaining(const Rect<Type>& r, F&& f) const {
+		auto contains = [&](const Rect<Type>& box) { return box.Contains(r); };
+		search(contains, contains, f);
+	}
+
+	/// <summary>
+	/// Returns the indices of the rectangles that contain the given rectangle
+	/// </summary>
+	std::vector<std::size_t> SearchContaining(const Rect<Type>& r) const {
+		std::vector<std::size_t> result;
+		SearchContaining(r, [&](std::size_t i) { result.push_back(i); });
+		return result;
+	}
+
+	/// <summary>
+	/// Calls f(index, distance) for the k rectangles closest to the point, nearest first
+	/// (distance is Euclidean, 0 for rectangles containing the point). Nodes are visited best-first
+	/// by the distance to their bounding box, so only the part of the tree near the point is read
+	/// </summary>
+	template<typename F>
+	void Nearest(const Point<Type>& p, std::size_t k, NearestScratch& scratch, F&& f) const {
+		auto& heap = scratch.heap;
+		heap.clear();
+		if (entries.empty() || k == 0) return;
+
+		auto push = [&](std::size_t pos, std::size_t level) {
+			heap.push_back({ entries[pos].box.DistanceSquared(p), pos, level });
+			std::push_heap(heap.begin(), heap.end(), std::greater<>{});
+		};
+		push(entries.size() - 1, levels.size() - 1);
+
+		// A leaf's key is its exact distance and a node's key never exceeds its children's,
+		// so leaves come off the heap in order of distance
+		while (!heap.empty()) {
+			std::pop_heap(heap.begin(), heap.end(), std::greater<>{});
+			auto top = heap.back();
+			heap.pop_back();
+
+			const Entry& e = entries[top.pos];
+			if (top.level == 0) {
+				f(e.index, std::sqrt(top.distance2));
+				if (--k == 0) return;
+				continue;
+			}
+
+			std::size_t child_end = std::min(e.index + node_size, levels[top.level - 1]);
+			for (std::size_t c = e.index; c < child_end; ++c) push(c, top.level - 1);
+		}
+	}
+
+	/// <summary>
+	/// Fills out with the k rectangles closest to the point, nearest first; reuses the storage of out and scratch
+	/// </summary>
+	void Nearest(const Point<Type>& p, std::size_t k, NearestScratch& scratch, std::vector<Neighbor>& out) const {
+		out.clear();
+		Nearest(p, k, scratch, [&](std::size_t i, double d) { out.push_back({ i, d }); });
+	}
+
+	/// <summary>
+	/// Returns the k rectangles closest to the point, nearest first
+	/// </summary>
+	std::vector<Neighbor> Nearest(const Point<Type>& p, std::size_t k) const {
+		NearestScratch scratch;
+		std::vector<Neighbor> out;
+		Nearest(p, k, scratch, out);
+		return out;
+	}
+};
@@ -0,0 +1,659 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept> // for std::invalid_argument
+#include <vector>
+
+// Instruction set selection: AVX2 > SSE4.1 > SSE2 > scalar
+#if defined(__AVX2__)
+#define RECT_SIMD_AVX2
+#endif
+#if defined(__SSE4_1__) || defined(__AVX__)
+#define RECT_SIMD_SSE41
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RECT_SIMD_SSE2
+#endif
+
+#if defined(RECT_SIMD_AVX2)
+#include <immintrin.h>
+#elif defined(RECT_SIMD_SSE41)
+#include <smmintrin.h>
+#elif defined(RECT_SIMD_SSE2)
+#include <emmintrin.h>
+#endif
+
+/// <summary>
+/// Allocator returning memory aligned to the given boundary (defaults to a cache line)
+/// </summary>
+template<typename T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+	using value_type = T;
+
+	template<typename U>
+	struct rebind {
+		using other = AlignedAllocator<U, Alignment>;
+	};
+
+	AlignedAllocator() noexcept = default;
+
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept
+	{ }
+
+	T* allocate(std::size_t n) {
+		return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+	}
+
+	void deallocate(T* p, std::size_t) noexcept {
+		::operator delete(p, std::align_val_t(Alignment));
+	}
+
+	template<typename U>
+	bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept {
+		return true;
+	}
+	template<typename U>
+	bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept {
+		return false;
+	}
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+namespace rect_simd {
+
+	/// <summary>
+	/// Vector operations for the element type. Types without a specialization use the scalar Rect methods
+	/// </summary>
+	template<typename T>
+	struct Ops {
+		static constexpr bool enabled = false;
+	};
+
+#if defined(RECT_SIMD_AVX2)
+	template<>
+	struct Ops<float> {
+		static constexpr bool enabled = true;
+		static constexpr std::size_t lanes = 8;
+		using V = __m256;
+
+		static V load(const float* p) { return _mm256_loadu_ps(p); }
+		static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+		static V set1(float v) { return _mm256_set1_ps(v); }
+		static V add(V a, V b) { return _mm256_add_ps(a, b); }
+		static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+		static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+		static V min(V a, V b) { return _mm256_min_ps(a, b); }
+		static V max(V a, V b) { return _mm256_max_ps(a, b); }
+		static V lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+		static V ge(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+		static V le(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+		static V mask_or(V a, V b) { return _mm256_or_ps(a, b); }
+		static V mask_and(V a, V b) { return _mm256_and_ps(a, b); }
+		static V zero_if(V mask, V v) { return _mm256_andnot_ps(mask, v); }
+		static int bits(V mask) { return _mm256_movemask_ps(mask); }
+	};
+
+	template<>
+	struct Ops<double> {
+		static constexpr bool enabled = true;
+		static constexpr std::size_t lanes = 4;
+		using V = __m256d;
+
+		static V load(const double* p) { return _mm256_loadu_pd(p); }
+		static void store(double* p, V v) { _mm256_storeu_pd(p, v); }
+		static V set1(double v) { return _mm256_set1_pd(v); }
+		static V add(V a, V b) { return _mm256_add_pd(a, b); }
+		static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+		static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+		static V min(V a, V b) { return _mm256_min_pd(a, b); }
+		static V max(V a, V b) { return _mm256_max_pd(a, b); }
+		static V lt(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+		static V ge(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+		static V le(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+		static V mask_or(V a, V b) { return _mm256_or_pd(a, b); }
+		static V mask_and(V a, V b) { return _mm256_and_pd(a, b); }
+		static V zero_if(V mask, V v) { return _mm256_andnot_pd(mask, v); }
+		static int bits(V mask) { return _mm256_movemask_pd(mask); }
+	};
+
+	template<>
+	struct Ops<int> {
+		static_assert(sizeof(int) == 4, "32-bit int expected");
+		static constexpr bool enabled = true;
+		static constexpr std::size_t lanes = 8;
+		using V = __m256i;
+
+		static V load(const int* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+		static void store(int* p, V v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+		static V set1(int v) { return _mm256_set1_epi32(v); }
+		static V add(V a, V b) { return _mm256_add_epi32(a, b); }
+		static V sub(V a, V b) { return _mm256_sub_epi32(a, b); }
+		static V mul(V a, V b) { return _mm256_mullo_epi32(a, b); }
+		static V min(V a, V b) { return _mm256_min_epi32(a, b); }
+		static V max(V a, V b) { return _mm256_max_epi32(a, b); }
+		static V lt(V a, V b) { return _mm256_cmpgt_epi32(b, a); }
+		static V ge(V a, V b) { return _mm256_xor_si256(lt(a, b), _mm256_set1_epi32(-1)); }
+		static V le(V a, V b) { return _mm256_xor_si256(lt(b, a), _mm256_set1_epi32(-1)); }
+		static V mask_or(V a, V b) { return _mm256_or_si256(a, b); }
+		static V mask_and(V a, V b) { return _mm256_and_si256(a, b); }
+		static V zero_if(V mask, V v) { return _mm256_andnot_si256(mask, v); }
+		static int bits(V mask) { return _mm256_movemask_ps(_mm256_castsi256_ps(mask)); }
+	};
+#elif defined(RECT_SIMD_SSE2)
+	template<>
+	struct Ops<float> {
+		static constexpr bool enabled = true;
+		static constexpr std::size_t lanes = 4;
+		using V = __m128;
+
+		static V load(const float* p) { return _mm_loadu_ps(p); }
+		static void store(float* p, V v) { _mm_storeu_ps(p, v); }
+		static V set1(float v) { return _mm_set1_ps(v); }
+		static V add(V a, V b) { return _mm_add_ps(a, b); }
+		static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+		static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+		static V min(V a, V b) { return _mm_min_ps(a, b); }
+		static V max(V a, V b) { return _mm_max_ps(a, b); }
+		static V lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+		static V ge(V a, V b) { return _mm_cmpge_ps(a, b); }
+		static V le(V a, V b) { return _mm_cmple_ps(a, b); }
+		static V mask_or(V a, V b) { return _mm_or_ps(a, b); }
+		static V mask_and(V a, V b) { return _mm_and_ps(a, b); }
+		static V zero_if(V mask, V v) { return _mm_andnot_ps(mask, v); }
+		static int bits(V mask) { return _mm_movemask_ps(mask); }
+	};
+
+	template<>
+	struct Ops<double> {
+		static constexpr bool enabled = true;
+		static constexpr std::size_t lanes = 2;
+		using V = __m128d;
+
+		static V load(const double* p) { return _mm_loadu_pd(p); }
+		static void store(double* p, V v) { _mm_storeu_pd(p, v); }
+		static V set1(double v) { return _mm_set1_pd(v); }
+		static V add(V a, V b) { return _mm_add_pd(a, b); }
+		static V sub(V a, V b) { return _mm_sub_pd(a, b); }
+		static V mul(V a, V b) { return _mm_mul_pd(a, b); }
+		static V min(V a, V b) { return _mm_min_pd(a, b); }
+		static V max(V a, V b) { return _mm_max_pd(a, b); }
+		static V lt(V a, V b) { return _mm_cmplt_pd(a, b); }
+		static V ge(V a, V b) { return _mm_cmpge_pd(a, b); }
+		static V le(V a, V b) { return _mm_cmple_pd(a, b); }
+		static V mask_or(V a, V b) { return _mm_or_pd(a, b); }
+		static V mask_and(V a, V b) { return _mm_and_pd(a, b); }
+		static V zero_if(V mask, V v) { return _mm_andnot_pd(mask, v); }
+		static int bits(V mask) { return _mm_movemask_pd(mask); }
+	};
+
+#if defined(RECT_SIMD_SSE41)
+	template<>
+	struct Ops<int> {
+		static_assert(sizeof(int) == 4, "32-bit int expected");
+		static constexpr bool enabled = true;
+		static constexpr std::size_t lanes = 4;
+		using V = __m128i;
+
+		static V load(const int* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+		static void store(int* p, V v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+		static V set1(int v) { return _mm_set1_epi32(v); }
+		static V add(V a, V b) { return _mm_add_epi32(a, b); }
+		static V sub(V a, V b) { return _mm_sub_epi32(a, b); }
+		static V mul(V a, V b) { return _mm_mullo_epi32(a, b); }
+		static V min(V a, V b) { return _mm_min_epi32(a, b); }
+		static V max(V a, V b) { return _mm_max_epi32(a, b); }
+		static V lt(V a, V b) { return _mm_cmplt_epi32(a, b); }
+		static V ge(V a, V b) { return _mm_xor_si128(_mm_cmplt_epi32(a, b), _mm_set1_epi32(-1)); }
+		static V le(V a, V b) { return _mm_xor_si128(_mm_cmpgt_epi32(a, b), _mm_set1_epi32(-1)); }
+		static V mask_or(V a, V b) { return _mm_or_si128(a, b); }
+		static V mask_and(V a, V b) { return _mm_and_si128(a, b); }
+		static V zero_if(V mask, V v) { return _mm_andnot_si128(mask, v); }
+		static int bits(V mask) { return _mm_movemask_ps(_mm_castsi128_ps(mask)); }
+	};
+#endif
+#endif
+
+	/// <summary>
+	/// Reads rectangle i from four separate columns
+	/// </summary>
+	template<typename T>
+	struct Columns {
+		const T* x;
+		const T* y;
+		const T* w;
+		const T* h;
+
+		Rect<T> at(std::size_t i) const {
+			return Rect<T>(x[i], y[i], w[i], h[i]);
+		}
+
+		template<typename O>
+		void load(std::size_t i, typename O::V& vx, typename O::V& vy, typename O::V& vw, typename O::V& vh) const {
+			vx = O::load(x + i);
+			vy = O::load(y + i);
+			vw = O::load(w + i);
+			vh = O::load(h + i);
+		}
+	};
+
+	/// <summary>
+	/// Repeats the same rectangle for every i
+	/// </summary>
+	template<typename T>
+	struct Broadcast {
+		Rect<T> r;
+
+		const Rect<T>& at(std::size_t) const {
+			return r;
+		}
+
+		template<typename O>
+		void load(std::size_t, typename O::V& vx, typename O::V& vy, typename O::V& vw, typename O::V& vh) const {
+			vx = O::set1(r.origin.x);
+			vy = O::set1(r.origin.y);
+			vw = O::set1(r.width);
+			vh = O::set1(r.height);
+		}
+	};
+
+	/// <summary>
+	/// out[i] = a[i].Intersect(b[i])
+	/// </summary>
+	template<typename T, typename A, typename B>
+	void Intersect(std::size_t n, const A& a, const B& b, T* ox, T* oy, T* ow, T* oh) {
+		std::size_t i = 0;
+		if constexpr (Ops<T>::enabled) {
+			using O = Ops<T>;
+			for (; i + O::lanes <= n; i += O::lanes) {
+				typename O::V ax, ay, aw, ah, bx, by, bw, bh;
+				a.template load<O>(i, ax, ay, aw, ah);
+				b.template load<O>(i, bx, by, bw, bh);
+
+				auto left = O::max(ax, bx);
+				auto bottom = O::max(ay, by);
+				auto right = O::min(O::add(ax, aw), O::add(bx, bw));
+				auto top = O::min(O::add(ay, ah), O::add(by, bh));
+				auto empty = O::mask_or(O::lt(right, left), O::lt(top, bottom));
+
+				O::store(ox + i, O::zero_if(empty, left));
+				O::store(oy + i, O::zero_if(empty, bottom));
+				O::store(ow + i, O::zero_if(empty, O::sub(right, left)));
+				O::store(oh + i, O::zero_if(empty, O::sub(top, bottom)));
+			}
+		}
+		for (; i < n; ++i) {
+			Rect<T> r = a.at(i).Intersect(b.at(i));
+			ox[i] = r.origin.x;
+			oy[i] = r.origin.y;
+			ow[i] = r.width;
+			oh[i] = r.height;
+		}
+	}
+
+	/// <summary>
+	/// out[i] = a[i].Union(b[i])
+	/// </summary>
+	template<typename T, typename A, typename B>
+	void Union(std::size_t n, const A& a, const B& b, T* ox, T* oy, T* ow, T* oh) {
+		std::size_t i = 0;
+		if constexpr (Ops<T>::enabled) {
+			using O = Ops<T>;
+			for (; i + O::lanes <= n; i += O::lanes) {
+				typename O::V ax, ay, aw, ah, bx, by, bw, bh;
+				a.template load<O>(i, ax, ay, aw, ah);
+				b.template load<O>(i, bx, by, bw, bh);
+
+				auto left = O::min(ax, bx);
+				auto bottom = O::min(ay, by);
+
+				O::store(ox + i, left);
+				O::store(oy + i, bottom);
+				O::store(ow + i, O::sub(O::max(O::add(ax, aw), O::add(bx, bw)), left));
+				O::store(oh + i, O::sub(O::max(O::add(ay, ah), O::add(by, bh)), bottom));
+			}
+		}
+		for (; i < n; ++i) {
+			Rect<T> r = a.at(i).Union(b.at(i));
+			ox[i] = r.origin.x;
+			oy[i] = r.origin.y;
+			ow[i] = r.width;
+			oh[i] = r.height;
+		}
+	}
+
+	/// <summary>
+	/// out[i] = w[i] * h[i]
+	/// </summary>
+	template<typename T>
+	void Area(std::size_t n, const T* w, const T* h, T* out) {
+		std::size_t i = 0;
+		if constexpr (Ops<T>::enabled) {
+			using O = Ops<T>;
+			for (; i + O::lanes <= n; i += O::lanes) {
+				O::store(out + i, O::mul(O::load(w + i), O::load(h + i)));
+			}
+		}
+		for (; i < n; ++i) {
+			out[i] = Rect<T>(0, 0, w[i], h[i]).Area();
+		}
+	}
+
+	/// <summary>
+	/// out[i] = 2 * (w[i] + h[i])
+	/// </summary>
+	template<typename T>
+	void Perimeter(std::size_t n, const T* w, const T* h, T* out) {
+		std::size_t i = 0;
+		if constexpr (Ops<T>::enabled) {
+			using O = Ops<T>;
+			const auto two = O::set1(2);
+			for (; i + O::lanes <= n; i += O::lanes) {
+				O::store(out + i, O::mul(two, O::add(O::load(w + i), O::load(h + i))));
+			}
+		}
+		for (; i < n; ++i) {
+			out[i] = Rect<T>(0, 0, w[i], h[i]).Perimeter();
+		}
+	}
+
+	/// <summary>
+	/// out[i] = a[i].Contains(p)
+	/// </summary>
+	template<typename T>
+	void ContainsPoint(std::size_t n, const Columns<T>& a, const Point<T>& p, std::uint8_t* out) {
+		std::size_t i = 0;
+		if constexpr (Ops<T>::enabled) {
+			using O = Ops<T>;
+			const auto px = O::set1(p.x);
+			const auto py = O::set1(p.y);
+			for (; i + O::lanes <= n; i += O::lanes) {
+				typename O::V ax, ay, aw, ah;
+				a.template load<O>(i, ax, ay, aw, ah);
+
+				auto inside = O::mask_and(
+					O::mask_and(O::ge(px, ax), O::le(px, O::add(ax, aw))),
+					O::mask_and(O::ge(py, ay), O::le(py, O::add(ay, ah))));
+
+				int bits = O::bits(inside);
+				for (std::size_t l = 0; l < O::lanes; ++l) {
+					out[i + l] = static_cast<std::uint8_t>((bits >> l) & 1);
+				}
+			}
+		}
+		for (; i < n; ++i) {
+			out[i] = a.at(i).Contains(p);
+		}
+	}
+
+	/// <summary>
+	/// out[i] = a[i].Contains(b[i])
+	/// </summary>
+	template<typename T, typename A, typename B>
+	void ContainsRect(std::size_t n, const A& a, const B& b, std::uint8_t* out) {
+		std::size_t i = 0;
+		if constexpr (Ops<T>::enabled) {
+			using O = Ops<T>;
+			for (; i + O::lanes <= n; i += O::lanes) {
+				typename O::V ax, ay, aw, ah, bx, by, bw, bh;
+				a.template load<O>(i, ax, ay, aw, ah);
+				b.template load<O>(i, bx, by, bw, bh);
+
+				auto inside = O::mask_and(
+					O::mask_and(O::ge(bx, ax), O::le(O::add(bx, bw), O::add(ax, aw))),
+					O::mask_and(O::ge(by, ay), O::le(O::add(by, bh), O::add(ay, ah))));
+
+				int bits = O::bits(inside);
+				for (std::size_t l = 0; l < O::lanes; ++l) {
+					out[i + l] = static_cast<std::uint8_t>((bits >> l) & 1);
+				}
+			}
+		}
+		for (; i < n; ++i) {
+			out[i] = a.at(i).Contains(b.at(i));
+		}
+	}
+}
+
+/// <summary>
+/// Structure-of-arrays container of rectangles with vectorized batch operations.
+/// Every batch result matches the corresponding scalar Rect method bit for bit
+/// </summary>
+template<typename Type>
+class RectBatch {
+	static_assert(std::is_arithmetic_v<Type>, "Type must be arithmetic");
+
+	AlignedVector<Type> x, y, w, h;
+
+	rect_simd::Columns<Type> columns() const {
+		return { x.data(), y.data(), w.data(), h.data() };
+	}
+
+	void check_size(const RectBatch<Type>& other) const {
+		if (other.Size() != Size())
+			throw std::invalid_argument("Batches must have the same size.");
+	}
+public:
+	/// <summary>
+	/// Creates an empty batch
+	/// </summary>
+	RectBatch() = default;
+
+	/// <summary>
+	/// Creates a batch of n default rectangles
+	/// </summary>
+	explicit RectBatch(std::size_t n)
+		: x(n), y(n), w(n), h(n)
+	{ }
+
+	/// <summary>
+	/// Creates a batch from an array of rectangles
+	/// </summary>
+	explicit RectBatch(const std::vector<Rect<Type>>& rects) {
+		Reserve(rects.size());
+		for (decltype(auto) r : rects) PushBack(r);
+	}
+
+	/// <summary>
+	/// Returns the number of rectangles
+	/// </summary>
+	std::size_t Size() const {
+		return x.size();
+	}
+
+	bool Empty() const {
+		return x.empty();
+	}
+
+	void Reserve(std::size_t n) {
+		x.reserve(n);
+		y.reserve(n);
+		w.reserve(n);
+		h.reserve(n);
+	}
+
+	void Resize(std::size_t n) {
+		x.resize(n);
+		y.resize(n);
+		w.resize(n);
+		h.resize(n);
+	}
+
+	void Clear() {
+		x.clear();
+		y.clear();
+		w.clear();
+		h.clear();
+	}
+
+	/// <summary>
+	/// Appends a rectangle to the end of the batch
+	/// </summary>
+	void PushBack(const Rect<Type>& r) {
+		x.push_back(r.origin.x);
+		y.push_back(r.origin.y);
+		w.push_back(r.width);
+		h.push_back(r.height);
+	}
+
+	/// <summary>
+	/// Returns the rectangle with index i
+	/// </summary>
+	Rect<Type> Get(std::size_t i) const {
+		return Rect<Type>(x[i], y[i], w[i], h[i]);
+	}
+
+	/// <summary>
+	/// Replaces the rectangle with index i
+	/// </summary>
+	void Set(std::size_t i, const Rect<Type>& r) {
+		x[i] = r.origin.x;
+		y[i] = r.origin.y;
+		w[i] = r.width;
+		h[i] = r.height;
+	}
+
+	/// <summary>
+	/// Converts the batch back to an array of rectangles
+	/// </summary>
+	std::vector<Rect<Type>> ToVector() const {
+		std::vector<Rect<Type>> result;
+		result.reserve(Size());
+		for (std::size_t i = 0; i < Size(); ++i) result.push_back(Get(i));
+		return result;
+	}
+
+	const Type* X() const { return x.data(); }
+	const Type* Y() const { return y.data(); }
+	const Type* Width() const { return w.data(); }
+	const Type* Height() const { return h.data(); }
+	Type* X() { return x.data(); }
+	Type* Y() { return y.data(); }
+	Type* Width() { return w.data(); }
+	Type* Height() { return h.data(); }
+
+	/// <summary>
+	/// Element-wise intersection: result[i] = (*this)[i].Intersect(other[i])
+	/// </summary>
+	RectBatch<Type> Intersect(const RectBatch<Type>& other) const {
+		check_size(other);
+		RectBatch<Type> result(Size());
+		rect_simd::Intersect(Size(), columns(), other.columns(), result.X(), result.Y(), result.Width(), result.Height());
+		return result;
+	}
+
+	/// <summary>
+	/// Intersection of every rectangle with the given one
+	/// </summary>
+	RectBatch<Type> Intersect(const Rect<Type>& other) const {
+		RectBatch<Type> result(Size());
+		rect_simd::Intersect(Size(), columns(), rect_simd::Broadcast<Type>{ other },
+			result.X(), result.Y(), result.Width(), result.Height());
+		return result;
+	}
+
+	/// <summary>
+	/// Element-wise union: result[i] = (*this)[i].Union(other[i])
+	/// </summary>
+	RectBatch<Type> Union(const RectBatch<Type>& other) const {
+		check_size(other);
+		RectBatch<Type> result(Size());
+		rect_simd::Union(Size(), columns(), other.columns(), result.X(), result.Y(), result.Width(), result.Height());
+		return result;
+	}
+
+	/// <summary>
+	/// Union of every rectangle with the given one
+	/// </summary>
+	RectBatch<Type> Union(const Rect<Type>& other) const {
+		RectBatch<Type> result(Size());
+		rect_simd::Union(Size(), columns(), rect_simd::Broadcast<Type>{ other },
+			result.X(), result.Y(), result.Width(), result.Height());
+		return result;
+	}
+
+	/// <summary>
+	/// Writes the area of every rectangle to out (Size() elements)
+	/// </summary>
+	void Area(Type* out) const {
+		rect_simd::Area(Size(), w.data(), h.data(), out);
+	}
+
+	/// <summary>
+	/// Returns the area of every rectangle
+	/// </summary>
+	std::vector<Type> Area() const {
+		std::vector<Type> result(Size());
+		Area(result.data());
+		return result;
+	}
+
+	/// <summary>
+	/// Writes the perimeter of every rectangle to out (Size() elements)
+	/// </summary>
+	void Perimeter(Type* out) const {
+		rect_simd::Perimeter(Size(), w.data(), h.data(), out);
+	}
+
+	/// <summary>
+	/// Returns the perimeter of every rectangle
+	/// </summary>
+	std::vector<Type> Perimeter() const {
+		std::vector<Type> result(Size());
+		Perimeter(result.data());
+		return result;
+	}
+
+	/// <summary>
+	/// Writes 1 to out[i] if rectangle i contains the point, 0 otherwise
+	/// </summary>
+	void Contains(const Point<Type>& p, std::uint8_t* out) const {
+		rect_simd::ContainsPoint(Size(), columns(), p, out);
+	}
+
+	/// <summary>
+	/// Indicates for every rectangle whether it contains the point
+	/// </summary>
+	std::vector<std::uint8_t> Contains(const Point<Type>& p) const {
+		std::vector<std::uint8_t> result(Size());
+		Contains(p, result.data());
+		return result;
+	}
+
+	/// <summary>
+	/// Element-wise containment: out[i] = (*this)[i].Contains(other[i])
+	/// </summary>
+	void Contains(const RectBatch<Type>& other, std::uint8_t* out) const {
+		check_size(other);
+		rect_simd::ContainsRect<Type>(Size(), columns(), other.columns(), out);
+	}
+
+	/// <summary>
+	/// Element-wise containment: result[i] = (*this)[i].Contains(other[i])
+	/// </summary>
+	std::vector<std::uint8_t> Contains(const RectBatch<Type>& other) const {
+		std::vector<std::uint8_t> result(Size());
+		Contains(other, result.data());
+		return result;
+	}
+
+	/// <summary>
+	/// Writes 1 to out[i] if rectangle i contains the given rectangle, 0 otherwise
+	/// </summary>
+	void Contains(const Rect<Type>& r, std::uint8_t* out) const {
+		rect_simd::ContainsRect<Type>(Size(), columns(), rect_simd::Broadcast<Type>{ r }, out);
+	}
+
+	/// <summary>
+	/// Indicates for every rectangle whether it contains the given rectangle
+	/// </summary>
+	std::vector<std::uint8_t> Contains(const Rect<Type>& r) const {
+		std::vector<std::uint8_t> result(Size());
+		Contains(r, result.data());
+		return result;
+	}
+};
@@ -1,5 +1,7 @@
 ﻿#pragma once
+#include "Instrumentation.hpp"
 #include "Point.hpp"
+#include <cmath>
 #include <ostream>
 #include <sstream>
 #include <stdexcept> // for std::invalid_argument
@@ -14,6 +16,23 @@ class Rect {
 	static Type max(Type f, Type s) {
 		return f > s ? f : s;
 	}
+	// a - b, or 0 if a <= b. Subtracts only the smaller value, so unsigned types do not wrap
+	static Type excess(Type a, Type b) {
+		return a > b ? Type(a - b) : Type(0);
+	}
+	// Distance from v to [lo, hi] along one axis, 0 inside; compiles to selects, no branches
+	static Type gap(Type v, Type lo, Type hi) {
+		return max(excess(lo, v), excess(v, hi));
+	}
+	// Distance between [lo1, hi1] and [lo2, hi2] along one axis, 0 if they overlap
+	static Type gap(Type lo1, Type hi1, Type lo2, Type hi2) {
+		return max(excess(lo2, hi1), excess(lo1, hi2));
+	}
+	static double gap_d(double v, double lo, double hi) {
+		double below = lo - v, above = v - hi;
+		double d = below > above ? below : above;
+		return d > 0 ? d : 0;
+	}
 public:
 	Type width, height;
 	Point<Type> origin; // Left lower point
@@ -24,6 +43,7 @@ public:
 	Rect(Point<Type> p, Type width, Type height)
 		: origin{ p }, width{ width }, height{ height }
 	{
+		RECT_PROBE(RectConstruct);
 		if (width < 0 || height < 0) 
 			throw std::invalid_argument("Width and height must be non-negative.");
 	}
@@ -113,6 +133,7 @@ public:
 	/// Indicates whether the rectangle contains the given point
 	/// </summary>
 	bool Contains(const Point<Type>& p) const {
+		RECT_PROBE(RectContains);
 		return p.x >= Left() && p.x <= Right() && p.y >= Bottom() && p.y <= Top();
 	}
 
@@ -120,13 +141,68 @@ public:
 	/// Indicates whether the rectangle contains the given rectangle
 	/// </summary>
 	bool Contains(const Rect<Type>& r) const {
+		RECT_PROBE(RectContains);
 		return r.Left() >= Left() && r.Right() <= Right() && r.Bottom() >= Bottom() && r.Top() <= Top();
 	}
 
+	/// <summary>
+	/// Indicates whether the rectangles intersect (touching edges count, as in Intersect)
+	/// </summary>
+	bool Overlaps(const Rect<Type>& other) const {
+		return other.Left() <= Right() && other.Right() >= Left() && other.Bottom() <= Top() && other.Top() >= Bottom();
+	}
+
+	/// <summary>
+	/// Returns the squared Euclidean distance from the point to the rectangle (0 if the point is inside)
+	/// </summary>
+	double DistanceSquared(const Point<Type>& p) const {
+		double dx = gap_d(p.x, Left(), Right());
+		double dy = gap_d(p.y, Bottom(), Top());
+		return dx * dx + dy * dy;
+	}
+
+	/// <summary>
+	/// Returns the Euclidean distance from the point to the rectangle (0 if the point is inside)
+	/// </summary>
+	double Distance(const Point<Type>& p) const {
+		return std::sqrt(DistanceSquared(p));
+	}
+
+	/// <summary>
+	/// Returns the squared Euclidean distance between the closest points of the rectangles (0 if they intersect)
+	/// </summary>
+	double DistanceSquared(const Rect<Type>& other) const {
+		double dx = gap_d(double(Left()), double(other.Left()) - double(width), double(other.Right()));
+		double dy = gap_d(double(Bottom()), double(other.Bottom()) - double(height), double(other.Top()));
+		return dx * dx + dy * dy;
+	}
+
+	/// <summary>
+	/// Returns the Euclidean distance between the closest points of the rectangles (0 if they intersect)
+	/// </summary>
+	double Distance(const Rect<Type>& other) const {
+		return std::sqrt(DistanceSquared(other));
+	}
+
+	/// <summary>
+	/// Returns the Chebyshev (max-axis) distance from the point to the rectangle (0 if the point is inside)
+	/// </summary>
+	Type ChebyshevDistance(const Point<Type>& p) const {
+		return max(gap(p.x, Left(), Right()), gap(p.y, Bottom(), Top()));
+	}
+
+	/// <summary>
+	/// Returns the Chebyshev (max-axis) distance between the rectangles (0 if they intersect)
+	/// </summary>
+	Type ChebyshevDistance(const Rect<Type>& other) const {
+		return max(gap(Left(), Right(), other.Left(), other.Right()), gap(Bottom(), Top(), other.Bottom(), other.Top()));
+	}
+
 	/// <summary>
 	/// Returns the intersection of the rectangles  
 	/// </summary>
 	Rect<Type> Intersect(const Rect<Type>& other) const {
+		RECT_PROBE(RectIntersect);
 		Type left = max(Left(), other.Left());
 		Type bottom = max(Bottom(), other.Bottom());
 		Type right = min(Right(), other.Right());
@@ -143,6 +219,7 @@ public:
 	/// Returns a rectangle expanded enough to include the new rectangle
 	/// </summary>
 	Rect<Type> Union(const Rect<Type>& other) const {
+		RECT_PROBE(RectUnion);
 		return Rect<Type>(
 			Point<Type>(min(origin.x, other.origin.x), min(origin.y, other.origin.y)),
 			max(origin.x + width, other.origin.x + other.width) - min(origin.x, other.origin.x),
@@ -154,6 +231,7 @@ public:
 	/// Returns a rectangle expanded enough to include the new point
 	/// </summary>
 	Rect<Type> Union(const Point<Type>& other) const {
+		RECT_PROBE(RectUnion);
 		return Rect<Type>(
 			Point<Type>(min(origin.x, other.x), min(origin.y, other.y)),
 			max(origin.x + width, other.x) - min(origin.x, other.x),
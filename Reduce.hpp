@@ -0,0 +1,183 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include "Coverage.hpp"
+#include "Parallel.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Parallel folds over rectangle collections. The input is cut into fixed blocks whose partial results are
+// combined in block order, so floating-point sums do not depend on the number of threads
+
+namespace reduce_detail {
+	constexpr std::size_t block = std::size_t{ 1 } << 16;
+
+	inline std::size_t blocks(std::size_t n) {
+		return (n + block - 1) / block;
+	}
+
+	/// <summary>
+	/// Computes partial(begin, end) for every block in parallel and returns the partials in block order
+	/// </summary>
+	template<typename T, typename Partial>
+	std::vector<T> map_blocks(std::size_t n, std::size_t threads, Partial&& partial) {
+		std::vector<T> partials(blocks(n));
+		ParallelFor(partials.size(), threads, [&](std::size_t b, std::size_t) {
+			partials[b] = partial(b * block, std::min(n, (b + 1) * block));
+		});
+		return partials;
+	}
+
+	template<typename Type>
+	struct Extent {
+		Type left, bottom, right, top;
+	};
+}
+
+/// <summary>
+/// Returns the smallest rectangle containing all rectangles (Rect() for an empty input).
+/// Compares raw edges instead of folding with Union, so only the result goes through the constructor
+/// </summary>
+template<typename Type>
+Rect<Type> BoundingBox(std::span<const Rect<Type>> rects, std::size_t threads = 0) {
+	using Extent = reduce_detail::Extent<Type>;
+
+	auto partials = reduce_detail::map_blocks<Extent>(rects.size(), threads, [&](std::size_t begin, std::size_t end) {
+		Extent e{ rects[begin].Left(), rects[begin].Bottom(), rects[begin].Right(), rects[begin].Top() };
+		for (std::size_t i = begin + 1; i < end; ++i) {
+			const Rect<Type>& r = rects[i];
+			e.left = std::min(e.left, r.Left());
+			e.bottom = std::min(e.bottom, r.Bottom());
+			e.right = std::max(e.right, r.Right());
+			e.top = std::max(e.top, r.Top());
+		}
+		return e;
+	});
+
+	if (partials.empty()) return Rect<Type>();
+	Extent total = partials[0];
+	for (decltype(auto) e : partials) {
+		total.left = std::min(total.left, e.left);
+		total.bottom = std::min(total.bottom, e.bottom);
+		total.right = std::max(total.right, e.right);
+		total.top = std::max(total.top, e.top);
+	}
+	return Rect<Type>(Point<Type>(total.left, total.bottom), total.right - total.left, total.top - total.bottom);
+}
+
+template<typename Type>
+Rect<Type> BoundingBox(const std::vector<Rect<Type>>& rects, std::size_t threads = 0) {
+	return BoundingBox(std::span<const Rect<Type>>(rects), threads);
+}
+
+/// <summary>
+/// Returns the sum of the areas (overlaps counted every time; see CoveredArea for the area of the union).
+/// Integer rectangles are summed in 64 bits
+/// </summary>
+template<typename Type>
+CoverageMeasure<Type> SumArea(std::span<const Rect<Type>> rects, std::size_t threads = 0) {
+	using Measure = CoverageMeasure<Type>;
+
+	auto partials = reduce_detail::map_blocks<Measure>(rects.size(), threads, [&](std::size_t begin, std::size_t end) {
+		Measure sum{};
+		for (std::size_t i = begin; i < end; ++i) sum += static_cast<Measure>(rects[i].width) * static_cast<Measure>(rects[i].height);
+		return sum;
+	});
+
+	Measure total{};
+	for (decltype(auto) p : partials) total += p;
+	return total;
+}
+
+template<typename Type>
+CoverageMeasure<Type> SumArea(const std::vector<Rect<Type>>& rects, std::size_t threads = 0) {
+	return SumArea(std::span<const Rect<Type>>(rects), threads);
+}
+
+/// <summary>
+/// Returns the sum of the perimeters. Integer rectangles are summed in 64 bits
+/// </summary>
+template<typename Type>
+CoverageMeasure<Type> SumPerimeter(std::span<const Rect<Type>> rects, std::size_t threads = 0) {
+	using Measure = CoverageMeasure<Type>;
+
+	auto partials = reduce_detail::map_blocks<Measure>(rects.size(), threads, [&](std::size_t begin, std::size_t end) {
+		Measure sum{};
+		for (std::size_t i = begin; i < end; ++i) sum += static_cast<Measure>(rects[i].width) + static_cast<Measure>(rects[i].height);
+		return sum;
+	});
+
+	Measure total{};
+	for (decltype(auto) p : partials) total += p;
+	return 2 * total;
+}
+
+template<typename Type>
+CoverageMeasure<Type> SumPerimeter(const std::vector<Rect<Type>>& rects, std::size_t threads = 0) {
+	return SumPerimeter(std::span<const Rect<Type>>(rects), threads);
+}
+
+/// <summary>
+/// Returns the number of rectangles for which pred(rect) holds
+/// </summary>
+template<typename Type, typename Pred>
+std::size_t CountIf(std::span<const Rect<Type>> rects, Pred&& pred, std::size_t threads = 0) {
+	auto partials = reduce_detail::map_blocks<std::size_t>(rects.size(), threads, [&](std::size_t begin, std::size_t end) {
+		std::size_t n = 0;
+		for (std::size_t i = begin; i < end; ++i) n += pred(rects[i]) ? 1 : 0;
+		return n;
+	});
+
+	std::size_t total = 0;
+	for (std::size_t p : partials) total += p;
+	return total;
+}
+
+template<typename Type, typename Pred>
+std::size_t CountIf(const std::vector<Rect<Type>>& rects, Pred&& pred, std::size_t threads = 0) {
+	return CountIf(std::span<const Rect<Type>>(rects), pred, threads);
+}
+
+/// <summary>
+/// Returns the indices of the rectangles for which pred(rect) holds, in ascending order.
+/// pred is called once per rectangle: the first pass keeps its answers in a bitmap and counts them per block,
+/// so the second pass writes the indices straight into place and stays in bounds even if pred is not deterministic
+/// </summary>
+template<typename Type, typename Pred>
+std::vector<std::size_t> SelectIf(std::span<const Rect<Type>> rects, Pred&& pred, std::size_t threads = 0) {
+	// Blocks start on word boundaries, so no two blocks write the same word
+	static_assert(reduce_detail::block % 64 == 0);
+	std::vector<std::uint64_t> hits((rects.size() + 63) / 64);
+
+	auto counts = reduce_detail::map_blocks<std::size_t>(rects.size(), threads, [&](std::size_t begin, std::size_t end) {
+		std::size_t n = 0;
+		for (std::size_t i = begin; i < end; ++i) {
+			if (pred(rects[i])) {
+				hits[i / 64] |= std::uint64_t{ 1 } << (i % 64);
+				++n;
+			}
+		}
+		return n;
+	});
+
+	std::vector<std::size_t> starts(counts.size() + 1, 0);
+	for (std::size_t b = 0; b < counts.size(); ++b) starts[b + 1] = starts[b] + counts[b];
+
+	std::vector<std::size_t> selected(starts.back());
+	ParallelFor(counts.size(), threads, [&](std::size_t b, std::size_t) {
+		std::size_t* dst = selected.data() + starts[b];
+		std::size_t end = (std::min(rects.size(), (b + 1) * reduce_detail::block) + 63) / 64;
+		for (std::size_t w = b * reduce_detail::block / 64; w < end; ++w) {
+			for (std::uint64_t bits = hits[w]; bits != 0; bits &= bits - 1) *dst++ = w * 64 + std::countr_zero(bits);
+		}
+	});
+	return selected;
+}
+
+template<typename Type, typename Pred>
+std::vector<std::size_t> SelectIf(const std::vector<Rect<Type>>& rects, Pred&& pred, std::size_t threads = 0) {
+	return SelectIf(std::span<const Rect<Type>>(rects), pred, threads);
+}
@@ -0,0 +1,305 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include "Coverage.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+/// <summary>
+/// Arbitrary rectilinear area stored as disjoint rectangles, in the style of X11 regions:
+/// horizontal bands sorted by Y, each holding sorted, non-touching spans along X.
+/// Vertically adjacent bands with the same spans are always merged, so the representation is canonical
+/// </summary>
+template<typename Type>
+class Region {
+	static_assert(std::is_arithmetic_v<Type>, "Type must be arithmetic");
+public:
+	struct Span {
+		Type left, right;
+
+		bool operator==(const Span& other) const {
+			return left == other.left && right == other.right;
+		}
+	};
+
+	struct Band {
+		Type bottom, top;
+		// Spans of the band are spans[first, last)
+		std::size_t first, last;
+	};
+
+private:
+	std::vector<Band> bands;
+	std::vector<Span> spans;
+
+	/// <summary>
+	/// Appends a band whose spans are already at the end of `spans`, merging it into the previous band if possible
+	/// </summary>
+	void push_band(Type bottom, Type top, std::size_t first) {
+		std::size_t last = spans.size();
+		if (first == last) return;
+
+		if (!bands.empty()) {
+			Band& prev = bands.back();
+			if (prev.top == bottom && prev.last - prev.first == last - first &&
+				std::equal(spans.begin() + prev.first, spans.begin() + prev.last, spans.begin() + first)) {
+				prev.top = top;
+				spans.resize(first);
+				return;
+			}
+		}
+		bands.push_back({ bottom, top, first, last });
+	}
+
+	/// <summary>
+	/// Merges two sorted span lists, keeping the X ranges where op(inside a, inside b) holds
+	/// </summary>
+	template<typename Op>
+	static void merge_spans(const Span* a, std::size_t na, const Span* b, std::size_t nb, Op op, std::vector<Span>& out) {
+		std::size_t i = 0, j = 0;
+		bool in_a = false, in_b = false, inside = false;
+		Type start{};
+
+		while (i < na || j < nb) {
+			// Next boundary of each list: its current span's left edge, or its right edge when inside it
+			bool has_a = i < na, has_b = j < nb;
+			Type xa = has_a ? (in_a ? a[i].right : a[i].left) : Type{};
+			Type xb = has_b ? (in_b ? b[j].right : b[j].left) : Type{};
+			Type x = !has_a ? xb : !has_b ? xa : std::min(xa, xb);
+
+			if (has_a && xa == x) {
+				if (in_a) ++i;
+				in_a = !in_a;
+			}
+			if (has_b && xb == x) {
+				if (in_b) ++j;
+				in_b = !in_b;
+			}
+
+			bool now = op(in_a, in_b);
+			if (now == inside) continue;
+			if (now) start = x;
+			else if (start < x) out.push_back({ start, x });
+			inside = now;
+		}
+	}
+
+	/// <summary>
+	/// Band-by-band merge of two regions; linear in the number of spans
+	/// </summary>
+	template<typename Op>
+	static Region<Type> combine(const Region<Type>& a, const Region<Type>& b, Op op) {
+		Region<Type> result;
+		result.bands.reserve(a.bands.size() + b.bands.size());
+		result.spans.reserve(a.spans.size() + b.spans.size());
+
+		std::size_t ia = 0, ib = 0;
+		Type y{};
+		bool started = false;
+
+		while (ia < a.bands.size() || ib < b.bands.size()) {
+			const Band* ba = ia < a.bands.size() ? &a.bands[ia] : nullptr;
+			const Band* bb = ib < b.bands.size() ? &b.bands[ib] : nullptr;
+
+			// Jump over gaps where neither region has a band
+			if (!started || !((ba && ba->bottom <= y) || (bb && bb->bottom <= y))) {
+				Type next = ba && bb ? std::min(ba->bottom, bb->bottom) : ba ? ba->bottom : bb->bottom;
+				y = started ? std::max(y, next) : next;
+				started = true;
+			}
+
+			bool active_a = ba && ba->bottom <= y;
+			bool active_b = bb && bb->bottom <= y;
+
+			// The slab [y, y2) has a constant set of active bands
+			Type y2{};
+			bool has_y2 = false;
+			auto limit = [&](const Band* band, bool active) {
+				if (!band) return;
+				Type edge = active ? band->top : band->bottom;
+				y2 = has_y2 ? std::min(y2, edge) : edge;
+				has_y2 = true;
+			};
+			limit(ba, active_a);
+			limit(bb, active_b);
+
+			std::size_t first = result.spans.size();
+			merge_spans(
+				active_a ? a.spans.data() + ba->first : nullptr, active_a ? ba->last - ba->first : 0,
+				active_b ? b.spans.data() + bb->first : nullptr, active_b ? bb->last - bb->first : 0,
+				op, result.spans);
+			if (y < y2) result.push_band(y, y2, first);
+			else result.spans.resize(first);
+
+			y = y2;
+			if (active_a && ba->top == y) ++ia;
+			if (active_b && bb->top == y) ++ib;
+		}
+		return result;
+	}
+
+public:
+	/// <summary>
+	/// Creates an empty region
+	/// </summary>
+	Region() = default;
+
+	/// <summary>
+	/// Creates a region covering one rectangle (empty if it has zero width or height)
+	/// </summary>
+	explicit Region(const Rect<Type>& r) {
+		if (r.width == 0 || r.height == 0) return;
+		spans.push_back({ r.Left(), r.Right() });
+		bands.push_back({ r.Bottom(), r.Top(), 0, 1 });
+	}
+
+	/// <summary>
+	/// Creates the union of the rectangles, merging them pairwise as a balanced tree
+	/// </summary>
+	explicit Region(std::span<const Rect<Type>> rects) {
+		if (rects.empty()) return;
+		if (rects.size() == 1) {
+			*this = Region<Type>(rects[0]);
+			return;
+		}
+		std::size_t half = rects.size() / 2;
+		*this = Region<Type>(rects.first(half)).Union(Region<Type>(rects.subspan(half)));
+	}
+
+	/// <summary>
+	/// Creates the union of the rectangles stored in a vector
+	/// </summary>
+	explicit Region(const std::vector<Rect<Type>>& rects)
+		: Region(std::span<const Rect<Type>>(rects))
+	{ }
+
+	bool Empty() const {
+		return bands.empty();
+	}
+
+	/// <summary>
+	/// Returns the number of disjoint rectangles in the region
+	/// </summary>
+	std::size_t RectCount() const {
+		return spans.size();
+	}
+
+	/// <summary>
+	/// Returns the number of horizontal bands
+	/// </summary>
+	std::size_t BandCount() const {
+		return bands.size();
+	}
+
+	const std::vector<Band>& Bands() const {
+		return bands;
+	}
+
+	const std::vector<Span>& Spans() const {
+		return spans;
+	}
+
+	/// <summary>
+	/// Returns the disjoint rectangles of the region, sorted by band and then by X
+	/// </summary>
+	std::vector<Rect<Type>> Rects() const {
+		std::vector<Rect<Type>> result;
+		result.reserve(spans.size());
+		for (decltype(auto) band : bands) {
+			for (std::size_t s = band.first; s < band.last; ++s) {
+				result.emplace_back(spans[s].left, band.bottom, spans[s].right - spans[s].left, band.top - band.bottom);
+			}
+		}
+		return result;
+	}
+
+	/// <summary>
+	/// Returns the bounding box of the region
+	/// </summary>
+	Rect<Type> Bounds() const {
+		if (bands.empty()) return Rect<Type>();
+
+		Type left = spans[bands.front().first].left, right = spans[bands.front().last - 1].right;
+		for (decltype(auto) band : bands) {
+			left = std::min(left, spans[band.first].left);
+			right = std::max(right, spans[band.last - 1].right);
+		}
+		return Rect<Type>(left, bands.front().bottom, right - left, bands.back().top - bands.front().bottom);
+	}
+
+	/// <summary>
+	/// Returns the area of the region
+	/// </summary>
+	CoverageMeasure<Type> Area() const {
+		CoverageMeasure<Type> area = 0;
+		for (decltype(auto) band : bands) {
+			CoverageMeasure<Type> length = 0;
+			for (std::size_t s = band.first; s < band.last; ++s) {
+				length += CoverageMeasure<Type>(spans[s].right) - CoverageMeasure<Type>(spans[s].left);
+			}
+			area += length * (CoverageMeasure<Type>(band.top) - CoverageMeasure<Type>(band.bottom));
+		}
+		return area;
+	}
+
+	/// <summary>
+	/// Indicates whether the region contains the point (edges included, as in Rect::Contains).
+	/// Binary search over the bands, then over the spans of the band
+	/// </summary>
+	bool Contains(const Point<Type>& p) const {
+		auto band = std::lower_bound(bands.begin(), bands.end(), p.y, [](const Band& b, Type y) {
+			return b.top < y;
+		});
+		// A point on the edge shared by two bands may only be inside the upper one
+		for (; band != bands.end() && band->bottom <= p.y; ++band) {
+			auto first = spans.begin() + band->first, last = spans.begin() + band->last;
+			auto span = std::lower_bound(first, last, p.x, [](const Span& s, Type x) {
+				return s.right < x;
+			});
+			if (span != last && span->left <= p.x) return true;
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// Returns the area covered by either region
+	/// </summary>
+	Region<Type> Union(const Region<Type>& other) const {
+		return combine(*this, other, [](bool a, bool b) { return a || b; });
+	}
+
+	/// <summary>
+	/// Returns the area covered by both regions
+	/// </summary>
+	Region<Type> Intersect(const Region<Type>& other) const {
+		return combine(*this, other, [](bool a, bool b) { return a && b; });
+	}
+
+	/// <summary>
+	/// Returns the area of this region not covered by the other
+	/// </summary>
+	Region<Type> Subtract(const Region<Type>& other) const {
+		return combine(*this, other, [](bool a, bool b) { return a && !b; });
+	}
+
+	/// <summary>
+	/// Returns the area covered by exactly one of the regions
+	/// </summary>
+	Region<Type> Xor(const Region<Type>& other) const {
+		return combine(*this, other, [](bool a, bool b) { return a != b; });
+	}
+
+	bool operator==(const Region<Type>& other) const {
+		if (bands.size() != other.bands.size() || spans != other.spans) return false;
+		for (std::size_t i = 0; i < bands.size(); ++i) {
+			if (bands[i].bottom != other.bands[i].bottom || bands[i].top != other.bands[i].top ||
+				bands[i].first != other.bands[i].first || bands[i].last != other.bands[i].last) return false;
+		}
+		return true;
+	}
+
+	bool operator!=(const Region<Type>& other) const {
+		return !operator==(other);
+	}
+};
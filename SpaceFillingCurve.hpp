@@ -0,0 +1,205 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include "Parallel.hpp"
+#include "Reduce.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Space-filling-curve order for rectangle collections. Rectangle centers are quantized to a 2^32 x 2^32 grid over
+// the bounding box of the collection and mapped to 64-bit Morton or Hilbert keys; rectangles close along the
+// curve are close in the plane, so storing them in key order keeps spatially adjacent work on nearby cache lines
+
+namespace curve_detail {
+	constexpr std::size_t block = std::size_t{ 1 } << 16;
+	constexpr unsigned digit_bits = 8;
+	constexpr std::size_t digits = std::size_t{ 1 } << digit_bits;
+	constexpr unsigned passes = 64 / digit_bits;
+
+	/// <summary>
+	/// Moves bit k of v to bit 2k
+	/// </summary>
+	inline std::uint64_t spread(std::uint32_t v) {
+		std::uint64_t x = v;
+		x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+		x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+		x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+		x = (x | (x << 2)) & 0x3333333333333333ull;
+		x = (x | (x << 1)) & 0x5555555555555555ull;
+		return x;
+	}
+
+	struct Entry {
+		std::uint64_t key;
+		std::size_t id;
+	};
+
+	/// <summary>
+	/// Stable LSD radix sort on the keys, 8 bits per pass. One read counts the digits of all passes, so passes in which
+	/// every key has the same digit (the high bits of a clustered collection) are skipped. Each remaining pass counts
+	/// its digit per block and the blocks scatter their entries in parallel to offsets taken from those counts
+	/// </summary>
+	inline void radix_sort(std::vector<Entry>& entries, std::size_t threads) {
+		using Histogram = std::array<std::size_t, digits>;
+
+		const std::size_t n = entries.size();
+		if (n == 0) return;
+		const std::size_t blocks = (n + block - 1) / block;
+		auto digit = [](std::uint64_t key, unsigned p) { return static_cast<std::size_t>((key >> (p * digit_bits)) & (digits - 1)); };
+
+		std::vector<std::array<Histogram, passes>> totals(blocks);
+		ParallelFor(blocks, threads, [&](std::size_t b, std::size_t) {
+			for (decltype(auto) h : totals[b]) h.fill(0);
+			std::size_t end = std::min(n, (b + 1) * block);
+			for (std::size_t i = b * block; i < end; ++i) {
+				for (unsigned p = 0; p < passes; ++p) ++totals[b][p][digit(entries[i].key, p)];
+			}
+		});
+
+		std::vector<Entry> buffer(n);
+		std::vector<Histogram> offsets(blocks);
+		for (unsigned p = 0; p < passes; ++p) {
+			// A digit shared by all keys leaves the order as it is
+			std::size_t same = 0;
+			for (std::size_t b = 0; b < blocks; ++b) same += totals[b][p][digit(entries[0].key, p)];
+			if (same == n) continue;
+
+			ParallelFor(blocks, threads, [&](std::size_t b, std::size_t) {
+				offsets[b].fill(0);
+				std::size_t end = std::min(n, (b + 1) * block);
+				for (std::size_t i = b * block; i < end; ++i) ++offsets[b][digit(entries[i].key, p)];
+			});
+
+			// Digit-major, then block order, so equal digits keep their order across blocks
+			std::size_t sum = 0;
+			for (std::size_t d = 0; d < digits; ++d) {
+				for (std::size_t b = 0; b < blocks; ++b) sum += std::exchange(offsets[b][d], sum);
+			}
+
+			ParallelFor(blocks, threads, [&](std::size_t b, std::size_t) {
+				Histogram& offset = offsets[b];
+				std::size_t end = std::min(n, (b + 1) * block);
+				for (std::size_t i = b * block; i < end; ++i) buffer[offset[digit(entries[i].key, p)]++] = entries[i];
+			});
+			entries.swap(buffer);
+		}
+	}
+}
+
+/// <summary>
+/// Interleaves the bits of x and y (x in the even bits): the Z-order curve
+/// </summary>
+inline std::uint64_t MortonKey(std::uint32_t x, std::uint32_t y) {
+	return curve_detail::spread(x) | (curve_detail::spread(y) << 1);
+}
+
+/// <summary>
+/// Returns the distance of cell (x, y) along the Hilbert curve over the 2^32 x 2^32 grid. Unlike the Z-order curve,
+/// consecutive keys are always neighbouring cells.
+/// The curve descends one quadrant per bit pair, and the orientation of each quadrant depends on all the bits above it.
+/// Instead of a 32-step loop with data-dependent branches, the orientations of all levels are computed at once by a
+/// prefix scan over the bit words: log2(32) rounds of shifts and masks
+/// </summary>
+inline std::uint64_t HilbertKey(std::uint32_t x, std::uint32_t y) {
+	constexpr std::uint32_t ones = UINT32_MAX;
+	// One bit of state per level; after the scan c and d hold the swap and flip composed from the levels above
+	std::uint32_t a, b, c, d;
+	{
+		std::uint32_t p = x ^ y, q = ones ^ p, r = ones ^ (x | y), s = x & (y ^ ones);
+		a = p | (q >> 1);
+		b = (p >> 1) ^ p;
+		c = ((r >> 1) ^ (q & (s >> 1))) ^ r;
+		d = ((p & (r >> 1)) ^ (s >> 1)) ^ s;
+	}
+	for (unsigned shift = 2; shift < 32; shift *= 2) {
+		std::uint32_t pa = a, pb = b, pc = c, pd = d;
+		a = (pa & (pa >> shift)) ^ (pb & (pb >> shift));
+		b = (pa & (pb >> shift)) ^ (pb & ((pa ^ pb) >> shift));
+		c ^= (pa & (pc >> shift)) ^ (pb & (pd >> shift));
+		d ^= (pb & (pc >> shift)) ^ ((pa ^ pb) & (pd >> shift));
+	}
+
+	std::uint32_t swapped = c ^ (c >> 1), flipped = d ^ (d >> 1);
+	std::uint32_t low = x ^ y;
+	std::uint32_t high = flipped | (ones ^ (low | swapped));
+	return (curve_detail::spread(high) << 1) | curve_detail::spread(low);
+}
+
+enum class Curve {
+	Morton,
+	Hilbert
+};
+
+/// <summary>
+/// Returns the curve keys of the rectangle centers, quantized to the bounding box of the collection.
+/// Runs on up to `threads` threads (0 = all cores)
+/// </summary>
+template<typename Type>
+std::vector<std::uint64_t> CurveKeys(std::span<const Rect<Type>> rects, Curve curve = Curve::Hilbert, std::size_t threads = 0) {
+	std::vector<std::uint64_t> keys(rects.size());
+	if (rects.empty()) return keys;
+
+	Rect<Type> box = BoundingBox(rects, threads);
+	// Centers are at most half a width from the left edge; a flat box maps its whole side to cell 0
+	constexpr double cells = 4294967295.0;
+	double x0 = double(box.Left()), y0 = double(box.Bottom());
+	double sx = box.width > 0 ? cells / double(box.width) : 0, sy = box.height > 0 ? cells / double(box.height) : 0;
+	auto quantize = [](double v) {
+		if (!(v > 0)) return std::uint32_t{ 0 }; // Also NaN
+		return v >= cells ? UINT32_MAX : static_cast<std::uint32_t>(v);
+	};
+
+	ParallelFor((rects.size() + curve_detail::block - 1) / curve_detail::block, threads, [&](std::size_t b, std::size_t) {
+		std::size_t end = std::min(rects.size(), (b + 1) * curve_detail::block);
+		for (std::size_t i = b * curve_detail::block; i < end; ++i) {
+			const Rect<Type>& r = rects[i];
+			std::uint32_t x = quantize((double(r.origin.x) + double(r.width) / 2 - x0) * sx);
+			std::uint32_t y = quantize((double(r.origin.y) + double(r.height) / 2 - y0) * sy);
+			keys[i] = curve == Curve::Hilbert ? HilbertKey(x, y) : MortonKey(x, y);
+		}
+	});
+	return keys;
+}
+
+/// <summary>
+/// Returns the permutation that orders the rectangles along the curve: order[k] is the original index of the
+/// k-th rectangle. Rectangles with equal keys keep their relative order; the result is the same for any number of threads
+/// </summary>
+template<typename Type>
+std::vector<std::size_t> CurveOrder(std::span<const Rect<Type>> rects, Curve curve = Curve::Hilbert, std::size_t threads = 0) {
+	std::vector<std::uint64_t> keys = CurveKeys(rects, curve, threads);
+	std::vector<curve_detail::Entry> entries(keys.size());
+	for (std::size_t i = 0; i < keys.size(); ++i) entries[i] = { keys[i], i };
+	curve_detail::radix_sort(entries, threads);
+
+	std::vector<std::size_t> order(entries.size());
+	for (std::size_t k = 0; k < entries.size(); ++k) order[k] = entries[k].id;
+	return order;
+}
+
+/// <summary>
+/// Reorders the rectangles along the curve and returns the original index of each one (see CurveOrder)
+/// </summary>
+template<typename Type>
+std::vector<std::size_t> SortAlongCurve(std::vector<Rect<Type>>& rects, Curve curve = Curve::Hilbert, std::size_t threads = 0) {
+	std::vector<std::size_t> order = CurveOrder(std::span<const Rect<Type>>(rects), curve, threads);
+	std::vector<Rect<Type>> sorted;
+	sorted.reserve(rects.size());
+	for (std::size_t id : order) sorted.push_back(rects[id]);
+	rects.swap(sorted);
+	return order;
+}
+
+template<typename Type>
+std::vector<std::uint64_t> CurveKeys(const std::vector<Rect<Type>>& rects, Curve curve = Curve::Hilbert, std::size_t threads = 0) {
+	return CurveKeys(std::span<const Rect<Type>>(rects), curve, threads);
+}
+
+template<typename Type>
+std::vector<std::size_t> CurveOrder(const std::vector<Rect<Type>>& rects, Curve curve = Curve::Hilbert, std::size_t threads = 0) {
+	return CurveOrder(std::span<const Rect<Type>>(rects), curve, threads);
+}
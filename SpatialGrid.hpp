@@ -0,0 +1,383 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept> // for std::invalid_argument
+#include <vector>
+
+/// <summary>
+/// Uniform grid (spatial hash) for many rectangles of similar size. Every rectangle is listed in each cell
+/// its Left()..Right() and Bottom()..Top() span covers; rectangles beyond the grid frame go to the border cells.
+/// The cells are one flat array filled by a counting sort (CSR: cell c owns entries[starts[c] .. starts[c + 1])).
+/// Insertions and moves that change cells are appended to per-cell chains in a second flat array, and the entries
+/// they replace are left behind as stale; once the chains and the stale entries outgrow half of the grid,
+/// everything is rebuilt by the counting sort again, so updates cost O(1) amortized.
+/// A window query reports every rectangle once: only from the first cell shared by the rectangle and the window
+/// </summary>
+template<typename Type>
+class SpatialGrid {
+	static_assert(std::is_arithmetic_v<Type>, "Type must be arithmetic");
+
+	static constexpr std::uint32_t null = UINT32_MAX;
+
+	struct CellRange {
+		std::uint32_t col0, row0, col1, row1;
+
+		std::size_t Cells() const {
+			return std::size_t(col1 - col0 + 1) * (row1 - row0 + 1);
+		}
+
+		bool operator==(const CellRange&) const = default;
+	};
+
+	struct Item {
+		CellRange cells;
+		std::uint32_t generation; // Changes when the rectangle changes cells; entries of older generations are stale
+		bool alive;
+	};
+
+	struct Entry {
+		std::uint32_t id;
+		std::uint32_t generation;
+	};
+
+	struct Link {
+		std::uint32_t id;
+		std::uint32_t generation;
+		std::uint32_t next;
+	};
+
+	// Rectangles apart from the rest, so a scan reads 4 values per entry; ids in spatial order help locality
+	std::vector<Rect<Type>> rects;
+	std::vector<Item> items;
+	std::vector<std::uint32_t> free_ids;
+	std::size_t count = 0;
+
+	double requested_cell; // 0 - automatic
+	double cell = 1, inverse = 1;
+	double x0 = 0, y0 = 0;
+	std::uint32_t cols = 1, rows = 1;
+
+	std::vector<std::size_t> starts{ 0, 0 };
+	std::vector<Entry> entries;
+	std::vector<std::uint32_t> heads{ null };
+	std::vector<Link> links;
+	std::size_t stale = 0;
+
+	static std::uint32_t clamp_index(double v, std::uint32_t size) {
+		if (!(v > 0)) return 0; // Also NaN
+		return v >= size ? size - 1 : static_cast<std::uint32_t>(v);
+	}
+
+	CellRange range_of(const Rect<Type>& r) const {
+		return {
+			clamp_index(std::floor((double(r.Left()) - x0) * inverse), cols),
+			clamp_index(std::floor((double(r.Bottom()) - y0) * inverse), rows),
+			clamp_index(std::floor((double(r.Right()) - x0) * inverse), cols),
+			clamp_index(std::floor((double(r.Top()) - y0) * inverse), rows) };
+	}
+
+	std::size_t cell_index(std::uint32_t col, std::uint32_t row) const {
+		return std::size_t(row) * cols + col;
+	}
+
+	/// <summary>
+	/// Chooses the frame and the cell size for the live rectangles
+	/// </summary>
+	void lay_out() {
+		double left = 0, bottom = 0, right = 0, top = 0, extent = 0;
+		bool first = true;
+		for (std::size_t id = 0; id < items.size(); ++id) {
+			if (!items[id].alive) continue;
+			const Rect<Type>& rect = rects[id];
+			double l = double(rect.Left()), b = double(rect.Bottom()), r = double(rect.Right()), t = double(rect.Top());
+			if (first) {
+				left = l, bottom = b, right = r, top = t;
+				first = false;
+			}
+			left = std::min(left, l), bottom = std::min(bottom, b), right = std::max(right, r), top = std::max(top, t);
+			extent += std::max(double(rect.width), double(rect.height));
+		}
+		double width = right - left, height = top - bottom;
+		double n = double(std::max<std::size_t>(count, 1));
+
+		// Automatic: the typical rectangle spans at most 2x2 cells, and sparse sets get about one rectangle per cell
+		cell = requested_cell > 0 ? requested_cell : std::max(extent / n, std::sqrt(width * height / n));
+		if (!(cell > 0)) cell = std::max(width, height) > 0 ? std::max(width, height) : 1;
+
+		// At most about 4 cells per rectangle, whatever the cell size asked for
+		double max_cells = std::max(4 * n, 1024.0);
+		while ((std::floor(width / cell) + 1) * (std::floor(height / cell) + 1) > max_cells) cell *= 2;
+
+		inverse = 1 / cell;
+		x0 = left;
+		y0 = bottom;
+		cols = static_cast<std::uint32_t>(std::floor(width * inverse)) + 1;
+		rows = static_cast<std::uint32_t>(std::floor(height * inverse)) + 1;
+	}
+
+	/// <summary>
+	/// Lays out the grid again and fills the CSR arrays by a counting sort; the chains become empty
+	/// </summary>
+	void rebuild() {
+		lay_out();
+		std::size_t cells = std::size_t(cols) * rows;
+		starts.assign(cells + 1, 0);
+		for (std::size_t id = 0; id < items.size(); ++id) {
+			Item& it = items[id];
+			if (!it.alive) continue;
+			it.cells = range_of(rects[id]);
+			for (std::uint32_t row = it.cells.row0; row <= it.cells.row1; ++row) {
+				for (std::uint32_t col = it.cells.col0; col <= it.cells.col1; ++col) ++starts[cell_index(col, row) + 1];
+			}
+		}
+		for (std::size_t c = 0; c < cells; ++c) starts[c + 1] += starts[c];
+
+		entries.resize(starts.back());
+		std::vector<std::size_t> fill(starts.begin(), starts.end() - 1);
+		for (std::uint32_t id = 0; id < items.size(); ++id) {
+			const Item& it = items[id];
+			if (!it.alive) continue;
+			for (std::uint32_t row = it.cells.row0; row <= it.cells.row1; ++row) {
+				for (std::uint32_t col = it.cells.col0; col <= it.cells.col1; ++col) {
+					entries[fill[cell_index(col, row)]++] = { id, it.generation };
+				}
+			}
+		}
+
+		heads.assign(cells, null);
+		links.clear();
+		stale = 0;
+	}
+
+	/// <summary>
+	/// Lists the rectangle in the chains of the given cells
+	/// </summary>
+	void place(std::uint32_t id, const CellRange& cells) {
+		Item& it = items[id];
+		it.cells = cells;
+		for (std::uint32_t row = it.cells.row0; row <= it.cells.row1; ++row) {
+			for (std::uint32_t col = it.cells.col0; col <= it.cells.col1; ++col) {
+				std::uint32_t& head = heads[cell_index(col, row)];
+				links.push_back({ id, it.generation, head });
+				head = static_cast<std::uint32_t>(links.size() - 1);
+			}
+		}
+	}
+
+	void maybe_rebuild() {
+		if (links.size() + stale > (entries.size() + links.size() - stale) / 2 + 256) rebuild();
+	}
+
+	void check(std::size_t id) const {
+		if (id >= items.size() || !items[id].alive)
+			throw std::invalid_argument("No rectangle with this id.");
+	}
+
+	/// <summary>
+	/// Calls visit(rect, id, generation) for every entry of the cell, stale ones included
+	/// </summary>
+	template<typename Visit>
+	void scan(std::size_t c, Visit&& visit) const {
+		for (std::size_t e = starts[c]; e < starts[c + 1]; ++e) visit(rects[entries[e].id], entries[e].id, entries[e].generation);
+		for (std::uint32_t l = heads[c]; l != null; l = links[l].next) visit(rects[links[l].id], links[l].id, links[l].generation);
+	}
+
+	bool live(std::uint32_t id, std::uint32_t generation) const {
+		return items[id].alive && items[id].generation == generation;
+	}
+
+public:
+	/// <summary>
+	/// cell_size - side of a cell; 0 picks it from the rectangles at every rebuild
+	/// </summary>
+	explicit SpatialGrid(double cell_size = 0)
+		: requested_cell{ cell_size }
+	{
+		if (!(cell_size >= 0))
+			throw std::invalid_argument("Cell size must be non-negative.");
+	}
+
+	/// <summary>
+	/// Builds the grid from the rectangles; ids are their indices
+	/// </summary>
+	SpatialGrid(std::span<const Rect<Type>> source, double cell_size = 0)
+		: SpatialGrid(cell_size)
+	{
+		Build(source);
+	}
+
+	SpatialGrid(const std::vector<Rect<Type>>& source, double cell_size = 0)
+		: SpatialGrid(std::span<const Rect<Type>>(source), cell_size)
+	{ }
+
+	/// <summary>
+	/// Replaces the contents with the rectangles; ids are their indices
+	/// </summary>
+	void Build(std::span<const Rect<Type>> source) {
+		rects.assign(source.begin(), source.end());
+		items.assign(source.size(), Item{ {}, 0, true });
+		free_ids.clear();
+		count = source.size();
+		rebuild();
+	}
+
+	void Build(const std::vector<Rect<Type>>& source) {
+		Build(std::span<const Rect<Type>>(source));
+	}
+
+	/// <summary>
+	/// Adds a rectangle and returns its id. Ids of removed rectangles are reused
+	/// </summary>
+	std::size_t Insert(const Rect<Type>& r) {
+		std::uint32_t id;
+		if (!free_ids.empty()) {
+			id = free_ids.back();
+			free_ids.pop_back();
+			rects[id] = r;
+			items[id] = { {}, items[id].generation + 1, true };
+		}
+		else {
+			id = static_cast<std::uint32_t>(items.size());
+			rects.push_back(r);
+			items.push_back({ {}, 0, true });
+		}
+		++count;
+		place(id, range_of(r));
+		maybe_rebuild();
+		return id;
+	}
+
+	/// <summary>
+	/// Removes a rectangle; throws std::invalid_argument for an unknown id
+	/// </summary>
+	void Remove(std::size_t id) {
+		check(id);
+		Item& it = items[id];
+		it.alive = false;
+		stale += it.cells.Cells();
+		free_ids.push_back(static_cast<std::uint32_t>(id));
+		--count;
+		maybe_rebuild();
+	}
+
+	/// <summary>
+	/// Updates the position of a rectangle. Returns true if it changed cells; otherwise nothing but the
+	/// rectangle itself is written
+	/// </summary>
+	bool Move(std::size_t id, const Rect<Type>& r) {
+		check(id);
+		Item& it = items[id];
+		rects[id] = r;
+		CellRange cells = range_of(r);
+		if (cells == it.cells) return false;
+
+		stale += it.cells.Cells();
+		++it.generation;
+		place(static_cast<std::uint32_t>(id), cells);
+		maybe_rebuild();
+		return true;
+	}
+
+	/// <summary>
+	/// Moves a rectangle by the given vector, as Rect::Move does
+	/// </summary>
+	bool Move(std::size_t id, const Point<Type>& movement) {
+		check(id);
+		Rect<Type> r = rects[id];
+		r.Move(movement);
+		return Move(id, r);
+	}
+
+	/// <summary>
+	/// Returns the rectangle with the given id
+	/// </summary>
+	const Rect<Type>& Get(std::size_t id) const {
+		check(id);
+		return rects[id];
+	}
+
+	std::size_t Size() const {
+		return count;
+	}
+
+	bool Empty() const {
+		return count == 0;
+	}
+
+	/// <summary>
+	/// Returns the side of a cell in use
+	/// </summary>
+	double CellSize() const {
+		return cell;
+	}
+
+	std::size_t Columns() const {
+		return cols;
+	}
+
+	std::size_t Rows() const {
+		return rows;
+	}
+
+	void Clear() {
+		rects.clear();
+		items.clear();
+		free_ids.clear();
+		count = 0;
+		rebuild();
+	}
+
+	/// <summary>
+	/// Calls f(id) once for every rectangle that overlaps the window
+	/// </summary>
+	template<typename F>
+	void Search(const Rect<Type>& window, F&& f) const {
+		if (count == 0) return;
+		CellRange w = range_of(window);
+		for (std::uint32_t row = w.row0; row <= w.row1; ++row) {
+			for (std::uint32_t col = w.col0; col <= w.col1; ++col) {
+				scan(cell_index(col, row), [&](const Rect<Type>& r, std::uint32_t id, std::uint32_t generation) {
+					if (!r.Overlaps(window) || !live(id, generation)) return;
+					// Reference point: report from the first cell the rectangle and the window share
+					const CellRange& cells = items[id].cells;
+					if (col == std::max(cells.col0, w.col0) && row == std::max(cells.row0, w.row0)) f(static_cast<std::size_t>(id));
+				});
+			}
+		}
+	}
+
+	/// <summary>
+	/// Returns the ids of the rectangles that overlap the window
+	/// </summary>
+	std::vector<std::size_t> Search(const Rect<Type>& window) const {
+		std::vector<std::size_t> result;
+		Search(window, [&](std::size_t id) { result.push_back(id); });
+		return result;
+	}
+
+	/// <summary>
+	/// Calls f(id) for every rectangle that contains the point
+	/// </summary>
+	template<typename F>
+	void SearchPoint(const Point<Type>& p, F&& f) const {
+		if (count == 0) return;
+		std::size_t c = cell_index(clamp_index(std::floor((double(p.x) - x0) * inverse), cols),
+			clamp_index(std::floor((double(p.y) - y0) * inverse), rows));
+		scan(c, [&](const Rect<Type>& r, std::uint32_t id, std::uint32_t generation) {
+			if (r.Contains(p) && live(id, generation)) f(static_cast<std::size_t>(id));
+		});
+	}
+
+	/// <summary>
+	/// Returns the ids of the rectangles that contain the point
+	/// </summary>
+	std::vector<std::size_t> SearchPoint(const Point<Type>& p) const {
+		std::vector<std::size_t> result;
+		SearchPoint(p, [&](std::size_t id) { result.push_back(id); });
+		return result;
+	}
+};
@@ -0,0 +1,271 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include "Parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept> // for std::invalid_argument
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace join_detail {
+
+	/// <summary>
+	/// Marks a join without refinement, so the intersection is never computed
+	/// </summary>
+	struct KeepAll {};
+
+	template<typename Type>
+	struct Interval {
+		Type left, right, bottom, top;
+		std::uint32_t id;
+	};
+
+	/// <summary>
+	/// Square tiles over the part of the plane where both inputs can meet. Coordinates beyond the frame fall
+	/// into the border tiles; the mapping is monotone, so a rectangle covers every tile between its corners
+	/// </summary>
+	struct Tiling {
+		double x0 = 0, y0 = 0, inverse = 1;
+		std::uint32_t cols = 1, rows = 1;
+		// Frame: the overlap of the two bounding boxes
+		double left = 0, bottom = 0, right = -1, top = -1;
+
+		static std::uint32_t clamp_index(double v, std::uint32_t size) {
+			if (!(v > 0)) return 0; // Also NaN
+			return v >= size ? size - 1 : static_cast<std::uint32_t>(v);
+		}
+
+		std::uint32_t Column(double x) const {
+			return clamp_index(std::floor((x - x0) * inverse), cols);
+		}
+
+		std::uint32_t Row(double y) const {
+			return clamp_index(std::floor((y - y0) * inverse), rows);
+		}
+
+		std::size_t Tiles() const {
+			return std::size_t(cols) * rows;
+		}
+
+		bool Empty() const {
+			return right < left || top < bottom;
+		}
+
+		/// <summary>
+		/// Indicates whether the rectangle can meet a rectangle of the other input
+		/// </summary>
+		template<typename Type>
+		bool Reaches(const Rect<Type>& r) const {
+			return double(r.Left()) <= right && double(r.Right()) >= left && double(r.Bottom()) <= top && double(r.Top()) >= bottom;
+		}
+	};
+
+	template<typename Type>
+	void bounds(std::span<const Rect<Type>> rects, double& left, double& bottom, double& right, double& top, double& extent) {
+		left = bottom = 0;
+		right = top = -1;
+		extent = 0;
+		for (std::size_t i = 0; i < rects.size(); ++i) {
+			const Rect<Type>& r = rects[i];
+			double l = double(r.Left()), b = double(r.Bottom()), rt = double(r.Right()), t = double(r.Top());
+			if (i == 0) left = l, bottom = b, right = rt, top = t;
+			left = std::min(left, l), bottom = std::min(bottom, b), right = std::max(right, rt), top = std::max(top, t);
+			extent += std::max(double(r.width), double(r.height));
+		}
+	}
+
+	/// <summary>
+	/// Lays tiles over the overlap of the bounding boxes. A tile holds about `per_tile` rectangles of an even
+	/// spread and is at least twice the mean rectangle extent, so few rectangles are copied into several tiles
+	/// </summary>
+	template<typename Type>
+	Tiling tile(std::span<const Rect<Type>> a, std::span<const Rect<Type>> b) {
+		constexpr double per_tile = 256;
+
+		Tiling t;
+		if (a.empty() || b.empty()) return t;
+
+		double al, ab, ar, at, ae, bl, bb, br, bt, be;
+		bounds(a, al, ab, ar, at, ae);
+		bounds(b, bl, bb, br, bt, be);
+		t.left = std::max(al, bl), t.bottom = std::max(ab, bb), t.right = std::min(ar, br), t.top = std::min(at, bt);
+		if (t.Empty()) return t;
+
+		double width = t.right - t.left, height = t.top - t.bottom;
+		double n = double(a.size() + b.size());
+		double size = std::max({ std::sqrt(width * height * per_tile / n), std::max(width, height) * per_tile / n,
+			2 * (ae + be) / n });
+		if (!(size > 0)) size = 1;
+
+		t.inverse = 1 / size;
+		t.x0 = t.left;
+		t.y0 = t.bottom;
+		t.cols = static_cast<std::uint32_t>(std::floor(width * t.inverse)) + 1;
+		t.rows = static_cast<std::uint32_t>(std::floor(height * t.inverse)) + 1;
+		return t;
+	}
+
+	/// <summary>
+	/// Ids of the rectangles in every tile they cover, by a counting sort (CSR: tile k owns ids[starts[k] .. starts[k + 1]))
+	/// </summary>
+	struct Buckets {
+		std::vector<std::size_t> starts;
+		std::vector<std::uint32_t> ids;
+	};
+
+	template<typename Type>
+	Buckets distribute(std::span<const Rect<Type>> rects, const Tiling& t) {
+		Buckets out;
+		out.starts.assign(t.Tiles() + 1, 0);
+
+		auto for_tiles = [&](const Rect<Type>& r, auto&& f) {
+			std::uint32_t c0 = t.Column(double(r.Left())), c1 = t.Column(double(r.Right()));
+			std::uint32_t r0 = t.Row(double(r.Bottom())), r1 = t.Row(double(r.Top()));
+			for (std::uint32_t row = r0; row <= r1; ++row) {
+				for (std::uint32_t col = c0; col <= c1; ++col) f(std::size_t(row) * t.cols + col);
+			}
+		};
+
+		for (const Rect<Type>& r : rects) {
+			if (t.Reaches(r)) for_tiles(r, [&](std::size_t k) { ++out.starts[k + 1]; });
+		}
+		for (std::size_t k = 0; k < t.Tiles(); ++k) out.starts[k + 1] += out.starts[k];
+
+		out.ids.resize(out.starts.back());
+		std::vector<std::size_t> cursor(out.starts.begin(), out.starts.end() - 1);
+		for (std::size_t i = 0; i < rects.size(); ++i) {
+			if (t.Reaches(rects[i])) for_tiles(rects[i], [&](std::size_t k) { out.ids[cursor[k]++] = static_cast<std::uint32_t>(i); });
+		}
+		return out;
+	}
+
+	template<typename Type>
+	void gather(std::span<const Rect<Type>> rects, const Buckets& buckets, std::size_t k, std::vector<Interval<Type>>& out) {
+		out.clear();
+		for (std::size_t e = buckets.starts[k]; e < buckets.starts[k + 1]; ++e) {
+			const Rect<Type>& r = rects[buckets.ids[e]];
+			out.push_back({ r.Left(), r.Right(), r.Bottom(), r.Top(), buckets.ids[e] });
+		}
+		std::sort(out.begin(), out.end(), [](const Interval<Type>& x, const Interval<Type>& y) { return x.left < y.left; });
+	}
+
+	/// <summary>
+	/// Joins the rectangles of one tile: both lists are swept together on Left(), each rectangle against the
+	/// rectangles of the other list that start before it ends. A pair is reported only by the tile holding
+	/// the bottom-left corner of its intersection, which both rectangles cover
+	/// </summary>
+	template<typename Type, typename Refine>
+	void join_tile(std::span<const Rect<Type>> a, std::span<const Rect<Type>> b, const Tiling& t, std::size_t k,
+		const std::vector<Interval<Type>>& as, const std::vector<Interval<Type>>& bs, Refine& refine,
+		std::vector<std::pair<std::size_t, std::size_t>>& out)
+	{
+		auto check = [&](const Interval<Type>& x, const Interval<Type>& y) {
+			if (y.bottom > x.top || y.top < x.bottom) return;
+			double rx = double(std::max(x.left, y.left)), ry = double(std::max(x.bottom, y.bottom));
+			if (std::size_t(t.Row(ry)) * t.cols + t.Column(rx) != k) return;
+			if constexpr (!std::is_same_v<Refine, KeepAll>) {
+				if (!refine(std::size_t{ x.id }, std::size_t{ y.id }, a[x.id].Intersect(b[y.id]))) return;
+			}
+			out.emplace_back(x.id, y.id);
+		};
+
+		std::size_t i = 0, j = 0;
+		while (i < as.size() && j < bs.size()) {
+			if (as[i].left <= bs[j].left) {
+				for (std::size_t m = j; m < bs.size() && bs[m].left <= as[i].right; ++m) check(as[i], bs[m]);
+				++i;
+			}
+			else {
+				for (std::size_t m = i; m < as.size() && as[m].left <= bs[j].right; ++m) check(as[m], bs[j]);
+				++j;
+			}
+		}
+	}
+
+	template<typename Type, typename Refine>
+	std::vector<std::pair<std::size_t, std::size_t>> join(std::span<const Rect<Type>> a, std::span<const Rect<Type>> b,
+		std::size_t threads, Refine& refine)
+	{
+		using Pairs = std::vector<std::pair<std::size_t, std::size_t>>;
+
+		if (a.size() > UINT32_MAX || b.size() > UINT32_MAX)
+			throw std::invalid_argument("Too many rectangles for 32-bit ids.");
+
+		Tiling t = tile(a, b);
+		if (t.Empty()) return {};
+		Buckets ba = distribute(a, t), bb = distribute(b, t);
+
+		// Pairs are kept per tile and joined in tile order, so the result is the same for any number of threads
+		std::vector<Pairs> partial(t.Tiles());
+		struct Scratch {
+			std::vector<Interval<Type>> as, bs;
+		};
+		std::vector<Scratch> scratch(threads == 0 ? HardwareThreads() : threads);
+
+		ParallelFor(t.Tiles(), threads, [&](std::size_t k, std::size_t worker) {
+			if (ba.starts[k] == ba.starts[k + 1] || bb.starts[k] == bb.starts[k + 1]) return;
+			Scratch& s = scratch[worker];
+			gather(a, ba, k, s.as);
+			gather(b, bb, k, s.bs);
+			join_tile(a, b, t, k, s.as, s.bs, refine, partial[k]);
+		});
+
+		std::size_t total = 0;
+		for (decltype(auto) p : partial) total += p.size();
+
+		Pairs result;
+		result.reserve(total);
+		for (decltype(auto) p : partial) result.insert(result.end(), p.begin(), p.end());
+		return result;
+	}
+}
+
+/// <summary>
+/// Returns every pair (i, j) where a[i] overlaps b[j] (touching edges count, as in Overlaps), grouped by tile.
+/// Partition-based spatial merge join: the overlap of the two bounding boxes is cut into tiles, each rectangle is
+/// listed in every tile it covers, and the tiles are swept independently on up to `threads` threads (0 = all cores).
+/// Every pair is reported once, by the tile holding the bottom-left corner of its intersection.
+/// The result is the same for any number of threads
+/// </summary>
+template<typename Type>
+std::vector<std::pair<std::size_t, std::size_t>> SpatialJoin(std::span<const Rect<Type>> a, std::span<const Rect<Type>> b,
+	std::size_t threads = 1)
+{
+	join_detail::KeepAll keep;
+	return join_detail::join(a, b, threads, keep);
+}
+
+/// <summary>
+/// Returns the overlapping pairs (i, j) for which refine(i, j, a[i].Intersect(b[j])) returns true.
+/// refine is called from the worker threads at the same time, so it must be safe to call concurrently
+/// </summary>
+template<typename Type, typename F>
+std::vector<std::pair<std::size_t, std::size_t>> SpatialJoin(std::span<const Rect<Type>> a, std::span<const Rect<Type>> b,
+	std::size_t threads, F&& refine)
+{
+	return join_detail::join(a, b, threads, refine);
+}
+
+/// <summary>
+/// Overload for rectangles stored in vectors
+/// </summary>
+template<typename Type>
+std::vector<std::pair<std::size_t, std::size_t>> SpatialJoin(const std::vector<Rect<Type>>& a, const std::vector<Rect<Type>>& b,
+	std::size_t threads = 1)
+{
+	return SpatialJoin(std::span<const Rect<Type>>(a), std::span<const Rect<Type>>(b), threads);
+}
+
+/// <summary>
+/// Overload for rectangles stored in vectors
+/// </summary>
+template<typename Type, typename F>
+std::vector<std::pair<std::size_t, std::size_t>> SpatialJoin(const std::vector<Rect<Type>>& a, const std::vector<Rect<Type>>& b,
+	std::size_t threads, F&& refine)
+{
+	return SpatialJoin(std::span<const Rect<Type>>(a), std::span<const Rect<Type>>(b), threads, refine);
+}
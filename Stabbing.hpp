@@ -0,0 +1,220 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include "Parallel.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept> // for std::invalid_argument
+#include <vector>
+
+/// <summary>
+/// CSR output of a batched stabbing query: the ids of the rectangles containing points[i]
+/// are ids[offsets[i] .. offsets[i + 1])
+/// </summary>
+struct StabbingResult {
+	std::vector<std::size_t> offsets;
+	std::vector<std::uint32_t> ids;
+
+	std::span<const std::uint32_t> operator[](std::size_t point) const {
+		return { ids.data() + offsets[point], offsets[point + 1] - offsets[point] };
+	}
+};
+
+/// <summary>
+/// Point-stabbing index: which rectangles contain a point (edges included, as in Rect::Contains).
+/// A centered interval tree over X; every node keeps the rectangles crossing its center twice,
+/// sorted by Left() ascending and by Right() descending, so a query only reads rectangles that contain
+/// the point along X and filters them by Y. Query time is O(log n + rectangles containing x)
+/// </summary>
+template<typename Type>
+class StabbingIndex {
+	static_assert(std::is_arithmetic_v<Type>, "Type must be arithmetic");
+
+	struct Item {
+		Type left, right, bottom, top;
+		std::uint32_t id;
+	};
+
+	struct Node {
+		Type center;
+		// Items crossing the center are by_left[first, last) and by_right[first, last)
+		std::size_t first, last;
+		std::int32_t below, above; // Children with Right() < center and Left() > center; -1 if none
+	};
+
+	std::vector<Node> nodes;
+	std::vector<Item> by_left, by_right;
+	std::size_t count = 0;
+
+	// Points per task of the batched queries
+	static constexpr std::size_t block = 2048;
+
+	std::int32_t build(std::vector<Item>& items, std::vector<Type>& ends) {
+		if (items.empty()) return -1;
+
+		ends.clear();
+		for (decltype(auto) it : items) {
+			ends.push_back(it.left);
+			ends.push_back(it.right);
+		}
+		auto mid = ends.begin() + ends.size() / 2;
+		std::nth_element(ends.begin(), mid, ends.end());
+		Type center = *mid;
+
+		std::vector<Item> below, above;
+		std::size_t first = by_left.size();
+		for (decltype(auto) it : items) {
+			if (it.right < center) below.push_back(it);
+			else if (it.left > center) above.push_back(it);
+			else {
+				by_left.push_back(it);
+				by_right.push_back(it);
+			}
+		}
+		std::size_t last = by_left.size();
+		std::sort(by_left.begin() + first, by_left.begin() + last, [](const Item& a, const Item& b) { return a.left < b.left; });
+		std::sort(by_right.begin() + first, by_right.begin() + last, [](const Item& a, const Item& b) { return a.right > b.right; });
+
+		items.clear();
+		items.shrink_to_fit();
+
+		std::int32_t self = static_cast<std::int32_t>(nodes.size());
+		nodes.push_back({ center, first, last, -1, -1 });
+		std::int32_t b = build(below, ends);
+		std::int32_t a = build(above, ends);
+		nodes[self].below = b;
+		nodes[self].above = a;
+		return self;
+	}
+
+public:
+	/// <summary>
+	/// Creates an empty index
+	/// </summary>
+	StabbingIndex() = default;
+
+	/// <summary>
+	/// Builds the index; queries report indices into rects
+	/// </summary>
+	explicit StabbingIndex(std::span<const Rect<Type>> rects)
+		: count{ rects.size() }
+	{
+		if (rects.size() > UINT32_MAX)
+			throw std::invalid_argument("Too many rectangles for 32-bit ids.");
+
+		std::vector<Item> items;
+		items.reserve(rects.size());
+		for (std::size_t i = 0; i < rects.size(); ++i) {
+			decltype(auto) r = rects[i];
+			items.push_back({ r.Left(), r.Right(), r.Bottom(), r.Top(), static_cast<std::uint32_t>(i) });
+		}
+		by_left.reserve(items.size());
+		by_right.reserve(items.size());
+
+		std::vector<Type> ends;
+		ends.reserve(items.size() * 2);
+		build(items, ends);
+	}
+
+	explicit StabbingIndex(const std::vector<Rect<Type>>& rects)
+		: StabbingIndex(std::span<const Rect<Type>>(rects))
+	{ }
+
+	/// <summary>
+	/// Returns the number of indexed rectangles
+	/// </summary>
+	std::size_t Size() const {
+		return count;
+	}
+
+	/// <summary>
+	/// Calls f(id) for every rectangle containing the point, in no particular order
+	/// </summary>
+	template<typename F>
+	void Stab(const Point<Type>& p, F&& f) const {
+		std::int32_t n = nodes.empty() ? -1 : 0;
+		while (n >= 0) {
+			const Node& node = nodes[n];
+			if (p.x < node.center) {
+				for (std::size_t i = node.first; i < node.last && by_left[i].left <= p.x; ++i) {
+					if (by_left[i].bottom <= p.y && p.y <= by_left[i].top) f(by_left[i].id);
+				}
+				n = node.below;
+			}
+			else if (p.x > node.center) {
+				for (std::size_t i = node.first; i < node.last && by_right[i].right >= p.x; ++i) {
+					if (by_right[i].bottom <= p.y && p.y <= by_right[i].top) f(by_right[i].id);
+				}
+				n = node.above;
+			}
+			else {
+				// Every rectangle of the node spans the center; the children lie strictly to either side
+				for (std::size_t i = node.first; i < node.last; ++i) {
+					if (by_left[i].bottom <= p.y && p.y <= by_left[i].top) f(by_left[i].id);
+				}
+				return;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Returns the number of rectangles containing the point
+	/// </summary>
+	std::size_t Count(const Point<Type>& p) const {
+		std::size_t n = 0;
+		Stab(p, [&](std::uint32_t) { ++n; });
+		return n;
+	}
+
+	/// <summary>
+	/// Writes the number of rectangles containing every point to counts (resized to points.size()),
+	/// without materializing ids. Runs on up to `threads` threads (0 = all cores)
+	/// </summary>
+	void Count(std::span<const Point<Type>> points, std::vector<std::uint32_t>& counts, std::size_t threads = 0) const {
+		counts.resize(points.size());
+		ParallelFor((points.size() + block - 1) / block, threads, [&](std::size_t task, std::size_t) {
+			std::size_t end = std::min(points.size(), (task + 1) * block);
+			for (std::size_t i = task * block; i < end; ++i) counts[i] = static_cast<std::uint32_t>(Count(points[i]));
+		});
+	}
+
+	/// <summary>
+	/// Finds the rectangles containing every point and writes them to out in CSR form, reusing its storage.
+	/// Counts first, so ids are written straight into place without per-thread buffers.
+	/// Runs on up to `threads` threads (0 = all cores)
+	/// </summary>
+	void Query(std::span<const Point<Type>> points, StabbingResult& out, std::size_t threads = 0) const {
+		std::size_t tasks = (points.size() + block - 1) / block;
+
+		out.offsets.resize(points.size() + 1);
+		out.offsets[0] = 0;
+		ParallelFor(tasks, threads, [&](std::size_t task, std::size_t) {
+			std::size_t end = std::min(points.size(), (task + 1) * block);
+			for (std::size_t i = task * block; i < end; ++i) out.offsets[i + 1] = Count(points[i]);
+		});
+		for (std::size_t i = 0; i < points.size(); ++i) out.offsets[i + 1] += out.offsets[i];
+
+		out.ids.resize(out.offsets.back());
+		ParallelFor(tasks, threads, [&](std::size_t task, std::size_t) {
+			std::size_t end = std::min(points.size(), (task + 1) * block);
+			for (std::size_t i = task * block; i < end; ++i) {
+				std::uint32_t* dst = out.ids.data() + out.offsets[i];
+				Stab(points[i], [&](std::uint32_t id) { *dst++ = id; });
+			}
+		});
+	}
+
+	/// <summary>
+	/// Returns the rectangles containing every point in CSR form
+	/// </summary>
+	StabbingResult Query(std::span<const Point<Type>> points, std::size_t threads = 0) const {
+		StabbingResult out;
+		Query(points, out, threads);
+		return out;
+	}
+
+	StabbingResult Query(const std::vector<Point<Type>>& points, std::size_t threads = 0) const {
+		return Query(std::span<const Point<Type>>(points), threads);
+	}
+};
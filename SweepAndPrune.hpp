@@ -0,0 +1,106 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include "Parallel.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace sweep_detail {
+
+	/// <summary>
+	/// Rectangle edges laid out contiguously so the sweep reads them without recomputing Right()/Top()
+	/// </summary>
+	template<typename Type>
+	struct Interval {
+		Type left, right, bottom, top;
+		std::size_t id;
+	};
+
+	template<typename Type>
+	std::vector<Interval<Type>> sorted_intervals(std::span<const Rect<Type>> rects) {
+		std::vector<Interval<Type>> sorted;
+		sorted.reserve(rects.size());
+		for (std::size_t i = 0; i < rects.size(); ++i) {
+			decltype(auto) r = rects[i];
+			sorted.push_back({ r.Left(), r.Right(), r.Bottom(), r.Top(), i });
+		}
+		std::sort(sorted.begin(), sorted.end(), [](const Interval<Type>& a, const Interval<Type>& b) {
+			return a.left < b.left;
+		});
+		return sorted;
+	}
+
+	/// <summary>
+	/// Reports every pair (i, j) with i in [begin, end) and j > i in sweep order
+	/// </summary>
+	template<typename Type, typename F>
+	void sweep(const std::vector<Interval<Type>>& sorted, std::size_t begin, std::size_t end, F& f) {
+		for (std::size_t i = begin; i < end; ++i) {
+			const Interval<Type>& a = sorted[i];
+			for (std::size_t j = i + 1; j < sorted.size() && sorted[j].left <= a.right; ++j) {
+				const Interval<Type>& b = sorted[j];
+				if (b.bottom <= a.top && b.top >= a.bottom) {
+					f(std::min(a.id, b.id), std::max(a.id, b.id));
+				}
+			}
+		}
+	}
+}
+
+/// <summary>
+/// Calls f(i, j) with i &lt; j for every pair of overlapping rectangles (touching edges count, as in Overlaps).
+/// Intervals are sorted on Left() and swept while Left() &lt;= Right(); Bottom()/Top() filter the candidates
+/// </summary>
+template<typename Type, typename F>
+void SweepAndPrune(std::span<const Rect<Type>> rects, F&& f) {
+	auto sorted = sweep_detail::sorted_intervals(rects);
+	sweep_detail::sweep(sorted, 0, sorted.size(), f);
+}
+
+/// <summary>
+/// Returns every pair (i, j), i &lt; j, of overlapping rectangles.
+/// The sweep is split into blocks of consecutive intervals that run on up to `threads` threads (0 = all cores);
+/// the result is the same for any number of threads
+/// </summary>
+template<typename Type>
+std::vector<std::pair<std::size_t, std::size_t>> OverlappingPairs(std::span<const Rect<Type>> rects, std::size_t threads = 1) {
+	using Pairs = std::vector<std::pair<std::size_t, std::size_t>>;
+
+	auto sorted = sweep_detail::sorted_intervals(rects);
+
+	// Many more blocks than threads, so dense regions of the sweep do not stall one worker
+	constexpr std::size_t block = 1024;
+	std::size_t blocks = (sorted.size() + block - 1) / block;
+	std::vector<Pairs> partial(blocks);
+
+	ParallelFor(blocks, threads, [&](std::size_t b, std::size_t) {
+		auto emit = [&](std::size_t i, std::size_t j) { partial[b].emplace_back(i, j); };
+		sweep_detail::sweep(sorted, b * block, std::min(sorted.size(), (b + 1) * block), emit);
+	});
+
+	std::size_t total = 0;
+	for (decltype(auto) p : partial) total += p.size();
+
+	Pairs result;
+	result.reserve(total);
+	for (decltype(auto) p : partial) result.insert(result.end(), p.begin(), p.end());
+	return result;
+}
+
+/// <summary>
+/// Overload for rectangles stored in a vector
+/// </summary>
+template<typename Type, typename F>
+void SweepAndPrune(const std::vector<Rect<Type>>& rects, F&& f) {
+	SweepAndPrune(std::span<const Rect<Type>>(rects), f);
+}
+
+/// <summary>
+/// Overload for rectangles stored in a vector
+/// </summary>
+template<typename Type>
+std::vector<std::pair<std::size_t, std::size_t>> OverlappingPairs(const std::vector<Rect<Type>>& rects, std::size_t threads = 1) {
+	return OverlappingPairs(std::span<const Rect<Type>>(rects), threads);
+}
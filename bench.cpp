@@ -0,0 +1,625 @@
+﻿#include "Rectangle.hpp"
+#include "Damage.hpp"
+#include "DynamicTree.hpp"
+#include "Packing.hpp"
+#include "Quantized.hpp"
+#include "RectBatch.hpp"
+#include "Reduce.hpp"
+#include "RTree.hpp"
+#include "SpaceFillingCurve.hpp"
+#include "SpatialGrid.hpp"
+#include "SpatialJoin.hpp"
+#include "Stabbing.hpp"
+#include "storage.hpp"
+#include "variables.hpp"
+#include "versioned.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Micro-benchmarks for the core operations.
+//
+//   rectangle_bench [--size N] [--samples S] [--dist uniform|clustered|degenerate|all] [--filter text] [--json]
+//
+// Every benchmark runs one operation over N inputs per sample; the time of a sample divided by N is one
+// observation of ns/op, and percentiles are taken over the samples.
+
+namespace {
+
+	struct Options {
+		size_t size = 100000;
+		size_t samples = 30;
+		std::vector<std::string> dists{ "uniform", "clustered", "degenerate" };
+		std::string filter;
+		bool json = false;
+	};
+
+	struct Result {
+		std::string name;
+		std::string dist;
+		size_t size;
+		double mean, min, p50, p90, p99;
+	};
+
+	// Results of every benchmark are folded into this, so the optimizer cannot drop the work
+	volatile std::uint64_t sink = 0;
+
+	template<typename T>
+	std::uint64_t fold(T v) {
+		if constexpr (std::is_floating_point_v<T>) return static_cast<std::uint64_t>(std::llround(v * 16));
+		else return static_cast<std::uint64_t>(v);
+	}
+
+	template<typename T>
+	std::uint64_t fold(const Rect<T>& r) {
+		return fold(r.origin.x) ^ (fold(r.origin.y) << 1) ^ (fold(r.width) << 2) ^ (fold(r.height) << 3);
+	}
+
+	double percentile(std::vector<double> sorted, double p) {
+		std::sort(sorted.begin(), sorted.end());
+		size_t i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+		return sorted[i];
+	}
+
+	/// <summary>
+	/// Rectangles with origins in [0, 10000) for the given distribution
+	/// </summary>
+	template<typename T>
+	std::vector<Rect<T>> make_rects(std::string_view dist, size_t n, unsigned seed) {
+		std::mt19937_64 gen(seed);
+		std::vector<Rect<T>> rects;
+		rects.reserve(n);
+
+		if (dist == "uniform") {
+			std::uniform_real_distribution<double> pos(0, 10000), size(0, 100);
+			for (size_t i = 0; i < n; ++i) rects.emplace_back(T(pos(gen)), T(pos(gen)), T(size(gen)), T(size(gen)));
+		}
+		else if (dist == "clustered") {
+			// A few dense hot spots: most rectangles overlap many others
+			std::uniform_real_distribution<double> center(1000, 9000), size(0, 20);
+			std::vector<std::pair<double, double>> centers(16);
+			for (decltype(auto) c : centers) c = { center(gen), center(gen) };
+			std::normal_distribution<double> spread(0, 50);
+			std::uniform_int_distribution<size_t> pick(0, centers.size() - 1);
+			for (size_t i = 0; i < n; ++i) {
+				auto [cx, cy] = centers[pick(gen)];
+				rects.emplace_back(T(cx + spread(gen)), T(cy + spread(gen)), T(size(gen)), T(size(gen)));
+			}
+		}
+		else {
+			// Zero-sized rectangles and repeated origins
+			std::uniform_int_distribution<int> corner(0, 3), kind(0, 2);
+			std::uniform_real_distribution<double> size(0, 100);
+			for (size_t i = 0; i < n; ++i) {
+				T x = T(corner(gen) * 2500), y = T(corner(gen) * 2500);
+				int k = kind(gen);
+				rects.emplace_back(x, y, k == 1 ? T(0) : T(size(gen)), k == 2 ? T(0) : T(size(gen)));
+			}
+		}
+		return rects;
+	}
+
+	class Runner {
+		Options options;
+		std::vector<Result> results;
+	public:
+		explicit Runner(Options options)
+			: options{ std::move(options) }
+		{ }
+
+		const Options& Settings() const {
+			return options;
+		}
+
+		/// <summary>
+		/// Times `samples` runs of body(), each doing `ops` operations
+		/// </summary>
+		void Run(const std::string& name, const std::string& dist, size_t ops, const std::function<std::uint64_t()>& body) {
+			if (!options.filter.empty() && name.find(options.filter) == name.npos) return;
+
+			sink = sink + body(); // Warm-up
+
+			std::vector<double> samples;
+			samples.reserve(options.samples);
+			for (size_t s = 0; s < options.samples; ++s) {
+				auto start = std::chrono::steady_clock::now();
+				sink = sink + body();
+				auto stop = std::chrono::steady_clock::now();
+				samples.push_back(std::chrono::duration<double, std::nano>(stop - start).count() / ops);
+			}
+
+			double mean = 0;
+			for (double v : samples) mean += v;
+			mean /= samples.size();
+
+			results.push_back({ name, dist, ops, mean, *std::min_element(samples.begin(), samples.end()),
+				percentile(samples, 0.5), percentile(samples, 0.9), percentile(samples, 0.99) });
+
+			if (!options.json) {
+				const Result& r = results.back();
+				std::cout << std::left << std::setw(36) << r.name << std::setw(12) << r.dist << std::right << std::fixed
+					<< std::setprecision(2) << std::setw(10) << r.p50 << std::setw(10) << r.p90 << std::setw(10) << r.p99
+					<< std::setw(16) << std::setprecision(0) << 1e9 / r.p50 << '\n';
+			}
+		}
+
+		void PrintJson() const {
+			std::cout << "{\n  \"size\": " << options.size << ",\n  \"samples\": " << options.samples << ",\n  \"results\": [\n";
+			for (size_t i = 0; i < results.size(); ++i) {
+				const Result& r = results[i];
+				std::cout << std::setprecision(4) << std::fixed
+					<< "    { \"name\": \"" << r.name << "\", \"dist\": \"" << r.dist << "\", \"size\": " << r.size
+					<< ", \"ns_per_op\": " << r.mean << ", \"min\": " << r.min << ", \"p50\": " << r.p50
+					<< ", \"p90\": " << r.p90 << ", \"p99\": " << r.p99 << ", \"ops_per_sec\": " << 1e9 / r.p50 << " }"
+					<< (i + 1 < results.size() ? ",\n" : "\n");
+			}
+			std::cout << "  ]\n}\n";
+		}
+	};
+
+	template<typename T>
+	void bench_rect(Runner& runner, const std::string& type, const std::string& dist) {
+		const size_t n = runner.Settings().size;
+		auto a = make_rects<T>(dist, n, 1);
+		auto b = make_rects<T>(dist, n, 2);
+		std::vector<Point<T>> points;
+		for (decltype(auto) r : b) points.push_back(r.origin);
+
+		runner.Run("Rect<" + type + ">::Intersect", dist, n, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < n; ++i) acc += fold(a[i].Intersect(b[i]));
+			return acc;
+		});
+		runner.Run("Rect<" + type + ">::Union", dist, n, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < n; ++i) acc += fold(a[i].Union(b[i]));
+			return acc;
+		});
+		runner.Run("Rect<" + type + ">::Contains(Point)", dist, n, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < n; ++i) acc += a[i].Contains(points[i]);
+			return acc;
+		});
+		runner.Run("Rect<" + type + ">::Contains(Rect)", dist, n, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < n; ++i) acc += a[i].Contains(b[i]);
+			return acc;
+		});
+		runner.Run("Rect<" + type + ">::Area", dist, n, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < n; ++i) acc += fold(a[i].Area());
+			return acc;
+		});
+		runner.Run("Rect<" + type + ">::Perimeter", dist, n, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < n; ++i) acc += fold(a[i].Perimeter());
+			return acc;
+		});
+		// Includes the negative width/height check
+		runner.Run("Rect<" + type + ">::Rect(x,y,w,h)", dist, n, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < n; ++i) acc += fold(Rect<T>(b[i].origin.x, a[i].origin.y, a[i].width, b[i].height));
+			return acc;
+		});
+
+		RectBatch<T> ba(a), bb(b);
+		runner.Run("RectBatch<" + type + ">::Intersect", dist, n, [&] {
+			RectBatch<T> r = ba.Intersect(bb);
+			return fold(r.X()[n / 2]);
+		});
+		runner.Run("RectBatch<" + type + ">::Contains(Point)", dist, n, [&] {
+			return static_cast<std::uint64_t>(ba.Contains(points[0])[n / 2]);
+		});
+	}
+
+	void bench_containers(Runner& runner, const std::string& dist) {
+		const size_t n = runner.Settings().size;
+		auto rects = make_rects<double>(dist, n, 3);
+
+		std::vector<std::string> names;
+		names.reserve(n);
+		for (size_t i = 0; i < n; ++i) names.push_back("var" + std::to_string(i * 7919 % n) + "_" + std::to_string(i));
+
+		VariableTable table;
+		std::unordered_map<std::string, Rect<double>> map;
+		for (size_t i = 0; i < n; ++i) {
+			table.Insert(names[i], rects[i]);
+			map.insert({ names[i], rects[i] });
+		}
+
+		runner.Run("VariableTable::Insert", dist, n, [&] {
+			VariableTable t;
+			for (size_t i = 0; i < n; ++i) t.Insert(names[i], rects[i]);
+			return static_cast<std::uint64_t>(t.Size());
+		});
+		runner.Run("unordered_map::insert", dist, n, [&] {
+			std::unordered_map<std::string, Rect<double>> m;
+			for (size_t i = 0; i < n; ++i) m.insert({ names[i], rects[i] });
+			return static_cast<std::uint64_t>(m.size());
+		});
+		runner.Run("VariableTable::Find", dist, n, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < n; ++i) acc += *table.Find(names[n - 1 - i]);
+			return acc;
+		});
+		runner.Run("unordered_map::find", dist, n, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < n; ++i) acc += fold(map.find(names[n - 1 - i])->second.width);
+			return acc;
+		});
+
+		VersionedTable versioned;
+		versioned.Update([&](VersionedTable::Transaction& tx) {
+			for (size_t i = 0; i < n; ++i) tx.InsertOrAssign(names[i], rects[i]);
+		});
+		runner.Run("VersionedTable snapshot Find", dist, n, [&] {
+			auto snapshot = versioned.Read();
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < n; ++i) acc += fold(snapshot.Find(names[n - 1 - i])->width);
+			return acc;
+		});
+		// One transaction per change: copies one segment each time
+		const size_t updates = std::max<size_t>(1, n / 1000);
+		runner.Run("VersionedTable::InsertOrAssign", dist, updates, [&] {
+			std::uint64_t version = 0;
+			for (size_t i = 0; i < updates; ++i) version = versioned.InsertOrAssign(names[i], rects[n - 1 - i]);
+			return version;
+		});
+	}
+
+	void bench_files(Runner& runner, const std::string& dist) {
+		namespace fs = std::filesystem;
+		const size_t n = runner.Settings().size;
+		auto rects = make_rects<double>(dist, n, 4);
+
+		VariableTable table;
+		for (size_t i = 0; i < n; ++i) table.Insert("var" + std::to_string(i), rects[i]);
+
+		fs::path text = fs::temp_directory_path() / "rectangle_bench.txt";
+		fs::path binary = fs::temp_directory_path() / "rectangle_bench.bin";
+
+		runner.Run("write_text", dist, n, [&] {
+			std::ofstream fout(text, std::ios::binary | std::ios::trunc);
+			write_text(fout, table);
+			return static_cast<std::uint64_t>(fout.tellp());
+		});
+		runner.Run("read_text_file", dist, n, [&] {
+			std::uint64_t acc = 0;
+			read_text_file(text, [&](std::string_view, const Rect<double>& r) { acc += fold(r.width); });
+			return acc;
+		});
+		runner.Run("write_binary_file", dist, n, [&] {
+			write_binary_file(binary, table);
+			return std::uint64_t{ 1 };
+		});
+		runner.Run("BinaryTable load", dist, n, [&] {
+			BinaryTable loaded(binary);
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < loaded.Size(); ++i) acc += fold(loaded.Get(i).width);
+			return acc;
+		});
+
+		fs::remove(text);
+		fs::remove(binary);
+	}
+
+	void bench_packing(Runner& runner, const std::string& dist) {
+		const size_t n = runner.Settings().size;
+		auto rects = make_rects<int>(dist, n, 5);
+
+		std::vector<PackSize> sizes;
+		sizes.reserve(n);
+		std::int64_t area = 0;
+		for (decltype(auto) r : rects) {
+			sizes.push_back({ r.width, r.height });
+			area += r.Area();
+		}
+
+		// A square bin with 20% slack over the total area
+		auto bin_side = [](std::int64_t area) {
+			return std::max(1, static_cast<int>(std::sqrt(static_cast<double>(area) * 1.2)));
+		};
+
+		runner.Run("Pack Skyline", dist, n, [&] {
+			int side = bin_side(area);
+			return static_cast<std::uint64_t>(Pack(sizes, side, side, PackMethod::Skyline).packed);
+		});
+
+		// MaxRects scans its free list, which grows with the item count, on every insertion
+		const size_t m = std::min<size_t>(n, 5000);
+		std::vector<PackSize> few(sizes.begin(), sizes.begin() + m);
+		std::int64_t few_area = 0;
+		for (decltype(auto) s : few) few_area += static_cast<std::int64_t>(s.width) * s.height;
+
+		runner.Run("Pack MaxRects BSSF (<= 5000)", dist, m, [&] {
+			int side = bin_side(few_area);
+			return static_cast<std::uint64_t>(Pack(few, side, side, PackMethod::MaxRectsBestShortSideFit).packed);
+		});
+		runner.Run("Pack MaxRects BAF (<= 5000)", dist, m, [&] {
+			int side = bin_side(few_area);
+			return static_cast<std::uint64_t>(Pack(few, side, side, PackMethod::MaxRectsBestAreaFit).packed);
+		});
+	}
+
+	void bench_spatial(Runner& runner, const std::string& dist) {
+		const size_t n = runner.Settings().size;
+		auto rects = make_rects<double>(dist, n, 7);
+		auto probes = make_rects<double>("uniform", n, 8);
+		RTree<double> tree(rects);
+		RTree<double>::NearestScratch scratch;
+
+		const size_t queries = std::min<size_t>(n, 10000);
+		runner.Run("RTree::Nearest k=8", dist, queries, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < queries; ++i) {
+				tree.Nearest(probes[i].origin, 8, scratch, [&](size_t index, double) { acc += index; });
+			}
+			return acc;
+		});
+		runner.Run("Rect::Distance(Point)", dist, n, [&] {
+			double acc = 0;
+			for (size_t i = 0; i < n; ++i) acc += rects[i].Distance(probes[i].origin);
+			return fold(acc);
+		});
+
+		// A few thousand rectangles against many points
+		std::vector<Rect<double>> few(rects.begin(), rects.begin() + std::min<size_t>(n, 4000));
+		std::vector<Point<double>> points;
+		points.reserve(n);
+		for (decltype(auto) r : probes) points.push_back(r.origin);
+		StabbingIndex<double> stabbing(few);
+		StabbingResult stabbed;
+		std::vector<std::uint32_t> counts;
+
+		runner.Run("StabbingIndex::Query (4000 rects)", dist, n, [&] {
+			stabbing.Query(points, stabbed, 1);
+			return static_cast<std::uint64_t>(stabbed.ids.size());
+		});
+		runner.Run("StabbingIndex::Query threads=all", dist, n, [&] {
+			stabbing.Query(points, stabbed);
+			return static_cast<std::uint64_t>(stabbed.ids.size());
+		});
+		runner.Run("StabbingIndex::Count threads=all", dist, n, [&] {
+			stabbing.Count(points, counts);
+			return static_cast<std::uint64_t>(counts.back());
+		});
+		// One tick of small moves: a dynamic tree updated in place against a static tree rebuilt from scratch
+		DynamicTree<double> dynamic(1.0);
+		std::vector<size_t> ids;
+		ids.reserve(n);
+		for (decltype(auto) r : rects) ids.push_back(dynamic.Insert(r));
+		std::vector<Rect<double>> moving = rects;
+		double phase = 0;
+		runner.Run("DynamicTree::Move tick", dist, n, [&] {
+			phase += 0.25;
+			std::uint64_t reinserted = 0;
+			for (size_t i = 0; i < n; ++i) {
+				moving[i].Move(Point<double>(0.1 * std::sin(phase + double(i)), 0.1 * std::cos(phase + double(i))));
+				reinserted += dynamic.Move(ids[i], moving[i]);
+			}
+			return reinserted;
+		});
+		runner.Run("RTree rebuild tick", dist, n, [&] {
+			RTree<double> rebuilt(moving);
+			return static_cast<std::uint64_t>(rebuilt.Height());
+		});
+		runner.Run("DynamicTree::Search", dist, queries, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < queries; ++i) dynamic.Search(probes[i], [&](size_t id) { acc += id; });
+			return acc;
+		});
+		runner.Run("RTree::Search", dist, queries, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < queries; ++i) tree.Search(probes[i], [&](size_t index) { acc += index; });
+			return acc;
+		});
+
+		// The same tick and queries on a uniform grid with an automatic cell size
+		SpatialGrid<double> grid(rects);
+		std::vector<Rect<double>> gridded = rects;
+		runner.Run("SpatialGrid build", dist, n, [&] {
+			SpatialGrid<double> built(rects);
+			return static_cast<std::uint64_t>(built.Columns() * built.Rows());
+		});
+		runner.Run("SpatialGrid::Move tick", dist, n, [&] {
+			phase += 0.25;
+			std::uint64_t changed = 0;
+			for (size_t i = 0; i < n; ++i) {
+				gridded[i].Move(Point<double>(0.1 * std::sin(phase + double(i)), 0.1 * std::cos(phase + double(i))));
+				changed += grid.Move(i, gridded[i]);
+			}
+			return changed;
+		});
+		runner.Run("SpatialGrid::Search", dist, queries, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < queries; ++i) grid.Search(probes[i], [&](size_t id) { acc += id; });
+			return acc;
+		});
+
+		// Space-filling-curve order: the radix sort against std::sort on the same keys, then the grid built from
+		// curve-ordered rectangles and the tree queried with curve-ordered probes
+		runner.Run("CurveOrder Hilbert", dist, n, [&] {
+			return static_cast<std::uint64_t>(CurveOrder(rects, Curve::Hilbert, 1).front());
+		});
+		runner.Run("CurveOrder Morton", dist, n, [&] {
+			return static_cast<std::uint64_t>(CurveOrder(rects, Curve::Morton, 1).front());
+		});
+		runner.Run("std::sort by Hilbert key", dist, n, [&] {
+			auto keys = CurveKeys(rects, Curve::Hilbert, 1);
+			std::vector<size_t> order(n);
+			for (size_t i = 0; i < n; ++i) order[i] = i;
+			std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+			return static_cast<std::uint64_t>(order.front());
+		});
+		std::vector<Rect<double>> curved = rects;
+		SortAlongCurve(curved);
+		SpatialGrid<double> curved_grid(curved);
+		runner.Run("SpatialGrid::Search curve-ordered", dist, queries, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < queries; ++i) curved_grid.Search(probes[i], [&](size_t id) { acc += id; });
+			return acc;
+		});
+		std::vector<Rect<double>> walk(probes.begin(), probes.begin() + queries);
+		SortAlongCurve(walk);
+		runner.Run("RTree::Search curve-ordered probes", dist, queries, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < queries; ++i) tree.Search(walk[i], [&](size_t index) { acc += index; });
+			return acc;
+		});
+
+		// Linear scans over the full set: 32-byte Rect<double> against 8-byte quantized boxes
+		QuantizedRects<double> quantized(rects);
+		std::vector<Rect<double>> decoded;
+		const Rect<double>& window = probes[0];
+		runner.Run("QuantizedRects::Encode", dist, n, [&] {
+			return static_cast<std::uint64_t>(QuantizedRects<double>(rects).Boxes().back().right);
+		});
+		runner.Run("QuantizedRects::Decode", dist, n, [&] {
+			quantized.Decode(decoded, 1);
+			return fold(decoded.back());
+		});
+		runner.Run("QuantizedRects::Search scan", dist, n, [&] {
+			std::uint64_t acc = 0;
+			quantized.Search(window, [&](size_t i) { acc += i; });
+			return acc;
+		});
+		runner.Run("Rect::Overlaps scan", dist, n, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < n; ++i) acc += rects[i].Overlaps(window) ? i : 0;
+			return acc;
+		});
+
+		const size_t scanned = std::min<size_t>(n, 1000);
+		runner.Run("Contains nested loop (4000 rects)", dist, scanned, [&] {
+			std::uint64_t acc = 0;
+			for (size_t i = 0; i < scanned; ++i) {
+				for (decltype(auto) r : few) acc += r.Contains(points[i]);
+			}
+			return acc;
+		});
+
+		// Two layers of a few thousand rectangles joined on every overlapping pair
+		std::vector<Rect<double>> layer = make_rects<double>(dist, few.size(), 9);
+		runner.Run("SpatialJoin (4000 x 4000)", dist, few.size(), [&] {
+			return static_cast<std::uint64_t>(SpatialJoin(few, layer).size());
+		});
+		runner.Run("SpatialJoin threads=all", dist, few.size(), [&] {
+			return static_cast<std::uint64_t>(SpatialJoin(few, layer, 0).size());
+		});
+		runner.Run("Overlaps nested loop (4000 x 4000)", dist, few.size(), [&] {
+			std::uint64_t acc = 0;
+			for (decltype(auto) a : few) {
+				for (decltype(auto) b : layer) acc += a.Overlaps(b);
+			}
+			return acc;
+		});
+	}
+
+	void bench_damage(Runner& runner, const std::string& dist) {
+		const size_t n = runner.Settings().size;
+		auto rects = make_rects<int>(dist, n, 6);
+
+		for (size_t k : { 8, 64 }) {
+			DamageAccumulator<int> damage(k);
+			std::vector<Rect<int>> frame;
+			runner.Run("DamageAccumulator::Insert K=" + std::to_string(k), dist, n, [&] {
+				for (decltype(auto) r : rects) damage.Insert(r);
+				damage.Flush(frame);
+				return static_cast<std::uint64_t>(frame.size());
+			});
+		}
+	}
+
+	void bench_reduce(Runner& runner, const std::string& dist) {
+		const size_t n = runner.Settings().size;
+		auto rects = make_rects<double>(dist, n, 7);
+		auto wide = [](const Rect<double>& r) { return r.width > r.height; };
+
+		for (size_t threads : { size_t{ 1 }, size_t{ 0 } }) {
+			std::string suffix = threads == 1 ? " 1 thread" : " all threads";
+			runner.Run("BoundingBox" + suffix, dist, n, [&] {
+				return fold(BoundingBox(rects, threads).Area());
+			});
+			runner.Run("SumArea" + suffix, dist, n, [&] {
+				return fold(SumArea(rects, threads));
+			});
+			runner.Run("SelectIf" + suffix, dist, n, [&] {
+				return static_cast<std::uint64_t>(SelectIf(rects, wide, threads).size());
+			});
+		}
+	}
+
+	Options parse(int argc, char* argv[]) {
+		Options options;
+		for (int i = 1; i < argc; ++i) {
+			std::string_view arg = argv[i];
+			auto value = [&]() -> std::string {
+				if (i + 1 >= argc) {
+					std::cerr << "Missing value for " << arg << '\n';
+					std::exit(1);
+				}
+				return argv[++i];
+			};
+
+			if (arg == "--size") options.size = std::stoul(value());
+			else if (arg == "--samples") options.samples = std::stoul(value());
+			else if (arg == "--filter") options.filter = value();
+			else if (arg == "--json") options.json = true;
+			else if (arg == "--dist") {
+				std::string dist = value();
+				if (dist != "all") options.dists = { dist };
+			}
+			else {
+				std::cerr << "Usage: " << argv[0]
+					<< " [--size N] [--samples S] [--dist uniform|clustered|degenerate|all] [--filter text] [--json]\n";
+				std::exit(1);
+			}
+		}
+		for (decltype(auto) d : options.dists) {
+			if (d != "uniform" && d != "clustered" && d != "degenerate") {
+				std::cerr << "Unknown distribution: " << d << '\n';
+				std::exit(1);
+			}
+		}
+		if (options.size == 0 || options.samples == 0) {
+			std::cerr << "Size and samples must be positive\n";
+			std::exit(1);
+		}
+		return options;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	Runner runner(parse(argc, argv));
+
+	if (!runner.Settings().json) {
+		std::cout << std::left << std::setw(36) << "benchmark" << std::setw(12) << "dist" << std::right
+			<< std::setw(10) << "p50 ns" << std::setw(10) << "p90 ns" << std::setw(10) << "p99 ns" << std::setw(16) << "ops/sec" << '\n';
+	}
+
+	for (decltype(auto) dist : runner.Settings().dists) {
+		bench_rect<int>(runner, "int", dist);
+		bench_rect<float>(runner, "float", dist);
+		bench_rect<double>(runner, "double", dist);
+		bench_containers(runner, dist);
+		bench_spatial(runner, dist);
+		bench_packing(runner, dist);
+		bench_damage(runner, dist);
+		bench_reduce(runner, dist);
+		bench_files(runner, dist);
+	}
+
+	if (runner.Settings().json) runner.PrintJson();
+	return 0;
+}
@@ -0,0 +1,362 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include "variables.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Производные переменные: значение переменной задается выражением над другими переменными
+/// (объединение, пересечение, сдвиг и их вложенные комбинации). Выражения образуют ациклический граф,
+/// результат каждого узла запоминается. Изменение переменной только помечает зависящие от нее узлы
+/// устаревшими; пересчет выполняется при чтении и затрагивает лишь устаревшие узлы.
+/// Запомненное значение производной переменной хранится в самой таблице, поэтому обход таблицы
+/// видит последнее вычисленное значение (см. Refresh)
+/// </summary>
+class ExpressionGraph {
+public:
+	using Handle = VariableTable::Handle;
+	using Node = std::uint32_t;
+
+private:
+	static constexpr Node null = UINT32_MAX;
+
+	enum class Op : std::uint8_t {
+		Var, // Переменная; left - корень ее выражения или null для обычной переменной
+		Union,
+		Intersect,
+		Move,
+		Free
+	};
+
+	struct NodeData {
+		Op op;
+		Node left, right;
+		Handle handle; // Для Var
+		Point<double> offset; // Для Move
+		Rect<double> value; // Запомненный результат (для Var - в таблице)
+		bool dirty;
+		std::uint32_t visited; // Метка обхода в depends_on
+		std::vector<Node> users; // Узлы, в которые этот входит аргументом
+	};
+
+	VariableTable& table;
+	std::vector<NodeData> nodes;
+	std::vector<Node> free_nodes;
+	std::vector<Node> var_nodes; // По дескриптору переменной; null - переменная не участвует в выражениях
+	std::vector<Node> stack;
+	std::size_t recomputed = 0;
+	std::uint32_t epoch = 0;
+
+	Node allocate(Op op, Node left, Node right) {
+		Node n;
+		if (!free_nodes.empty()) {
+			n = free_nodes.back();
+			free_nodes.pop_back();
+		}
+		else {
+			n = static_cast<Node>(nodes.size());
+			nodes.emplace_back();
+		}
+		nodes[n] = { op, left, right, 0, Point<double>(0, 0), Rect<double>(), true, 0, {} };
+		if (left != null) nodes[left].users.push_back(n);
+		if (right != null) nodes[right].users.push_back(n);
+		return n;
+	}
+
+	Node var_node(Handle h) const {
+		return h < var_nodes.size() ? var_nodes[h] : null;
+	}
+
+	const Rect<double>& value_of(Node n) const {
+		return nodes[n].op == Op::Var ? table[nodes[n].handle] : nodes[n].value;
+	}
+
+	static void unlink(NodeData& child, Node user) {
+		for (std::size_t i = 0; i < child.users.size(); ++i) {
+			if (child.users[i] == user) {
+				child.users[i] = child.users.back();
+				child.users.pop_back();
+				return;
+			}
+		}
+	}
+
+	/// <summary>
+	/// Отсоединение поддерева выражения от узла user; узлы выражения, которые больше нигде не используются, освобождаются
+	/// </summary>
+	void release(Node n, Node user) {
+		unlink(nodes[n], user);
+		if (nodes[n].op == Op::Var || !nodes[n].users.empty()) return;
+
+		Node left = nodes[n].left, right = nodes[n].right;
+		nodes[n].op = Op::Free;
+		free_nodes.push_back(n);
+		if (left != null) release(left, n);
+		if (right != null) release(right, n);
+	}
+
+	/// <summary>
+	/// Пометка устаревшими всех узлов, зависящих от n. Уже устаревшие узлы не обходятся повторно:
+	/// их зависимые помечены раньше
+	/// </summary>
+	void invalidate_users(Node n) {
+		stack.assign(nodes[n].users.begin(), nodes[n].users.end());
+		while (!stack.empty()) {
+			Node u = stack.back();
+			stack.pop_back();
+			if (nodes[u].dirty) continue;
+			nodes[u].dirty = true;
+			stack.insert(stack.end(), nodes[u].users.begin(), nodes[u].users.end());
+		}
+	}
+
+	/// <summary>
+	/// Зависит ли узел target от n. Поиск идет от n вверх по зависимым узлам, поэтому для переменной,
+	/// которую еще никто не использует, проверка мгновенная
+	/// </summary>
+	bool depends_on(Node target, Node n) {
+		if (target == n) return true;
+		++epoch;
+		stack.assign(1, n);
+		while (!stack.empty()) {
+			Node m = stack.back();
+			stack.pop_back();
+			for (Node u : nodes[m].users) {
+				if (u == target) return true;
+				if (nodes[u].visited == epoch) continue;
+				nodes[u].visited = epoch;
+				stack.push_back(u);
+			}
+		}
+		return false;
+	}
+
+	void compute(Node n) {
+		NodeData& d = nodes[n];
+		switch (d.op) {
+		case Op::Var:
+			table[d.handle] = value_of(d.left);
+			break;
+		case Op::Union:
+			d.value = value_of(d.left).Union(value_of(d.right));
+			break;
+		case Op::Intersect:
+			d.value = value_of(d.left).Intersect(value_of(d.right));
+			break;
+		case Op::Move:
+			d.value = value_of(d.left);
+			d.value.Move(d.offset);
+			break;
+		case Op::Free:
+			break;
+		}
+		d.dirty = false;
+		++recomputed;
+	}
+
+	/// <summary>
+	/// Пересчет устаревших узлов, от которых зависит n, в порядке зависимостей. Без рекурсии:
+	/// цепочки производных переменных могут быть сколь угодно длинными
+	/// </summary>
+	const Rect<double>& evaluate(Node n) {
+		stack.assign(1, n);
+		while (!stack.empty()) {
+			Node top = stack.back();
+			if (!nodes[top].dirty) {
+				stack.pop_back();
+				continue;
+			}
+			bool ready = true;
+			for (Node child : { nodes[top].left, nodes[top].right }) {
+				if (child != null && nodes[child].dirty) {
+					stack.push_back(child);
+					ready = false;
+				}
+			}
+			if (ready) {
+				compute(top);
+				stack.pop_back();
+			}
+		}
+		return value_of(n);
+	}
+
+	void describe(Node n, std::string& out) const {
+		const NodeData& d = nodes[n];
+		switch (d.op) {
+		case Op::Var:
+			out += table.Name(d.handle);
+			break;
+		case Op::Union:
+		case Op::Intersect:
+			out += '(';
+			describe(d.left, out);
+			out += d.op == Op::Union ? " | " : " & ";
+			describe(d.right, out);
+			out += ')';
+			break;
+		case Op::Move:
+			out += "move(";
+			describe(d.left, out);
+			out += ", " + std::to_string(d.offset.x) + ", " + std::to_string(d.offset.y) + ')';
+			break;
+		case Op::Free:
+			break;
+		}
+	}
+
+public:
+	explicit ExpressionGraph(VariableTable& table)
+		: table{ table }
+	{ }
+
+	ExpressionGraph(const ExpressionGraph&) = delete;
+	ExpressionGraph& operator=(const ExpressionGraph&) = delete;
+
+	/// <summary>
+	/// Узел-ссылка на переменную
+	/// </summary>
+	Node Ref(Handle h) {
+		Node n = var_node(h);
+		if (n != null) return n;
+
+		if (h >= var_nodes.size()) var_nodes.resize(std::size_t{ h } + 1, null);
+		n = allocate(Op::Var, null, null);
+		nodes[n].handle = h;
+		nodes[n].dirty = false;
+		var_nodes[h] = n;
+		return n;
+	}
+
+	Node Union(Node a, Node b) {
+		return allocate(Op::Union, a, b);
+	}
+
+	Node Intersect(Node a, Node b) {
+		return allocate(Op::Intersect, a, b);
+	}
+
+	Node Move(Node a, const Point<double>& offset) {
+		Node n = allocate(Op::Move, a, null);
+		nodes[n].offset = offset;
+		return n;
+	}
+
+	/// <summary>
+	/// Задание переменной выражения; прежнее выражение переменной отбрасывается.
+	/// Каждый построенный узел принадлежит одному выражению. Если выражение ссылается на саму
+	/// переменную (напрямую или через другие), выбрасывается исключение и переменная не меняется
+	/// </summary>
+	void Define(Handle h, Node expr) {
+		Node var = Ref(h);
+		if (depends_on(expr, var)) {
+			if (nodes[expr].op != Op::Var && nodes[expr].users.empty()) {
+				nodes[expr].users.push_back(var);
+				release(expr, var);
+			}
+			throw std::runtime_error("Циклическая зависимость: выражение ссылается на " + std::string(table.Name(h)));
+		}
+
+		if (nodes[var].left != null) release(nodes[var].left, var);
+		nodes[var].left = expr;
+		nodes[expr].users.push_back(var);
+		nodes[var].dirty = true;
+		invalidate_users(var);
+	}
+
+	/// <summary>
+	/// Является ли переменная производной
+	/// </summary>
+	bool IsDerived(Handle h) const {
+		Node n = var_node(h);
+		return n != null && nodes[n].left != null;
+	}
+
+	/// <summary>
+	/// Используется ли переменная в выражениях других переменных
+	/// </summary>
+	bool Used(Handle h) const {
+		Node n = var_node(h);
+		return n != null && !nodes[n].users.empty();
+	}
+
+	/// <summary>
+	/// Актуальное значение переменной; пересчитываются только устаревшие узлы.
+	/// Ссылка действительна до следующей вставки в таблицу
+	/// </summary>
+	const Rect<double>& Get(Handle h) {
+		Node n = var_node(h);
+		return n == null ? table[h] : evaluate(n);
+	}
+
+	/// <summary>
+	/// Значение переменной записано в таблицу напрямую: производная переменная становится обычной,
+	/// зависящие от нее узлы устаревают
+	/// </summary>
+	void Assigned(Handle h) {
+		Node n = var_node(h);
+		if (n == null) return;
+		if (nodes[n].left != null) {
+			release(nodes[n].left, n);
+			nodes[n].left = null;
+		}
+		nodes[n].dirty = false;
+		invalidate_users(n);
+	}
+
+	/// <summary>
+	/// Забыть переменную перед удалением из таблицы; переменную, используемую другими, удалить нельзя
+	/// </summary>
+	void Erase(Handle h) {
+		Node n = var_node(h);
+		if (n == null) return;
+		if (!nodes[n].users.empty())
+			throw std::runtime_error("Переменная используется в выражениях других переменных: " + std::string(table.Name(h)));
+
+		if (nodes[n].left != null) release(nodes[n].left, n);
+		nodes[n].op = Op::Free;
+		free_nodes.push_back(n);
+		var_nodes[h] = null;
+	}
+
+	/// <summary>
+	/// Пересчет всех устаревших производных переменных, чтобы таблица содержала актуальные значения;
+	/// changed(handle) вызывается для каждой пересчитанной переменной
+	/// </summary>
+	template<typename F>
+	void Refresh(F&& changed) {
+		for (Handle h = 0; h < var_nodes.size(); ++h) {
+			Node n = var_nodes[h];
+			if (n != null && nodes[n].dirty) {
+				evaluate(n);
+				changed(h);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Выражение переменной в виде текста, например "(a | b) &amp; c"; пустая строка для обычной переменной
+	/// </summary>
+	std::string ToString(Handle h) const {
+		std::string out;
+		if (IsDerived(h)) describe(nodes[var_node(h)].left, out);
+		return out;
+	}
+
+	/// <summary>
+	/// Число пересчитанных узлов за все время
+	/// </summary>
+	std::size_t Recomputed() const {
+		return recomputed;
+	}
+
+	void Clear() {
+		nodes.clear();
+		free_nodes.clear();
+		var_nodes.clear();
+		stack.clear();
+	}
+};
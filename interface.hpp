@@ -1,14 +1,30 @@
 ﻿#pragma once
+#include "expressions.hpp"
+#include "Instrumentation.hpp"
+#include "journal.hpp"
 #include "Rectangle.hpp"
+#include "storage.hpp"
+#include "variables.hpp"
+#include <cassert>
+#include <clocale>
+#include <cstdlib>
 #include <iomanip>
+#include <iostream>
+#include <limits>
 #include <string>
 #include <string_view>
-#include <conio.h>
-#include <unordered_map>
-#include <Windows.h>
+#include <vector>
 #include <filesystem>
 #include <fstream>
 
+#ifdef _WIN32
+#include <conio.h>
+#include <Windows.h>
+#else
+#include <termios.h>
+#include <unistd.h>
+#endif
+
 #ifdef max
 #undef max
 #endif
@@ -17,7 +33,13 @@ using Rectd = Rect<double>;
 namespace fs = std::filesystem;
 
 // Все переменные
-std::unordered_map<std::string, Rectd> vals;
+VariableTable vals;
+
+// Журнал изменений vals; открывается в main_menu, до этого записи не ведутся
+Journal journal("variables");
+
+// Выражения производных переменных; действуют до конца сеанса, в журнал попадают вычисленные значения
+ExpressionGraph derived(vals);
 
 // Выравнивание в выводе
 constexpr std::streamsize align = 60;
@@ -32,7 +54,54 @@ constexpr std::string_view invalid_file = " \\|/:\"\'*<>?!$.";
 /// Очистка консоли
 /// </summary>
 void clear_console() {
+#ifdef _WIN32
 	system("cls");
+#else
+	std::cout << "\033[2J\033[H" << std::flush;
+#endif
+}
+
+/// <summary>
+/// Ввод закончился: меню продолжать нечем
+/// </summary>
+[[noreturn]] void input_closed() {
+	std::cout << "Fatal error";
+	std::exit(0);
+}
+
+/// <summary>
+/// Чтение одной клавиши без ожидания Enter
+/// </summary>
+int read_key() {
+#ifdef _WIN32
+	return _getch();
+#else
+	std::cout << std::flush;
+
+	int c;
+	termios old_mode{};
+	if (tcgetattr(STDIN_FILENO, &old_mode) != 0) {
+		// Не терминал: перевод строки после предыдущего ввода - не выбор пункта
+		do c = std::cin.get(); while (c == '\n' || c == '\r');
+	}
+	else {
+		termios raw = old_mode;
+		raw.c_lflag &= ~(ICANON | ECHO);
+		tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+		c = std::getchar();
+		tcsetattr(STDIN_FILENO, TCSANOW, &old_mode);
+	}
+
+	if (c == EOF) input_closed();
+	return c;
+#endif
+}
+
+/// <summary>
+/// Чтение слова; при конце ввода - выход
+/// </summary>
+void read_word(std::string& input) {
+	if (!(std::cin >> input)) input_closed();
 }
 
 /// <summary>
@@ -53,7 +122,7 @@ size_t check_ask(std::string_view ann, std::vector<std::string_view> command) {
 
 		std::cout << "\n\n";
 
-		input = _getch();
+		input = read_key();
 		
 		clear_console();
 
@@ -63,18 +132,29 @@ size_t check_ask(std::string_view ann, std::vector<std::string_view> command) {
 	} while (true);
 }
 
+/// <summary>
+/// Пересчет устаревших производных переменных с записью новых значений в журнал
+/// </summary>
+void refresh_vals() {
+	derived.Refresh([](VariableTable::Handle h) { journal.Put(vals.Name(h), vals[h]); });
+}
+
 /// <summary>
 /// Отображение всех перменных
 /// </summary>
 void show_vals() {
-	if (vals.empty()) {
+	refresh_vals();
+	if (vals.Empty()) {
 		std::cout << "Переменных нет\n";
 	}
 	else {
 		std::cout << std::setw(align) << std::left << "Имя переменной" << "Значение" << "\n\n";
 
-		for (decltype(auto) v : vals) {
-			std::cout << std::setw(align) << std::left << v.first << v.second.ToString() << '\n';
+		for (auto it = vals.begin(); it != vals.end(); ++it) {
+			decltype(auto) v = *it;
+			std::cout << std::setw(align) << std::left << v.first << v.second.ToString();
+			if (derived.IsDerived(it.handle())) std::cout << " = " << derived.ToString(it.handle());
+			std::cout << '\n';
 		}
 	}
 	std::cout << '\n';
@@ -93,10 +173,7 @@ double get_abs_double(std::string ann) {
 		clear_console();
 
 		if (!std::cin) {
-			if (std::cin.eof()) {
-				std::cout << "Fatal error";
-				std::exit(0);
-			}
+			if (std::cin.eof()) input_closed();
 
 			std::cin.clear();
 
@@ -124,10 +201,7 @@ double get_double(std::string_view ann) {
 		clear_console();
 
 		if (!std::cin) {
-			if (std::cin.eof()) {
-				std::cout << "Fatal error";
-				std::exit(0);
-			}
+			if (std::cin.eof()) input_closed();
 
 			std::cin.clear();
 
@@ -142,10 +216,11 @@ double get_double(std::string_view ann) {
 /// <summary>
 /// Меню выбора переменной
 /// </summary>
-Rectd& choice_rect(std::string_view ann) {
+VariableTable::Handle choice_val(std::string_view ann) {
+	RECT_PROBE(ChoiceRect);
 	std::string input;
 	
-	if (vals.empty()) throw std::runtime_error("Нет переменных");
+	if (vals.Empty()) throw std::runtime_error("Нет переменных");
 
 	do {
 		std::cout << ann;
@@ -154,16 +229,33 @@ Rectd& choice_rect(std::string_view ann) {
 		
 		std::cout << "Введите имя переменной: ";
 
-		std::cin >> input;
+		read_word(input);
 
 		clear_console();
 
-		if (vals.contains(input)) return vals.at(input);
+		if (auto h = vals.Find(input)) return *h;
 		else std::cout << "Такой переменной нет\n\n";
 
 	} while (true);
 }
 
+/// <summary>
+/// Создание или изменение переменной с записью в журнал
+/// </summary>
+void store_val(std::string_view name, const Rectd& value) {
+	derived.Assigned(vals.InsertOrAssign(name, value));
+	journal.Put(name, value);
+}
+
+/// <summary>
+/// Создание производной переменной из выражения с записью вычисленного значения в журнал
+/// </summary>
+void define_val(std::string_view name, ExpressionGraph::Node expr) {
+	VariableTable::Handle h = vals.Insert(name, Rectd()).first;
+	derived.Define(h, expr);
+	journal.Put(name, derived.Get(h));
+}
+
 /// <summary>
 /// Меню создания значения переменной
 /// </summary>
@@ -174,46 +266,68 @@ void create_val_value(std::string name) {
 			"Создать прямоуольник по точке, высоте и широте",
 			"Создать прямоугольник из обьединения двух прямоугольников",
 			"Создать прямоугольник из пересечения двух прямоугольников",
+			"Создать прямоугольник сдвигом существующего",
 			"Назад"
 			})) {
 		case 1:
-			vals.insert({ name, Rectd() });
+			store_val(name, Rectd());
 			return;
 		case 2:
-			vals.insert({ name, Rectd(get_double("Введите координату X: "), get_double("Введите координату Y: "),
-				get_abs_double("Введите ширину: "),get_abs_double("Введите высоту: ")) });
+			store_val(name, Rectd(get_double("Введите координату X: "), get_double("Введите координату Y: "),
+				get_abs_double("Введите ширину: "),get_abs_double("Введите высоту: ")));
 			return;
 		case 3:
-			if (vals.size() < 2) {
+			if (vals.Size() < 2) {
 				std::cout << "Слишком мало существующих переменных для обьединения\n\n";
 				break;
 			}
 			else {
-				vals.insert({ name, choice_rect("Выберите первый прямоугольник для обьединения: \n").Union(
-					choice_rect("Выберите второй прямоугольник для обьединения: \n")) });
+				auto a = derived.Ref(choice_val("Выберите первый прямоугольник для обьединения: \n"));
+				auto b = derived.Ref(choice_val("Выберите второй прямоугольник для обьединения: \n"));
+				define_val(name, derived.Union(a, b));
 				return;
 			}
 		case 4:
-			if (vals.size() < 2) {
+			if (vals.Size() < 2) {
 				std::cout << "Слишком мало существующих переменных для пересечения\n\n";
 				break;
 			}
 			else {
-				vals.insert({ name, choice_rect("Выберите первый прямоугольник для пересечения: \n").Union(
-					choice_rect("Выберите второй прямоугольник для пересечения: \n")) });
+				auto a = derived.Ref(choice_val("Выберите первый прямоугольник для пересечения: \n"));
+				auto b = derived.Ref(choice_val("Выберите второй прямоугольник для пересечения: \n"));
+				define_val(name, derived.Intersect(a, b));
 				return;
 			}
 		case 5:
+			if (vals.Empty()) {
+				std::cout << "Нет существующих переменных для сдвига\n\n";
+				break;
+			}
+			else {
+				auto a = derived.Ref(choice_val("Выберите прямоугольник для сдвига: \n"));
+				Point<double> offset(get_double("Введите сдвиг по X: "), get_double("Введите сдвиг по Y: "));
+				define_val(name, derived.Move(a, offset));
+				return;
+			}
+		case 6:
 			return;
 		}
 	} while (true);
 }
 
 /// <summary>
-/// Проверка имени переменной
+/// Допустимость имени переменной; одна проверка для меню, скриптов и сервера, чтобы любую созданную
+/// переменную можно было выбрать в меню. Пробельные символы сделали бы текстовый файл переменных нечитаемым
+/// </summary>
+bool valid_name(std::string_view name) {
+	return !name.empty() and name.find_first_of(invalid_name) == name.npos and name.find_first_of("\t\r\n") == name.npos;
+}
+
+/// <summary>
+/// Проверка имени новой переменной
 /// </summary>
 bool check_value_name(std::string_view name) {
-	return name.find_first_of(invalid_name) == name.npos and !vals.contains(name.data());
+	return valid_name(name) and !vals.Contains(name);
 }
 
 /// <summary>
@@ -225,7 +339,7 @@ void create_val_name() {
 		show_vals();
 
 		std::string name;
-		std::cin >> name;
+		read_word(name);
 		
 		clear_console();
 
@@ -245,14 +359,19 @@ void create_val_name() {
 /// Меню манипуляций с переменной
 /// </summary>
 void manipulate_value() {
-	if (vals.empty()) {
+	if (vals.Empty()) {
 		std::cout << "Для начала создайте переменные\n\n";
 		return;
 	}
 
-	Rectd& r = choice_rect("");
+	VariableTable::Handle h = choice_val("");
+	std::string name(vals.Name(h));
 	do {
-		switch (check_ask("Выбранный прямоугольник: " + r.ToString() + "\n\n", {
+		// Копия: изменение производной переменной делает ее обычной (store_val)
+		Rectd r = derived.Get(h);
+		std::string title = "Выбранный прямоугольник: " + r.ToString();
+		if (derived.IsDerived(h)) title += " = " + derived.ToString(h);
+		switch (check_ask(title + "\n\n", {
 			"Показать площадь",
 			"Показать периметр",
 			"Задать новую точку Х",
@@ -269,15 +388,19 @@ void manipulate_value() {
 			break;
 		case 3:
 			r.origin.x = get_double("Введите новую точку Х: ");
+			store_val(name, r);
 			break;
 		case 4:
 			r.origin.y = get_double("Введите новую точку Y: ");
+			store_val(name, r);
 			break;
 		case 5:
 			r.height = get_abs_double("Введите новую высоту: ");
+			store_val(name, r);
 			break;
 		case 6:
 			r.width = get_abs_double("Введите новую ширину: ");
+			store_val(name, r);
 			break;
 		case 7:
 			return;
@@ -293,7 +416,7 @@ fs::path create_file() {
 	do {
 		std::cout << "Введите имя файла: ";
 
-		std::cin >> input;
+		read_word(input);
 
 		if (input.find_first_of(invalid_file) == input.npos) return input;
 		else std::cout << "Некорректное имя файла, попробуйте снова\n\n";
@@ -304,11 +427,12 @@ fs::path create_file() {
 /// Считывание с файла
 /// </summary>
 void read_file() {
+	RECT_PROBE(ReadFile);
 	std::string input;
 	std::cout << "Внимание! При коллизии имен, существующие перменные будут перезаписаны\n";
 	std::cout << "Введите имя файла: ";
 
-	std::cin >> input;
+	read_word(input);
 
 	if (!fs::exists(input)) {
 		std::cout << "Файл не найден, попробуйте снова\n\n";
@@ -317,20 +441,29 @@ void read_file() {
 	
 	fs::path fn = input;
 
-	std::ifstream fin(fn);
-
-	if (!fin.is_open()) {
-		std::cout << "Не удалось открыть файл " << fn << "\n\n";
-		return;
+	// Одна запись журнала на переменную, но один сброс на весь файл; записи, сделанные до ошибки, тоже сбрасываются
+	journal.BeginBatch();
+	try {
+		if (is_binary_file(fn)) {
+			// Отображение открывается мгновенно, но переменные копируются в vals целиком: загрузка линейна
+			// по числу записей, зато дальше переменные ничем не отличаются от созданных в меню
+			BinaryTable table(fn);
+			vals.Reserve(vals.Size() + table.Size());
+			for (size_t i = 0; i < table.Size(); ++i) {
+				store_val(table.Name(i), table.Get(i));
+			}
+		}
+		else {
+			read_text_file(fn, [](std::string_view n, const Rectd& r) {
+				store_val(n, r);
+			});
+		}
 	}
-
-	std::string n;
-	double x = 0, y = 0, w = 0, h = 0;
-	while (!fin.eof() and fin.good()) {
-		fin >> n >> x >> y >> w >> h;
-		if (vals.contains(n)) vals.at(n) = Rectd(x, y, w, h);
-		else vals.insert({ n, Rectd(x,y,w,h) });
+	catch (...) {
+		journal.Flush();
+		throw;
 	}
+	journal.Flush();
 
 	std::cout << "Переменные загружены\n\n";
 }
@@ -339,33 +472,99 @@ void read_file() {
 /// Запись в файл
 /// </summary>
 void write_file() {
-	if (vals.empty()) {
+	RECT_PROBE(WriteFile);
+	if (vals.Empty()) {
 		std::cout << "Нет переменных для сохранения\n\n";
 		return;
 	}
 
+	size_t format = check_ask("Выберите формат файла\n\n", {
+		"Текстовый",
+		"Бинарный",
+		"Назад" });
+	if (format == 3) return;
+
 	fs::path fn = create_file();
+	refresh_vals();
 
-	std::ofstream fout(fn, std::ios::app);
+	if (format == 2) {
+		write_binary_file(fn, vals);
+	}
+	else {
+		std::ofstream fout(fn, std::ios::trunc);
 
-	if (!fout.is_open()) {
-		std::cout << "Не удалось открыть файл " << fn << "\n\n";
+		if (!fout.is_open()) {
+			std::cout << "Не удалось открыть файл " << fn << "\n\n";
+			return;
+		}
+
+		write_text(fout, vals);
+	}
+
+	std::cout << "Успешно сохранено в файл: " << fn << "\n\n";
+}
+
+/// <summary>
+/// Конвертация файла между текстовым и бинарным форматом
+/// </summary>
+void convert_file() {
+	size_t direction = check_ask("", {
+		"Текстовый файл в бинарный",
+		"Бинарный файл в текстовый",
+		"Назад" });
+	if (direction == 3) return;
+
+	std::string input;
+	std::cout << "Введите имя исходного файла: ";
+
+	read_word(input);
+
+	if (!fs::exists(input)) {
+		std::cout << "Файл не найден, попробуйте снова\n\n";
 		return;
 	}
 
-	for (decltype(auto) v : vals) {
-		decltype(auto) r = v.second;
-		fout << std::setw(align) << std::left << v.first 
-			<< r.origin.x << ' ' << r.origin.y << ' ' << r.width << ' ' << r.height << '\n';
+	fs::path to = create_file();
+
+	if (direction == 1) convert_text_to_binary(input, to);
+	else convert_binary_to_text(input, to);
+
+	std::cout << "Файл " << input << " сконвертирован в " << to << "\n\n";
+}
+
+/// <summary>
+/// Счетчики вызовов и задержек; доступны при сборке с RECTANGLE_INSTRUMENT
+/// </summary>
+void show_statistics() {
+	if (!instrumentation::Enabled()) {
+		std::cout << "Инструментирование выключено, соберите программу с опцией RECTANGLE_INSTRUMENT\n\n";
+		return;
 	}
 
-	fout.close();
+	instrumentation::PrintStatistics(std::cout);
+	std::cout << '\n';
 
-	std::cout << "Успешно сохранено в файл: " << fn << "\n\n";
+	switch (check_ask("", {
+		"Экспорт трассировки (Chrome trace JSON)",
+		"Сбросить счетчики",
+		"Назад" })) {
+	case 1: {
+		fs::path fn = create_file();
+		std::ofstream fout(fn, std::ios::trunc);
+		if (!fout.is_open()) throw std::runtime_error("Не удалось открыть файл " + fn.string());
+		instrumentation::WriteChromeTrace(fout);
+		std::cout << "Трассировка сохранена в файл: " << fn << "\n\n";
+		break;
+	}
+	case 2:
+		instrumentation::Reset();
+		std::cout << "Счетчики сброшены\n\n";
+		break;
+	}
 }
 
 void delete_val() {
-	if (vals.empty()) {
+	if (vals.Empty()) {
 		std::cout << "Нет переменных для удаления\n\n";
 		return;
 	}
@@ -377,12 +576,18 @@ void delete_val() {
 
 		std::cout << "Введите имя переменной: ";
 
-		std::cin >> input;
+		read_word(input);
 
 		clear_console();
 
-		if (vals.contains(input)) {
-			vals.erase(input);
+		if (auto h = vals.Find(input)) {
+			if (derived.Used(*h)) {
+				std::cout << "Переменная используется в выражениях других переменных\n\n";
+				return;
+			}
+			derived.Erase(*h);
+			vals.Erase(input);
+			journal.Erase(input);
 			std::cout << "Переменная удалена\n\n";
 			return;
 		}
@@ -395,10 +600,20 @@ void delete_val() {
 /// </summary>
 void main_menu() {
 	setlocale(LC_ALL, "RU-ru");
+#ifdef _WIN32
 	SetConsoleCP(1251);
 	SetConsoleOutputCP(1251);
+#endif
 
 	clear_console();
+	try {
+		journal.Open(vals);
+		if (!vals.Empty()) std::cout << "Восстановлено переменных: " << vals.Size() << "\n\n";
+	}
+	catch (const std::exception& e) {
+		std::cout << "Не удалось открыть журнал переменных: " << e.what() << "\n\n";
+	}
+
 	while (true) {
 		try {
 			switch (check_ask("", { 
@@ -408,6 +623,8 @@ void main_menu() {
 				"Изменить переменную",
 				"Загрузить переменные из файла",
 				"Выгрузить переменные в файл",
+				"Конвертировать файл",
+				"Статистика",
 				"Закончить"})) {
 			case 1:
 				show_vals();
@@ -428,6 +645,14 @@ void main_menu() {
 				write_file();
 				break;
 			case 7:
+				convert_file();
+				break;
+			case 8:
+				show_statistics();
+				break;
+			case 9:
+				refresh_vals();
+				journal.Close();
 				std::cout << "До свидания!\n";
 				return;
 			}
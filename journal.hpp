@@ -0,0 +1,345 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include "storage.hpp"
+#include "variables.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace journal_format {
+	// Сигнатура файла журнала и версия формата
+	constexpr char magic[8] = { 'R', 'E', 'C', 'T', 'J', 'R', 'N', '\0' };
+	constexpr std::uint32_t version = 1;
+
+	struct Header {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t reserved;
+	};
+
+	enum class Op : std::uint8_t {
+		Put = 1,
+		Erase = 2
+	};
+
+	/// <summary>
+	/// Заголовок записи; за ним следуют size байт: операция, длина имени (uint32), имя и для Put - StoredRect
+	/// </summary>
+	struct RecordHeader {
+		std::uint32_t size;
+		std::uint32_t checksum; // FNV-1a от содержимого записи
+	};
+
+	static_assert(sizeof(Header) == 16 && sizeof(RecordHeader) == 8, "Journal layout must not contain padding");
+
+	inline std::uint32_t checksum(const char* data, std::size_t size) {
+		std::uint32_t h = 2166136261u;
+		for (std::size_t i = 0; i < size; ++i) {
+			h ^= static_cast<unsigned char>(data[i]);
+			h *= 16777619u;
+		}
+		return h;
+	}
+}
+
+/// <summary>
+/// Журнал изменений таблицы переменных: каждое создание, изменение и удаление дописывает в конец файла
+/// короткую запись, так что стоимость сохранения зависит от изменения, а не от размера таблицы.
+/// Когда журнал перерастает снимок, он сжимается: начинается новый файл журнала, а фоновый поток пишет
+/// копию таблицы в снимок (бинарный формат storage.hpp) и удаляет старые файлы журнала.
+/// Восстановление: снимок и затем все файлы журнала по порядку поколений; записи идемпотентны,
+/// поэтому сбой на любом шаге сжатия не теряет и не искажает данные. Оборванная последняя запись
+/// (сбой во время записи) отбрасывается по контрольной сумме.
+/// Файлы: base.snapshot и base.N.journal, где N - номер поколения
+/// </summary>
+class Journal {
+	std::filesystem::path base;
+	std::uintmax_t compact_bytes;
+
+	const VariableTable* table = nullptr;
+	std::ofstream out;
+	std::uint64_t generation = 0;
+	std::uintmax_t journal_bytes = 0;
+	std::vector<char> record;
+	std::vector<char> buffer = std::vector<char>(std::size_t{ 1 } << 16); // Буфер файла: пакет записей уходит в ОС крупными блоками
+	bool batched = false;
+
+	std::thread compactor;
+	std::exception_ptr failure;
+
+	std::filesystem::path snapshot_path() const {
+		return std::filesystem::path(base.string() + ".snapshot");
+	}
+
+	std::filesystem::path journal_path(std::uint64_t n) const {
+		return std::filesystem::path(base.string() + "." + std::to_string(n) + ".journal");
+	}
+
+	/// <summary>
+	/// Поколения существующих файлов журнала по возрастанию
+	/// </summary>
+	std::vector<std::uint64_t> generations() const {
+		std::filesystem::path dir = base.parent_path().empty() ? std::filesystem::path(".") : base.parent_path();
+		std::string prefix = base.filename().string() + ".";
+		constexpr std::string_view suffix = ".journal";
+
+		std::vector<std::uint64_t> result;
+		std::error_code ec;
+		for (decltype(auto) entry : std::filesystem::directory_iterator(dir, ec)) {
+			std::string name = entry.path().filename().string();
+			if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+				name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) continue;
+
+			std::string_view digits(name.data() + prefix.size(), name.size() - prefix.size() - suffix.size());
+			std::uint64_t n = 0;
+			auto [end, err] = std::from_chars(digits.data(), digits.data() + digits.size(), n);
+			if (err == std::errc() && end == digits.data() + digits.size()) result.push_back(n);
+		}
+		std::sort(result.begin(), result.end());
+		return result;
+	}
+
+	/// <summary>
+	/// Применение записей одного файла; возвращает их число. Чтение останавливается на первой неполной
+	/// или поврежденной записи
+	/// </summary>
+	static std::size_t replay(const std::filesystem::path& path, VariableTable& target) {
+		using namespace journal_format;
+
+		MappedFile file(path);
+		const char* data = reinterpret_cast<const char*>(file.Data());
+		const std::size_t size = file.Size();
+		// Файл, оборванный при создании, еще не содержит записей
+		if (size < sizeof(Header)) return 0;
+		if (std::memcmp(data, magic, sizeof(magic)) != 0)
+			throw std::runtime_error("Файл поврежден или имеет неизвестный формат " + path.string());
+
+		Header header;
+		std::memcpy(&header, data, sizeof(header));
+		if (header.version != version)
+			throw std::runtime_error("Неподдерживаемая версия журнала: " + std::to_string(header.version));
+
+		std::size_t applied = 0;
+		std::size_t pos = sizeof(Header);
+		while (size - pos >= sizeof(RecordHeader)) {
+			RecordHeader rh;
+			std::memcpy(&rh, data + pos, sizeof(rh));
+			const char* p = data + pos + sizeof(rh);
+			if (rh.size > size - pos - sizeof(rh) || rh.size < 5 || checksum(p, rh.size) != rh.checksum) break;
+
+			Op op = static_cast<Op>(p[0]);
+			std::uint32_t length;
+			std::memcpy(&length, p + 1, sizeof(length));
+			std::size_t expected = 5 + std::size_t{ length } + (op == Op::Put ? sizeof(binary_format::StoredRect) : 0);
+			if (expected != rh.size || (op != Op::Put && op != Op::Erase)) break;
+
+			std::string_view name(p + 5, length);
+			if (op == Op::Put) {
+				binary_format::StoredRect s;
+				std::memcpy(&s, p + 5 + length, sizeof(s));
+				target.InsertOrAssign(name, Rect<double>(s.x, s.y, s.width, s.height));
+			}
+			else {
+				target.Erase(name);
+			}
+			++applied;
+			pos += sizeof(rh) + rh.size;
+		}
+		return applied;
+	}
+
+	void start_generation() {
+		using namespace journal_format;
+
+		out.close();
+		++generation;
+		out.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+		out.open(journal_path(generation), std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) throw std::runtime_error("Не удалось открыть файл " + journal_path(generation).string());
+
+		Header header{};
+		std::memcpy(header.magic, magic, sizeof(magic));
+		header.version = version;
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.flush();
+		journal_bytes = sizeof(header);
+	}
+
+	void wait() {
+		if (compactor.joinable()) compactor.join();
+		if (failure) std::rethrow_exception(std::exchange(failure, nullptr));
+	}
+
+	void append(journal_format::Op op, std::string_view name, const Rect<double>* value) {
+		using namespace journal_format;
+		if (!table) return;
+
+		std::size_t size = 5 + name.size() + (value ? sizeof(binary_format::StoredRect) : 0);
+		record.resize(sizeof(RecordHeader) + size);
+		char* p = record.data() + sizeof(RecordHeader);
+		p[0] = static_cast<char>(op);
+		std::uint32_t length = static_cast<std::uint32_t>(name.size());
+		std::memcpy(p + 1, &length, sizeof(length));
+		std::memcpy(p + 5, name.data(), name.size());
+		if (value) {
+			binary_format::StoredRect s{ value->origin.x, value->origin.y, value->width, value->height };
+			std::memcpy(p + 5 + name.size(), &s, sizeof(s));
+		}
+		RecordHeader rh{ static_cast<std::uint32_t>(size), checksum(p, size) };
+		std::memcpy(record.data(), &rh, sizeof(rh));
+
+		out.write(record.data(), static_cast<std::streamsize>(record.size()));
+		if (!out) throw std::runtime_error("Не удалось записать журнал " + journal_path(generation).string());
+		journal_bytes += record.size();
+		if (!batched) Flush();
+	}
+
+public:
+	/// <summary>
+	/// base - путь без расширения; compact_bytes - размер журнала, начиная с которого он сжимается
+	/// (сжатие начинается не раньше, чем журнал перерастет снимок)
+	/// </summary>
+	explicit Journal(std::filesystem::path base, std::uintmax_t compact_bytes = std::uintmax_t{ 1 } << 20)
+		: base{ std::move(base) }, compact_bytes{ compact_bytes }
+	{ }
+
+	Journal(const Journal&) = delete;
+	Journal& operator=(const Journal&) = delete;
+
+	~Journal() {
+		try {
+			Close();
+		}
+		catch (...) {
+		}
+	}
+
+	/// <summary>
+	/// Восстановление таблицы из снимка и журнала и начало записи нового поколения журнала.
+	/// Таблица очищается; дальнейшие Put и Erase должны следовать за ее изменениями.
+	/// Возвращает число примененных записей журнала
+	/// </summary>
+	std::size_t Open(VariableTable& target) {
+		Close();
+		target.Clear();
+
+		std::error_code ec;
+		std::filesystem::remove(std::filesystem::path(snapshot_path().string() + ".tmp"), ec);
+
+		if (std::filesystem::exists(snapshot_path())) {
+			BinaryTable snapshot(snapshot_path());
+			target.Reserve(snapshot.Size());
+			for (std::size_t i = 0; i < snapshot.Size(); ++i) target.InsertOrAssign(snapshot.Name(i), snapshot.Get(i));
+		}
+
+		std::size_t applied = 0;
+		generation = 0;
+		for (std::uint64_t n : generations()) {
+			applied += replay(journal_path(n), target);
+			generation = n;
+		}
+
+		table = &target;
+		start_generation();
+		// Иначе каждый запуск оставлял бы по файлу журнала
+		if (applied > 0) Compact();
+		return applied;
+	}
+
+	bool IsOpen() const {
+		return table != nullptr;
+	}
+
+	/// <summary>
+	/// Запись о создании или изменении переменной; вызывается после изменения таблицы
+	/// </summary>
+	void Put(std::string_view name, const Rect<double>& value) {
+		append(journal_format::Op::Put, name, &value);
+	}
+
+	/// <summary>
+	/// Запись об удалении переменной; вызывается после изменения таблицы
+	/// </summary>
+	void Erase(std::string_view name) {
+		append(journal_format::Op::Erase, name, nullptr);
+	}
+
+	/// <summary>
+	/// Начало пакета: следующие Put и Erase только дописываются в буфер, без сброса в ОС и без сжатия.
+	/// Пакет завершает Flush; до него записи пакета могут быть потеряны при падении программы
+	/// </summary>
+	void BeginBatch() {
+		batched = true;
+	}
+
+	/// <summary>
+	/// Сброс записей в ОС одним вызовом и завершение пакета: после возврата изменения переживут падение
+	/// программы (но не ОС). Если журнал перерос снимок, он сжимается
+	/// </summary>
+	void Flush() {
+		batched = false;
+		if (!table) return;
+		out.flush();
+		if (!out) throw std::runtime_error("Не удалось записать журнал " + journal_path(generation).string());
+
+		// Снимок - около 48 байт на переменную; сжатие окупается, когда журнал больше снимка
+		if (journal_bytes > std::max<std::uintmax_t>(compact_bytes, table->Size() * 48)) Compact();
+	}
+
+	/// <summary>
+	/// Сжатие: новый файл журнала и фоновая запись снимка текущего состояния.
+	/// Копия таблицы снимается сразу, поэтому изменения можно продолжать, не дожидаясь записи
+	/// </summary>
+	void Compact() {
+		if (!table) return;
+		wait();
+
+		std::uint64_t covered = generation;
+		auto copy = std::make_shared<const VariableTable>(*table);
+		start_generation();
+
+		compactor = std::thread([this, copy, covered] {
+			try {
+				std::filesystem::path tmp(snapshot_path().string() + ".tmp");
+				write_binary_file(tmp, *copy);
+				std::filesystem::rename(tmp, snapshot_path());
+				for (std::uint64_t n : generations()) {
+					if (n <= covered) std::filesystem::remove(journal_path(n));
+				}
+			}
+			catch (...) {
+				failure = std::current_exception();
+			}
+		});
+	}
+
+	/// <summary>
+	/// Размер текущего файла журнала в байтах
+	/// </summary>
+	std::uintmax_t JournalBytes() const {
+		return journal_bytes;
+	}
+
+	/// <summary>
+	/// Ожидание фонового сжатия и закрытие журнала; ошибка сжатия передается вызывающему
+	/// </summary>
+	void Close() {
+		table = nullptr;
+		batched = false;
+		out.close();
+		wait();
+	}
+};
@@ -1,7 +1,31 @@
 ﻿#include "tests.hpp"
 #include "interface.hpp"
+#include "script.hpp"
+#include "server.hpp"
+
+int main(int argc, char* argv[]) {
+    std::string_view mode = argc > 1 ? argv[1] : "";
+
+    // Rectangle --test                 run the tests and exit
+    // Rectangle --script [file | -]    run commands from a file or stdin without the menu
+    // Rectangle --server socket        serve queries on a Unix socket until SIGINT or SIGTERM (Linux)
+    if (mode == "--test") {
+        all_tests();
+        return 0;
+    }
+    if (mode == "--script") {
+        std::ios::sync_with_stdio(false);
+        if (argc > 2 && std::string_view(argv[2]) != "-") return run_script_file(argv[2]);
+        return run_script(std::cin, std::cout);
+    }
+    if (mode == "--server" && argc > 2) {
+        return run_server(argv[2]);
+    }
+    if (!mode.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--test | --script [file | -] | --server socket]\n";
+        return 1;
+    }
 
-int main() {
     all_tests();
     main_menu();
     return 0;
@@ -0,0 +1,284 @@
+﻿#pragma once
+#include "interface.hpp"
+#include <charconv>
+#include <exception>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+/// <summary>
+/// Пакетный режим: выполняет команды из файла или стандартного ввода без меню и очистки консоли.
+///
+///   let a = rect 0 0 5 5     создать или перезаписать переменную
+///   let c = a &amp; b          пересечение, "a | b" - объединение, "a" - копия
+///   set a width 3            изменить x, y, width или height
+///   move a 1 -2              сдвинуть прямоугольник
+///   delete a                 удалить переменную
+///   area c / perimeter c     вывести площадь или периметр
+///   show [a]                 вывести переменную (или все) в текстовом формате
+///   count / clear            число переменных / удалить все
+///   load file / save file    загрузка и сохранение; файл *.bin пишется в бинарном формате
+///   statistics [reset]       счетчики вызовов и задержек (сборка с RECTANGLE_INSTRUMENT) / их сброс
+///   trace file               трассировка в формате Chrome trace-event JSON
+///
+/// Пустые строки и строки, начинающиеся с '#', пропускаются
+/// </summary>
+class ScriptRunner {
+	std::ostream& out;
+	std::string buffer;
+	std::vector<std::string_view> tokens;
+	size_t errors = 0;
+
+	// Вывод копится в буфере и сбрасывается большими блоками
+	static constexpr size_t flush_at = size_t{ 1 } << 20;
+
+	static void split(std::string_view line, std::vector<std::string_view>& result) {
+		result.clear();
+		size_t pos = 0;
+		while (true) {
+			pos = line.find_first_not_of(" \t\r", pos);
+			if (pos == line.npos) return;
+			size_t end = line.find_first_of(" \t\r", pos);
+			if (end == line.npos) end = line.size();
+			result.push_back(line.substr(pos, end - pos));
+			pos = end;
+		}
+	}
+
+	static double number(std::string_view s) {
+		if (!s.empty() && s.front() == '+') s.remove_prefix(1);
+		double v = 0;
+		auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), v);
+		if (ec != std::errc() || end != s.data() + s.size())
+			throw std::runtime_error("Ожидалось число: " + std::string(s));
+		return v;
+	}
+
+	static Rectd& find(std::string_view name) {
+		return vals.At(name);
+	}
+
+	void expect(size_t count) const {
+		if (tokens.size() != count) throw std::runtime_error("Неверное число аргументов команды " + std::string(tokens[0]));
+	}
+
+	void write(std::string_view s) {
+		buffer.append(s);
+	}
+
+	void write(double v) {
+		char digits[32];
+		buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), v).ptr);
+	}
+
+	void write(size_t v) {
+		char digits[24];
+		buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), v).ptr);
+	}
+
+	void write_var(std::string_view name, const Rectd& r) {
+		write(name);
+		write(" ");
+		write(r.origin.x);
+		write(" ");
+		write(r.origin.y);
+		write(" ");
+		write(r.width);
+		write(" ");
+		write(r.height);
+		write("\n");
+	}
+
+	Rectd evaluate(size_t first) const {
+		size_t n = tokens.size() - first;
+		if (n == 5 && tokens[first] == "rect") {
+			return Rectd(number(tokens[first + 1]), number(tokens[first + 2]),
+				number(tokens[first + 3]), number(tokens[first + 4]));
+		}
+		if (n == 3 && tokens[first + 1] == "&") return find(tokens[first]).Intersect(find(tokens[first + 2]));
+		if (n == 3 && tokens[first + 1] == "|") return find(tokens[first]).Union(find(tokens[first + 2]));
+		if (n == 1) return find(tokens[first]);
+		throw std::runtime_error("Неверное выражение");
+	}
+
+	void execute() {
+		std::string_view cmd = tokens[0];
+
+		if (cmd == "let") {
+			if (tokens.size() < 4 || tokens[2] != "=") throw std::runtime_error("Ожидалось: let имя = выражение");
+			std::string_view name = tokens[1];
+			if (!valid_name(name))
+				throw std::runtime_error("Недопустимое имя переменной: " + std::string(name));
+			Rectd value = evaluate(3);
+			vals.InsertOrAssign(name, value);
+		}
+		else if (cmd == "set") {
+			expect(4);
+			Rectd& r = find(tokens[1]);
+			double v = number(tokens[3]);
+			if (tokens[2] == "x") r.origin.x = v;
+			else if (tokens[2] == "y") r.origin.y = v;
+			else if ((tokens[2] == "width" || tokens[2] == "height") && v < 0)
+				throw std::runtime_error("Ширина и высота должны быть неотрицательными");
+			else if (tokens[2] == "width") r.width = v;
+			else if (tokens[2] == "height") r.height = v;
+			else throw std::runtime_error("Неизвестное поле: " + std::string(tokens[2]));
+		}
+		else if (cmd == "move") {
+			expect(4);
+			find(tokens[1]).Move(Point<double>(number(tokens[2]), number(tokens[3])));
+		}
+		else if (cmd == "delete") {
+			expect(2);
+			if (!vals.Erase(tokens[1]))
+				throw std::runtime_error("Такой переменной нет: " + std::string(tokens[1]));
+		}
+		else if (cmd == "area") {
+			expect(2);
+			write(find(tokens[1]).Area());
+			write("\n");
+		}
+		else if (cmd == "perimeter") {
+			expect(2);
+			write(find(tokens[1]).Perimeter());
+			write("\n");
+		}
+		else if (cmd == "show") {
+			if (tokens.size() == 1) {
+				for (decltype(auto) v : vals) write_var(v.first, v.second);
+			}
+			else {
+				expect(2);
+				write_var(tokens[1], find(tokens[1]));
+			}
+		}
+		else if (cmd == "count") {
+			expect(1);
+			write(vals.Size());
+			write("\n");
+		}
+		else if (cmd == "clear") {
+			expect(1);
+			vals.Clear();
+		}
+		else if (cmd == "load") {
+			expect(2);
+			fs::path fn = tokens[1];
+			if (is_binary_file(fn)) {
+				BinaryTable table(fn);
+				for (size_t i = 0; i < table.Size(); ++i) vals.InsertOrAssign(table.Name(i), table.Get(i));
+			}
+			else {
+				read_text_file(fn, [](std::string_view n, const Rectd& r) { vals.InsertOrAssign(n, r); });
+			}
+		}
+		else if (cmd == "save") {
+			expect(2);
+			fs::path fn = tokens[1];
+			if (fn.extension() == ".bin") {
+				write_binary_file(fn, vals);
+			}
+			else {
+				std::ofstream fout(fn, std::ios::trunc);
+				if (!fout.is_open()) throw std::runtime_error("Не удалось открыть файл " + fn.string());
+				write_text(fout, vals);
+			}
+		}
+		else if (cmd == "statistics") {
+			if (tokens.size() == 2 && tokens[1] == "reset") {
+				instrumentation::Reset();
+				return;
+			}
+			expect(1);
+			Flush();
+			instrumentation::PrintStatistics(out);
+		}
+		else if (cmd == "trace") {
+			expect(2);
+			fs::path fn = tokens[1];
+			std::ofstream fout(fn, std::ios::trunc);
+			if (!fout.is_open()) throw std::runtime_error("Не удалось открыть файл " + fn.string());
+			instrumentation::WriteChromeTrace(fout);
+		}
+		else {
+			throw std::runtime_error("Неизвестная команда: " + std::string(cmd));
+		}
+	}
+public:
+	explicit ScriptRunner(std::ostream& out)
+		: out{ out }
+	{
+		buffer.reserve(flush_at + 4096);
+	}
+
+	~ScriptRunner() {
+		Flush();
+	}
+
+	/// <summary>
+	/// Выполнение одной строки; ошибки выводятся в std::cerr с номером строки
+	/// </summary>
+	void Execute(std::string_view line, size_t line_number) {
+		split(line, tokens);
+		if (tokens.empty() || tokens[0].front() == '#') return;
+
+		try {
+			execute();
+		}
+		catch (const std::exception& e) {
+			++errors;
+			Flush();
+			std::cerr << "Строка " << line_number << ": " << e.what() << '\n';
+		}
+
+		if (buffer.size() >= flush_at) Flush();
+	}
+
+	/// <summary>
+	/// Запись накопленного вывода
+	/// </summary>
+	void Flush() {
+		out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+		out.flush();
+		buffer.clear();
+	}
+
+	/// <summary>
+	/// Количество строк, завершившихся ошибкой
+	/// </summary>
+	size_t Errors() const {
+		return errors;
+	}
+};
+
+/// <summary>
+/// Выполнение команд из потока; возвращает код завершения процесса
+/// </summary>
+int run_script(std::istream& in, std::ostream& out) {
+	ScriptRunner runner(out);
+
+	std::string line;
+	size_t line_number = 0;
+	while (std::getline(in, line)) {
+		runner.Execute(line, ++line_number);
+	}
+	runner.Flush();
+
+	return runner.Errors() == 0 ? 0 : 1;
+}
+
+/// <summary>
+/// Выполнение команд из файла
+/// </summary>
+int run_script_file(const fs::path& path) {
+	std::ifstream fin(path);
+	if (!fin.is_open()) {
+		std::cerr << "Не удалось открыть файл " << path << '\n';
+		return 1;
+	}
+	return run_script(fin, std::cout);
+}
@@ -0,0 +1,653 @@
+﻿#pragma once
+#include "interface.hpp"
+#include "DynamicTree.hpp"
+#include "Instrumentation.hpp"
+#include "storage.hpp"
+#include "variables.hpp"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#ifdef __linux__
+#include <cerrno>
+#include <csignal>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace server_protocol {
+	/// <summary>
+	/// Команды. Кадр запроса - RequestHeader и size байт аргументов; на каждый запрос приходит кадр ответа
+	/// с тем же id в порядке запросов. Имя кодируется как uint32 длина и байты, прямоугольник - как StoredRect,
+	/// числа - в порядке байт машины (клиент и сервер на одной машине)
+	/// </summary>
+	enum class Op : std::uint8_t {
+		Create = 1,    // имя, прямоугольник -> пусто; существующая переменная перезаписывается. Имя проверяется как в меню (valid_name)
+		Delete = 2,    // имя -> пусто
+		Get = 3,       // имя -> прямоугольник
+		Intersect = 4, // имя, имя -> прямоугольник
+		Union = 5,     // имя, имя -> прямоугольник
+		Area = 6,      // имя -> double
+		Window = 7,    // прямоугольник -> uint32 число и имена переменных, пересекающих окно, в любом порядке; O(log n + k) по индексу
+		Stats = 8      // пусто -> для каждой команды Create..Window: uint64 calls, total_ns, max_ns, p50_ns, p99_ns
+	};
+
+	// Индекс - код команды; 0 не используется
+	constexpr std::size_t op_count = 9;
+
+	constexpr std::array<std::string_view, op_count> op_names{
+		"", "create", "delete", "get", "intersect", "union", "area", "window", "stats" };
+
+	enum class Status : std::uint8_t {
+		Ok = 0,
+		NotFound = 1, // Нет переменной с таким именем
+		Invalid = 2,  // Неизвестная команда или неверные аргументы; ответ пустой
+		Failed = 3    // Ошибка сервера, например записи журнала; ответ пустой
+	};
+
+	struct RequestHeader {
+		std::uint32_t size;
+		std::uint32_t id; // Возвращается в ответе
+		Op op;
+		std::uint8_t reserved[3];
+	};
+
+	struct ResponseHeader {
+		std::uint32_t size;
+		std::uint32_t id;
+		Status status;
+		std::uint8_t reserved[3];
+	};
+
+	static_assert(sizeof(RequestHeader) == 12 && sizeof(ResponseHeader) == 12, "Frame headers must not contain padding");
+
+	// Кадр большего размера считается ошибкой протокола, и соединение закрывается
+	constexpr std::uint32_t max_frame = std::uint32_t{ 1 } << 20;
+
+	template<typename T>
+	void put_value(std::vector<char>& out, const T& value) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		const char* p = reinterpret_cast<const char*>(&value);
+		out.insert(out.end(), p, p + sizeof(T));
+	}
+
+	inline void put(std::vector<char>& out, std::string_view name) {
+		put_value(out, static_cast<std::uint32_t>(name.size()));
+		out.insert(out.end(), name.begin(), name.end());
+	}
+
+	inline void put(std::vector<char>& out, const Rect<double>& r) {
+		put_value(out, binary_format::StoredRect{ r.origin.x, r.origin.y, r.width, r.height });
+	}
+
+	/// <summary>
+	/// Начало кадра с заголовком header; размер проставляет end_frame
+	/// </summary>
+	template<typename Header>
+	std::size_t begin_frame(std::vector<char>& out, const Header& header) {
+		std::size_t start = out.size();
+		put_value(out, header);
+		return start;
+	}
+
+	inline void end_frame(std::vector<char>& out, std::size_t start) {
+		std::uint32_t size = static_cast<std::uint32_t>(out.size() - start - sizeof(RequestHeader));
+		std::memcpy(out.data() + start, &size, sizeof(size));
+	}
+
+	/// <summary>
+	/// Дописывание запроса в буфер; args - имена (std::string_view) и прямоугольники в порядке команды.
+	/// Несколько запросов в одном буфере отправляются одной записью
+	/// </summary>
+	template<typename... Args>
+	void Request(std::vector<char>& out, std::uint32_t id, Op op, const Args&... args) {
+		std::size_t start = begin_frame(out, RequestHeader{ 0, id, op, {} });
+		(put(out, args), ...);
+		end_frame(out, start);
+	}
+
+	/// <summary>
+	/// Выделение первого полного кадра из буфера; false, если кадр еще не получен целиком
+	/// </summary>
+	template<typename Header>
+	bool NextFrame(std::string_view& buffer, Header& header, std::string_view& payload) {
+		if (buffer.size() < sizeof(Header)) return false;
+		std::memcpy(&header, buffer.data(), sizeof(Header));
+		if (buffer.size() - sizeof(Header) < header.size) return false;
+		payload = buffer.substr(sizeof(Header), header.size);
+		buffer.remove_prefix(sizeof(Header) + header.size);
+		return true;
+	}
+
+	/// <summary>
+	/// Последовательное чтение аргументов кадра; при нехватке байт - исключение std::invalid_argument
+	/// </summary>
+	class Reader {
+		std::string_view data;
+
+		void need(std::size_t n) const {
+			if (data.size() < n) throw std::invalid_argument("Кадр короче, чем требует команда");
+		}
+
+	public:
+		explicit Reader(std::string_view data)
+			: data{ data }
+		{ }
+
+		template<typename T>
+		T Value() {
+			need(sizeof(T));
+			T value;
+			std::memcpy(&value, data.data(), sizeof(T));
+			data.remove_prefix(sizeof(T));
+			return value;
+		}
+
+		std::string_view Name() {
+			std::uint32_t length = Value<std::uint32_t>();
+			need(length);
+			std::string_view name = data.substr(0, length);
+			data.remove_prefix(length);
+			return name;
+		}
+
+		/// <summary>
+		/// Прямоугольник; отрицательные размеры - исключение конструктора Rect
+		/// </summary>
+		Rect<double> Rectangle() {
+			auto s = Value<binary_format::StoredRect>();
+			return Rect<double>(s.x, s.y, s.width, s.height);
+		}
+
+		bool End() const {
+			return data.empty();
+		}
+	};
+}
+
+#ifdef __linux__
+
+/// <summary>
+/// Сервер запросов к таблице переменных на локальном (Unix) сокете. Один поток обслуживает всех клиентов
+/// через epoll: таблица не требует блокировок, а клиенты не ждут друг друга дольше одной пачки запросов.
+/// Клиент может отправить сколько угодно запросов, не дожидаясь ответов: все полученные кадры выполняются
+/// подряд, а ответы на них уходят одной записью. Пока клиент не забирает ответы, его новые запросы
+/// не читаются, поэтому память на соединение ограничена.
+/// Для каждой команды собираются число вызовов и распределение времени выполнения (команда Stats)
+/// </summary>
+class QueryServer {
+	using Clock = std::chrono::steady_clock;
+
+	// Предел неотправленных ответов одного клиента, после которого его запросы не читаются
+	static constexpr std::size_t out_limit = std::size_t{ 4 } << 20;
+	static constexpr std::size_t read_chunk = std::size_t{ 64 } << 10;
+
+	struct Connection {
+		int fd;
+		std::vector<char> in;
+		std::size_t parsed = 0; // Байты in, уже выполненные
+		std::vector<char> out;
+		std::size_t sent = 0; // Байты out, уже отправленные
+		std::uint32_t events = EPOLLIN;
+		bool eof = false;
+
+		std::size_t pending() const {
+			return out.size() - sent;
+		}
+	};
+
+	VariableTable& table;
+	Journal* journal;
+	fs::path path;
+	int listener = -1;
+	int epoll = -1;
+	int wakeup = -1;
+	std::vector<std::unique_ptr<Connection>> connections; // По дескриптору сокета
+	std::size_t clients = 0;
+	std::array<instrumentation::ProbeStats, server_protocol::op_count> stats{};
+
+	// Индекс для Window: лист дерева на каждую переменную, обновляется в Create и Delete
+	static constexpr std::size_t no_leaf = SIZE_MAX;
+	DynamicTree<double> index;
+	std::vector<std::size_t> leaf_of; // По дескриптору переменной
+	std::vector<VariableTable::Handle> handle_of; // По листу дерева
+
+	/// <summary>
+	/// Добавление переменной в индекс или обновление ее прямоугольника
+	/// </summary>
+	void index_val(VariableTable::Handle h) {
+		if (h >= leaf_of.size()) leaf_of.resize(std::size_t{ h } + 1, no_leaf);
+		if (leaf_of[h] != no_leaf) {
+			index.Move(leaf_of[h], table[h]);
+			return;
+		}
+		std::size_t leaf = index.Insert(table[h]);
+		if (leaf >= handle_of.size()) handle_of.resize(leaf + 1);
+		handle_of[leaf] = h;
+		leaf_of[h] = leaf;
+	}
+
+	void unindex_val(VariableTable::Handle h) {
+		index.Remove(leaf_of[h]);
+		leaf_of[h] = no_leaf;
+	}
+
+	[[noreturn]] static void fail(const std::string& what) {
+		throw std::runtime_error(what + ": " + std::generic_category().message(errno));
+	}
+
+	void watch(int fd, std::uint32_t events, int op) {
+		epoll_event e{};
+		e.events = events;
+		e.data.fd = fd;
+		if (epoll_ctl(epoll, op, fd, &e) != 0) fail("Ошибка epoll_ctl");
+	}
+
+	void accept_clients() {
+		while (true) {
+			int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0) {
+				if (errno == EINTR || errno == ECONNABORTED) continue;
+				return; // EAGAIN, а при нехватке дескрипторов клиент подождет в очереди
+			}
+			if (static_cast<std::size_t>(fd) >= connections.size()) connections.resize(std::size_t(fd) + 1);
+			connections[fd] = std::make_unique<Connection>();
+			connections[fd]->fd = fd;
+			watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+			++clients;
+		}
+	}
+
+	void close_client(int fd) {
+		epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+		::close(fd);
+		connections[fd].reset();
+		--clients;
+	}
+
+	/// <summary>
+	/// Чтение всего, что пришло; false при ошибке сокета
+	/// </summary>
+	bool receive(Connection& c) {
+		std::size_t used = c.in.size();
+		while (used - c.parsed < out_limit) {
+			c.in.resize(used + read_chunk);
+			ssize_t r = recv(c.fd, c.in.data() + used, read_chunk, 0);
+			if (r > 0) {
+				used += static_cast<std::size_t>(r);
+				continue;
+			}
+			if (r == 0) c.eof = true;
+			else if (errno == EINTR) continue;
+			else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				c.in.resize(used);
+				return false;
+			}
+			break;
+		}
+		c.in.resize(used);
+		return true;
+	}
+
+	/// <summary>
+	/// Выполнение полученных кадров, пока ответы помещаются в предел; false при ошибке протокола
+	/// </summary>
+	bool execute(Connection& c) {
+		using namespace server_protocol;
+
+		std::string_view buffer(c.in.data() + c.parsed, c.in.size() - c.parsed);
+		RequestHeader header;
+		std::string_view payload;
+		while (c.pending() < out_limit) {
+			if (buffer.size() >= sizeof(header)) {
+				std::memcpy(&header, buffer.data(), sizeof(header));
+				if (header.size > max_frame) return false;
+			}
+			if (!NextFrame(buffer, header, payload)) break;
+			handle(header, payload, c.out);
+		}
+		c.parsed = c.in.size() - buffer.size();
+
+		// Остаток - начало следующего кадра
+		if (c.parsed == c.in.size()) {
+			c.in.clear();
+			c.parsed = 0;
+		}
+		else if (c.parsed >= read_chunk) {
+			c.in.erase(c.in.begin(), c.in.begin() + static_cast<std::ptrdiff_t>(c.parsed));
+			c.parsed = 0;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Выполнение полученных кадров одним пакетом журнала: записи всех изменений пакета сбрасываются в ОС
+	/// одним вызовом до отправки ответов на них. Если сброс не удался, соединение закрывается без ответов,
+	/// и клиент не получает подтверждений изменений, которые могли не сохраниться
+	/// </summary>
+	bool execute_batch(Connection& c) {
+		if (!journal) return execute(c);
+		journal->BeginBatch();
+		bool ok = execute(c);
+		try {
+			journal->Flush();
+		}
+		catch (const std::exception&) {
+			return false;
+		}
+		return ok;
+	}
+
+	/// <summary>
+	/// Отправка накопленных ответов; false при ошибке сокета
+	/// </summary>
+	bool flush(Connection& c) {
+		while (c.pending() > 0) {
+			ssize_t w = send(c.fd, c.out.data() + c.sent, c.pending(), MSG_NOSIGNAL);
+			if (w >= 0) {
+				c.sent += static_cast<std::size_t>(w);
+				continue;
+			}
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+			return false;
+		}
+		c.out.clear();
+		c.sent = 0;
+		return true;
+	}
+
+	/// <summary>
+	/// Обработка событий соединения; false - соединение нужно закрыть
+	/// </summary>
+	bool serve(Connection& c, std::uint32_t events) {
+		if (events & EPOLLERR) return false;
+		if ((events & (EPOLLIN | EPOLLHUP)) && !c.eof && !receive(c)) return false;
+
+		// Выполнение может остановиться на пределе ответов; после отправки продолжаем, пока есть что выполнять
+		while (true) {
+			std::size_t parsed = c.parsed, size = c.in.size();
+			if (!execute_batch(c) || !flush(c)) return false;
+			bool progress = c.parsed != parsed || c.in.size() != size;
+			if (!progress || c.pending() > 0) break;
+		}
+
+		// Все полные кадры уже выполнены: после конца потока остаток может быть только обрезанным кадром
+		if (c.eof && c.pending() == 0) return false;
+
+		std::uint32_t wanted = (c.eof || c.pending() >= out_limit ? 0u : std::uint32_t{ EPOLLIN }) |
+			(c.pending() > 0 ? std::uint32_t{ EPOLLOUT } : 0u);
+		if (wanted != c.events) {
+			watch(c.fd, wanted, EPOLL_CTL_MOD);
+			c.events = wanted;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Выполнение одной команды: ответ дописывается в out
+	/// </summary>
+	void handle(const server_protocol::RequestHeader& request, std::string_view payload, std::vector<char>& out) {
+		using namespace server_protocol;
+
+		Clock::time_point start = Clock::now();
+		std::size_t frame = begin_frame(out, ResponseHeader{ 0, request.id, Status::Ok, {} });
+		Status status;
+		try {
+			Reader reader(payload);
+			status = command(request.op, reader, out);
+			if (status == Status::Ok && !reader.End()) status = Status::Invalid;
+		}
+		catch (const std::invalid_argument&) {
+			status = Status::Invalid;
+		}
+		catch (const std::exception&) {
+			status = Status::Failed;
+		}
+
+		if (status != Status::Ok) {
+			out.resize(frame + sizeof(ResponseHeader));
+			out[frame + offsetof(ResponseHeader, status)] = static_cast<char>(status);
+		}
+		end_frame(out, frame);
+
+		std::size_t op = static_cast<std::size_t>(request.op);
+		if (op < op_count) {
+			stats[op].Add(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+		}
+	}
+
+	server_protocol::Status command(server_protocol::Op op, server_protocol::Reader& reader, std::vector<char>& out) {
+		using namespace server_protocol;
+
+		switch (op) {
+		case Op::Create: {
+			std::string_view name = reader.Name();
+			Rect<double> r = reader.Rectangle();
+			if (!valid_name(name)) return Status::Invalid;
+			index_val(table.InsertOrAssign(name, r));
+			if (journal) journal->Put(name, r);
+			return Status::Ok;
+		}
+		case Op::Delete: {
+			std::string_view name = reader.Name();
+			auto h = table.Find(name);
+			if (!h) return Status::NotFound;
+			unindex_val(*h);
+			table.Erase(name);
+			if (journal) journal->Erase(name);
+			return Status::Ok;
+		}
+		case Op::Get:
+		case Op::Area: {
+			auto h = table.Find(reader.Name());
+			if (!h) return Status::NotFound;
+			if (op == Op::Get) put(out, table[*h]);
+			else put_value(out, table[*h].Area());
+			return Status::Ok;
+		}
+		case Op::Intersect:
+		case Op::Union: {
+			auto a = table.Find(reader.Name());
+			auto b = table.Find(reader.Name());
+			if (!a || !b) return Status::NotFound;
+			put(out, op == Op::Union ? table[*a].Union(table[*b]) : table[*a].Intersect(table[*b]));
+			return Status::Ok;
+		}
+		case Op::Window: {
+			Rect<double> window = reader.Rectangle();
+			std::size_t count_at = out.size();
+			std::uint32_t count = 0;
+			put_value(out, count);
+			index.Search(window, [&](std::size_t leaf) {
+				put(out, table.Name(handle_of[leaf]));
+				++count;
+			});
+			std::memcpy(out.data() + count_at, &count, sizeof(count));
+			return Status::Ok;
+		}
+		case Op::Stats:
+			for (std::size_t i = 1; i < static_cast<std::size_t>(Op::Stats); ++i) {
+				const instrumentation::ProbeStats& s = stats[i];
+				for (std::uint64_t v : { s.calls, s.total_ns, s.max_ns, s.PercentileNs(0.5), s.PercentileNs(0.99) }) put_value(out, v);
+			}
+			return Status::Ok;
+		}
+		return Status::Invalid;
+	}
+
+public:
+	/// <summary>
+	/// journal - если задан, в него записываются создания и удаления. Пока сервер существует, таблица
+	/// должна меняться только через него: иначе индекс для Window устареет
+	/// </summary>
+	explicit QueryServer(VariableTable& table, Journal* journal = nullptr)
+		: table{ table }, journal{ journal }
+	{
+		for (auto it = table.begin(); it != table.end(); ++it) index_val(it.handle());
+	}
+
+	QueryServer(const QueryServer&) = delete;
+	QueryServer& operator=(const QueryServer&) = delete;
+
+	~QueryServer() {
+		for (decltype(auto) c : connections) {
+			if (c) ::close(c->fd);
+		}
+		if (listener >= 0) {
+			::close(listener);
+			std::error_code ec;
+			fs::remove(path, ec);
+		}
+		if (epoll >= 0) ::close(epoll);
+		if (wakeup >= 0) ::close(wakeup);
+	}
+
+	/// <summary>
+	/// Создание сокета; после возврата клиенты уже могут подключаться. Оставшийся от прошлого запуска
+	/// файл сокета заменяется
+	/// </summary>
+	void Listen(const fs::path& socket_path) {
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		std::string p = socket_path.string();
+		if (p.empty() || p.size() >= sizeof(address.sun_path))
+			throw std::runtime_error("Недопустимый путь сокета: " + p);
+		std::memcpy(address.sun_path, p.data(), p.size());
+
+		std::error_code ec;
+		if (fs::is_socket(socket_path, ec)) fs::remove(socket_path, ec);
+
+		listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (listener < 0) fail("Не удалось создать сокет");
+		if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+			fail("Не удалось открыть сокет " + p);
+		path = socket_path;
+		if (listen(listener, SOMAXCONN) != 0) fail("Ошибка listen");
+
+		epoll = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll < 0) fail("Ошибка epoll_create1");
+		wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (wakeup < 0) fail("Ошибка eventfd");
+		watch(listener, EPOLLIN, EPOLL_CTL_ADD);
+		watch(wakeup, EPOLLIN, EPOLL_CTL_ADD);
+	}
+
+	/// <summary>
+	/// Цикл обслуживания до вызова Stop
+	/// </summary>
+	void Run() {
+		std::array<epoll_event, 64> events;
+		while (true) {
+			int n = epoll_wait(epoll, events.data(), static_cast<int>(events.size()), -1);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				fail("Ошибка epoll_wait");
+			}
+			for (int i = 0; i < n; ++i) {
+				int fd = events[i].data.fd;
+				if (fd == wakeup) return;
+				if (fd == listener) {
+					accept_clients();
+					continue;
+				}
+				Connection* c = connections[fd].get();
+				if (c && !serve(*c, events[i].events)) close_client(fd);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Завершение Run; можно вызывать из другого потока и из обработчика сигнала
+	/// </summary>
+	void Stop() {
+		std::uint64_t one = 1;
+		[[maybe_unused]] ssize_t r = ::write(wakeup, &one, sizeof(one));
+	}
+
+	/// <summary>
+	/// Число подключенных клиентов
+	/// </summary>
+	std::size_t Clients() const {
+		return clients;
+	}
+
+	/// <summary>
+	/// Время выполнения команд; индекс - код команды
+	/// </summary>
+	const std::array<instrumentation::ProbeStats, server_protocol::op_count>& Statistics() const {
+		return stats;
+	}
+
+	/// <summary>
+	/// Таблица вызовов и задержек по командам
+	/// </summary>
+	void PrintStatistics(std::ostream& out) const {
+		out << std::left << std::setw(12) << "command" << std::right << std::setw(14) << "calls" << std::setw(12) << "mean ns"
+			<< std::setw(12) << "p50 ns" << std::setw(12) << "p99 ns" << std::setw(14) << "max ns" << '\n';
+		for (std::size_t op = 1; op < server_protocol::op_count; ++op) {
+			const instrumentation::ProbeStats& s = stats[op];
+			if (s.calls == 0) continue;
+			out << std::left << std::setw(12) << server_protocol::op_names[op] << std::right << std::setw(14) << s.calls
+				<< std::setw(12) << std::fixed << std::setprecision(1) << s.MeanNs()
+				<< std::setw(12) << s.PercentileNs(0.5) << std::setw(12) << s.PercentileNs(0.99) << std::setw(14) << s.max_ns << '\n';
+		}
+	}
+};
+
+// Сервер, который останавливают SIGINT и SIGTERM
+QueryServer* running_server = nullptr;
+
+/// <summary>
+/// Режим сервера: таблица восстанавливается из журнала, изменения записываются в него же.
+/// Работает до SIGINT или SIGTERM, затем выводит статистику команд
+/// </summary>
+int run_server(const fs::path& socket_path) {
+	try {
+		journal.Open(vals);
+		QueryServer server(vals, &journal);
+		server.Listen(socket_path);
+
+		running_server = &server;
+		auto stop = [](int) { running_server->Stop(); };
+		std::signal(SIGINT, stop);
+		std::signal(SIGTERM, stop);
+
+		std::cout << "Переменных: " << vals.Size() << ", сервер слушает " << socket_path.string() << std::endl;
+		server.Run();
+
+		std::signal(SIGINT, SIG_DFL);
+		std::signal(SIGTERM, SIG_DFL);
+		running_server = nullptr;
+		server.PrintStatistics(std::cout);
+		journal.Close();
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Ошибка: " << e.what() << '\n';
+		return 1;
+	}
+	return 0;
+}
+
+#else
+
+int run_server(const fs::path&) {
+	std::cerr << "Режим сервера доступен только в Linux\n";
+	return 1;
+}
+
+#endif
@@ -0,0 +1,489 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include "Parallel.hpp"
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Ширина колонки имени в текстовом формате
+constexpr std::streamsize text_name_align = 60;
+
+/// <summary>
+/// Файл, отображенный в память только для чтения
+/// </summary>
+class MappedFile {
+	const std::byte* data = nullptr;
+	std::size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+
+	void close() {
+#ifdef _WIN32
+		if (data) UnmapViewOfFile(data);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+		mapping = nullptr;
+#else
+		if (data) munmap(const_cast<std::byte*>(data), size);
+#endif
+		data = nullptr;
+		size = 0;
+	}
+public:
+	MappedFile() = default;
+
+	/// <summary>
+	/// Отображает файл целиком; страницы читаются с диска только при обращении к ним
+	/// </summary>
+	explicit MappedFile(const std::filesystem::path& path) {
+		std::uintmax_t length = std::filesystem::file_size(path);
+		if (length == 0) return;
+		size = static_cast<std::size_t>(length);
+
+#ifdef _WIN32
+		file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			close();
+			throw std::runtime_error("Не удалось открыть файл " + path.string());
+		}
+		mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping) data = static_cast<const std::byte*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			close();
+			throw std::runtime_error("Не удалось открыть файл " + path.string());
+		}
+		void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (p != MAP_FAILED) data = static_cast<const std::byte*>(p);
+#endif
+		if (!data) {
+			close();
+			throw std::runtime_error("Не удалось отобразить файл в память " + path.string());
+		}
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other) noexcept {
+		*this = std::move(other);
+	}
+
+	MappedFile& operator=(MappedFile&& other) noexcept {
+		if (this != &other) {
+			close();
+			std::swap(data, other.data);
+			std::swap(size, other.size);
+#ifdef _WIN32
+			std::swap(file, other.file);
+			std::swap(mapping, other.mapping);
+#endif
+		}
+		return *this;
+	}
+
+	~MappedFile() {
+		close();
+	}
+
+	const std::byte* Data() const {
+		return data;
+	}
+
+	std::size_t Size() const {
+		return size;
+	}
+};
+
+namespace binary_format {
+	// Сигнатура файла и версия формата
+	constexpr char magic[8] = { 'R', 'E', 'C', 'T', 'B', 'I', 'N', '\0' };
+	constexpr std::uint32_t version = 1;
+
+	/// <summary>
+	/// Заголовок: смещения отсчитываются от начала файла, все числа в порядке байт little-endian
+	/// </summary>
+	struct Header {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t reserved;
+		std::uint64_t count;
+		std::uint64_t names_offset;   // NameEntry[count], отсортированы по имени
+		std::uint64_t strings_offset; // Байты имен без завершающих нулей
+		std::uint64_t strings_size;
+		std::uint64_t rects_offset;   // StoredRect[count] в том же порядке, что и имена
+	};
+
+	struct NameEntry {
+		std::uint64_t offset; // Относительно strings_offset
+		std::uint32_t length;
+		std::uint32_t reserved;
+	};
+
+	struct StoredRect {
+		double x, y, width, height;
+	};
+
+	static_assert(sizeof(Header) == 56 && sizeof(NameEntry) == 16 && sizeof(StoredRect) == 32,
+		"Binary layout must not contain padding");
+	// Файл читается через отображение в память без преобразования, поэтому порядок байт машины должен совпадать с форматом
+	static_assert(std::endian::native == std::endian::little, "Binary format requires a little-endian host");
+
+	constexpr std::uint64_t align8(std::uint64_t v) {
+		return (v + 7) & ~std::uint64_t{ 7 };
+	}
+}
+
+/// <summary>
+/// Проверка, записан ли файл в бинарном формате
+/// </summary>
+inline bool is_binary_file(const std::filesystem::path& path) {
+	std::ifstream fin(path, std::ios::binary);
+	char head[sizeof(binary_format::magic)] = {};
+	fin.read(head, sizeof(head));
+	return fin.gcount() == sizeof(head) && std::memcmp(head, binary_format::magic, sizeof(head)) == 0;
+}
+
+/// <summary>
+/// Бинарная таблица переменных, отображенная в память.
+/// Открытие не разбирает содержимое: имена и прямоугольники читаются прямо из файла при обращении
+/// </summary>
+class BinaryTable {
+	MappedFile file;
+	const binary_format::Header* header = nullptr;
+	const binary_format::NameEntry* names = nullptr;
+	const char* strings = nullptr;
+	const binary_format::StoredRect* rects = nullptr;
+
+	static void check(bool condition) {
+		if (!condition) throw std::runtime_error("Файл поврежден или имеет неизвестный формат");
+	}
+public:
+	BinaryTable() = default;
+
+	/// <summary>
+	/// Открывает файл и проверяет заголовок; время не зависит от числа переменных
+	/// </summary>
+	explicit BinaryTable(const std::filesystem::path& path)
+		: file(path)
+	{
+		using namespace binary_format;
+
+		const std::uint64_t size = file.Size();
+		check(size >= sizeof(Header));
+		header = reinterpret_cast<const Header*>(file.Data());
+		check(std::memcmp(header->magic, magic, sizeof(magic)) == 0);
+		if (header->version != version)
+			throw std::runtime_error("Неподдерживаемая версия бинарного формата: " + std::to_string(header->version));
+
+		const std::uint64_t count = header->count;
+		check(count <= size / sizeof(StoredRect));
+		check(header->names_offset % 8 == 0 && header->names_offset <= size && count * sizeof(NameEntry) <= size - header->names_offset);
+		check(header->rects_offset % 8 == 0 && header->rects_offset <= size && count * sizeof(StoredRect) <= size - header->rects_offset);
+		check(header->strings_offset <= size && header->strings_size <= size - header->strings_offset);
+
+		names = reinterpret_cast<const NameEntry*>(file.Data() + header->names_offset);
+		strings = reinterpret_cast<const char*>(file.Data() + header->strings_offset);
+		rects = reinterpret_cast<const StoredRect*>(file.Data() + header->rects_offset);
+	}
+
+	/// <summary>
+	/// Количество переменных
+	/// </summary>
+	std::size_t Size() const {
+		return header ? static_cast<std::size_t>(header->count) : 0;
+	}
+
+	/// <summary>
+	/// Имя переменной с индексом i
+	/// </summary>
+	std::string_view Name(std::size_t i) const {
+		const binary_format::NameEntry& e = names[i];
+		check(e.offset <= header->strings_size && e.length <= header->strings_size - e.offset);
+		return { strings + e.offset, e.length };
+	}
+
+	/// <summary>
+	/// Значение переменной с индексом i
+	/// </summary>
+	Rect<double> Get(std::size_t i) const {
+		const binary_format::StoredRect& r = rects[i];
+		return Rect<double>(r.x, r.y, r.width, r.height);
+	}
+
+	/// <summary>
+	/// Бинарный поиск переменной по имени
+	/// </summary>
+	std::optional<std::size_t> Find(std::string_view name) const {
+		std::size_t lo = 0, hi = Size();
+		while (lo < hi) {
+			std::size_t mid = lo + (hi - lo) / 2;
+			if (Name(mid) < name) lo = mid + 1;
+			else hi = mid;
+		}
+		if (lo < Size() && Name(lo) == name) return lo;
+		return std::nullopt;
+	}
+};
+
+/// <summary>
+/// Запись переменных в бинарный формат одной последовательной записью.
+/// Range - любой диапазон пар (имя, Rect&lt;double&gt;), например std::unordered_map
+/// </summary>
+template<typename Range>
+void write_binary_file(const std::filesystem::path& path, const Range& table) {
+	using namespace binary_format;
+
+	std::vector<std::pair<std::string_view, const Rect<double>*>> sorted;
+	for (decltype(auto) v : table) sorted.emplace_back(v.first, &v.second);
+	std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+	std::uint64_t strings_size = 0;
+	for (decltype(auto) v : sorted) strings_size += v.first.size();
+
+	Header header{};
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.count = sorted.size();
+	header.names_offset = sizeof(Header);
+	header.rects_offset = header.names_offset + sorted.size() * sizeof(NameEntry);
+	header.strings_offset = header.rects_offset + sorted.size() * sizeof(StoredRect);
+	header.strings_size = strings_size;
+
+	std::vector<char> buffer(static_cast<std::size_t>(align8(header.strings_offset + strings_size)));
+	char* out = buffer.data();
+	std::memcpy(out, &header, sizeof(header));
+
+	std::uint64_t offset = 0;
+	for (std::size_t i = 0; i < sorted.size(); ++i) {
+		const auto& [name, r] = sorted[i];
+		NameEntry e{ offset, static_cast<std::uint32_t>(name.size()), 0 };
+		StoredRect s{ r->origin.x, r->origin.y, r->width, r->height };
+		std::memcpy(out + header.names_offset + i * sizeof(NameEntry), &e, sizeof(e));
+		std::memcpy(out + header.rects_offset + i * sizeof(StoredRect), &s, sizeof(s));
+		std::memcpy(out + header.strings_offset + offset, name.data(), name.size());
+		offset += name.size();
+	}
+
+	std::ofstream fout(path, std::ios::binary | std::ios::trunc);
+	if (!fout.is_open()) throw std::runtime_error("Не удалось открыть файл " + path.string());
+	fout.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+	if (!fout) throw std::runtime_error("Не удалось записать файл " + path.string());
+}
+
+namespace text_format {
+	/// <summary>
+	/// Запись текстового файла, ссылающаяся на имя внутри отображенного файла
+	/// </summary>
+	struct Record {
+		std::string_view name;
+		Rect<double> rect;
+	};
+
+	/// <summary>
+	/// Результат разбора одного фрагмента файла
+	/// </summary>
+	struct Chunk {
+		std::vector<Record> records;
+		std::size_t lines = 0;
+		std::optional<std::size_t> error_line; // Номер строки внутри фрагмента
+	};
+
+	inline bool is_space(char c) {
+		return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+	}
+
+	inline const char* skip_spaces(const char* p, const char* end) {
+		while (p != end && is_space(*p)) ++p;
+		return p;
+	}
+
+	inline bool parse_double(const char*& p, const char* end, double& value) {
+		p = skip_spaces(p, end);
+		// from_chars не принимает явный знак '+', в отличие от operator>>
+		if (p != end && *p == '+') ++p;
+		auto [next, ec] = std::from_chars(p, end, value);
+		if (ec != std::errc() || (next != end && !is_space(*next))) return false;
+		p = next;
+		return true;
+	}
+
+	/// <summary>
+	/// Разбор строк "имя x y ширина высота" из [begin, end); пустые строки пропускаются
+	/// </summary>
+	inline void parse_chunk(const char* begin, const char* end, Chunk& chunk) {
+		const char* line = begin;
+		while (line != end) {
+			const char* eol = static_cast<const char*>(std::memchr(line, '\n', end - line));
+			if (!eol) eol = end;
+			++chunk.lines;
+
+			const char* p = skip_spaces(line, eol);
+			if (p != eol) {
+				const char* name_end = p;
+				while (name_end != eol && !is_space(*name_end)) ++name_end;
+
+				double x = 0, y = 0, w = 0, h = 0;
+				const char* q = name_end;
+				if (!parse_double(q, eol, x) || !parse_double(q, eol, y) || !parse_double(q, eol, w) ||
+					!parse_double(q, eol, h) || skip_spaces(q, eol) != eol) {
+					chunk.error_line = chunk.lines;
+					return;
+				}
+				chunk.records.push_back({ std::string_view(p, name_end - p), Rect<double>(x, y, w, h) });
+			}
+			line = eol == end ? end : eol + 1;
+		}
+	}
+
+	inline char* append(char* out, double v) {
+		return std::to_chars(out, out + 32, v).ptr;
+	}
+}
+
+/// <summary>
+/// Чтение текстового формата "имя x y ширина высота"; f(имя, прямоугольник) вызывается для каждой записи по порядку.
+/// Файл отображается в память, делится на фрагменты по границам строк и разбирается через std::from_chars
+/// на threads потоках (0 - все ядра)
+/// </summary>
+template<typename F>
+void read_text_file(const std::filesystem::path& path, F&& f, std::size_t threads = 0) {
+	MappedFile file(path);
+	const char* data = reinterpret_cast<const char*>(file.Data());
+	const std::size_t size = file.Size();
+
+	// Фрагменты не меньше 1 МБ, чтобы не тратить время на потоки для маленьких файлов
+	constexpr std::size_t min_chunk = std::size_t{ 1 } << 20;
+	std::size_t workers = threads == 0 ? HardwareThreads() : threads;
+	std::size_t chunks = std::max<std::size_t>(1, std::min(workers * 4, size / min_chunk));
+
+	std::vector<const char*> bounds{ data };
+	for (std::size_t c = 1; c < chunks; ++c) {
+		const char* target = data + size * c / chunks;
+		if (target <= bounds.back()) continue;
+		const char* eol = static_cast<const char*>(std::memchr(target, '\n', data + size - target));
+		if (!eol) break;
+		bounds.push_back(eol + 1);
+	}
+	bounds.push_back(data + size);
+
+	std::vector<text_format::Chunk> parsed(bounds.size() - 1);
+	ParallelFor(parsed.size(), workers, [&](std::size_t c, std::size_t) {
+		text_format::parse_chunk(bounds[c], bounds[c + 1], parsed[c]);
+	});
+
+	std::size_t line = 0;
+	for (decltype(auto) chunk : parsed) {
+		if (chunk.error_line)
+			throw std::runtime_error("Ошибка в строке " + std::to_string(line + *chunk.error_line) + " файла " + path.string());
+		line += chunk.lines;
+	}
+	for (decltype(auto) chunk : parsed) {
+		for (decltype(auto) r : chunk.records) f(r.name, r.rect);
+	}
+}
+
+/// <summary>
+/// Запись переменных в текстовом формате через буфер и std::to_chars.
+/// Числа записываются в кратчайшем виде, который читается обратно без потери точности
+/// </summary>
+template<typename Range>
+void write_text(std::ostream& out, const Range& table) {
+	constexpr std::size_t flush_at = std::size_t{ 1 } << 20;
+	// Каждое число не длиннее 24 символов; 4 числа и разделители с запасом помещаются в 128 байт
+	constexpr std::size_t max_numbers = 128;
+
+	std::vector<char> buffer;
+	buffer.reserve(flush_at + 4096);
+
+	for (decltype(auto) v : table) {
+		std::string_view name = v.first;
+		decltype(auto) r = v.second;
+
+		std::size_t padded = std::max<std::size_t>(name.size() + 1, text_name_align);
+		std::size_t pos = buffer.size();
+		buffer.resize(pos + padded + max_numbers);
+
+		char* p = buffer.data() + pos;
+		std::memcpy(p, name.data(), name.size());
+		std::memset(p + name.size(), ' ', padded - name.size());
+		p += padded;
+
+		p = text_format::append(p, r.origin.x);
+		*p++ = ' ';
+		p = text_format::append(p, r.origin.y);
+		*p++ = ' ';
+		p = text_format::append(p, r.width);
+		*p++ = ' ';
+		p = text_format::append(p, r.height);
+		*p++ = '\n';
+		buffer.resize(p - buffer.data());
+
+		if (buffer.size() >= flush_at) {
+			out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+			buffer.clear();
+		}
+	}
+	out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+}
+
+/// <summary>
+/// Конвертация текстового файла в бинарный
+/// </summary>
+inline void convert_text_to_binary(const std::filesystem::path& from, const std::filesystem::path& to) {
+	std::vector<std::pair<std::string, Rect<double>>> table;
+	read_text_file(from, [&](std::string_view name, const Rect<double>& r) { table.emplace_back(name, r); });
+
+	// Как и при загрузке, при повторе имени остается последнее значение
+	std::stable_sort(table.begin(), table.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+	std::vector<std::pair<std::string, Rect<double>>> unique;
+	for (decltype(auto) v : table) {
+		if (!unique.empty() && unique.back().first == v.first) unique.back().second = v.second;
+		else unique.push_back(v);
+	}
+	write_binary_file(to, unique);
+}
+
+/// <summary>
+/// Конвертация бинарного файла в текстовый
+/// </summary>
+inline void convert_binary_to_text(const std::filesystem::path& from, const std::filesystem::path& to) {
+	BinaryTable table(from);
+
+	std::ofstream fout(to, std::ios::trunc);
+	if (!fout.is_open()) throw std::runtime_error("Не удалось открыть файл " + to.string());
+
+	std::vector<std::pair<std::string_view, Rect<double>>> rows;
+	rows.reserve(table.Size());
+	for (std::size_t i = 0; i < table.Size(); ++i) rows.emplace_back(table.Name(i), table.Get(i));
+	write_text(fout, rows);
+}
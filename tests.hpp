@@ -2,7 +2,38 @@
 #include <iostream>
 #include "Rectangle.hpp"
 #include "Point.hpp"
+#include "RectBatch.hpp"
+#include "RTree.hpp"
+#include "SweepAndPrune.hpp"
+#include "Coverage.hpp"
+#include "Region.hpp"
+#include "storage.hpp"
+#include "script.hpp"
+#include "variables.hpp"
+#include "Instrumentation.hpp"
+#include "Packing.hpp"
+#include "Damage.hpp"
+#include "Stabbing.hpp"
+#include "Reduce.hpp"
+#include "Quantized.hpp"
+#include "DynamicTree.hpp"
+#include "SpatialGrid.hpp"
+#include "SpatialJoin.hpp"
+#include "SpaceFillingCurve.hpp"
+#include "journal.hpp"
+#include "versioned.hpp"
+#include "expressions.hpp"
+#include "server.hpp"
+#include <map>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <cmath>
 #include <cassert>  // For assert
+#include <random>
+#include <thread>
+#include <vector>
 
 void testDefaultConstructor() {
     Rect<int> r;
@@ -207,6 +238,1451 @@ void testDoubleMove() {
     std::cout << "testDoubleMove passed." << std::endl;
 }
 
+template<typename T>
+std::vector<Rect<T>> randomRects(size_t n, unsigned seed) {
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> pos(-50, 50), size(0, 30);
+    std::vector<Rect<T>> rects;
+    for (size_t i = 0; i < n; ++i) {
+        // Fractional parts exercise the floating-point paths
+        T frac = std::is_floating_point_v<T> ? T(i % 4) / T(4) : T(0);
+        rects.emplace_back(T(pos(gen)) + frac, T(pos(gen)), T(size(gen)), T(size(gen)) + frac);
+    }
+    return rects;
+}
+
+template<typename T>
+void testRectBatchMatchesScalar(const char* name) {
+    // 37 is not a multiple of any vector width, so the scalar tail is covered too
+    auto a = randomRects<T>(37, 1);
+    auto b = randomRects<T>(37, 2);
+    RectBatch<T> ba(a), bb(b);
+    Rect<T> window(-10, -10, 25, 25);
+    Point<T> p(3, 4);
+
+    auto inter = ba.Intersect(bb).ToVector();
+    auto uni = ba.Union(bb).ToVector();
+    auto interWindow = ba.Intersect(window).ToVector();
+    auto uniWindow = ba.Union(window).ToVector();
+    auto area = ba.Area();
+    auto perimeter = ba.Perimeter();
+    auto containsPoint = ba.Contains(p);
+    auto containsRect = ba.Contains(bb);
+    auto containsWindow = ba.Contains(Rect<T>(0, 0, 1, 1));
+
+    assert(ba.ToVector() == a);
+    for (size_t i = 0; i < a.size(); ++i) {
+        assert(inter[i] == a[i].Intersect(b[i]));
+        assert(uni[i] == a[i].Union(b[i]));
+        assert(interWindow[i] == a[i].Intersect(window));
+        assert(uniWindow[i] == a[i].Union(window));
+        assert(area[i] == a[i].Area());
+        assert(perimeter[i] == a[i].Perimeter());
+        assert(bool(containsPoint[i]) == a[i].Contains(p));
+        assert(bool(containsRect[i]) == a[i].Contains(b[i]));
+        assert(bool(containsWindow[i]) == a[i].Contains(Rect<T>(0, 0, 1, 1)));
+    }
+    std::cout << "testRectBatchMatchesScalar<" << name << "> passed." << std::endl;
+}
+
+void testRectBatchSizeMismatch() {
+    RectBatch<int> a(3), b(4);
+    try {
+        a.Intersect(b);
+        std::cerr << "testRectBatchSizeMismatch failed: exception not thrown." << std::endl;
+    }
+    catch (const std::invalid_argument& e) {
+        std::cout << "testRectBatchSizeMismatch passed: " << e.what() << std::endl;
+    }
+}
+
+void testOverlaps() {
+    Rect<int> r1(0, 0, 5, 5);
+    assert(r1.Overlaps(Rect<int>(3, 3, 5, 5)));
+    assert(r1.Overlaps(Rect<int>(5, 0, 2, 2))); // Touching edge
+    assert(!r1.Overlaps(Rect<int>(6, 6, 2, 2)));
+    std::cout << "testOverlaps passed." << std::endl;
+}
+
+template<typename T>
+void testRTreeMatchesLinearScan(const char* name) {
+    auto rects = randomRects<T>(1000, 3);
+    RTree<T> tree(rects, 8);
+    assert(tree.Size() == rects.size());
+
+    Rect<T> window(-5, -5, 20, 15);
+    Point<T> p(1, 2);
+    std::vector<size_t> overlaps, points, contained, containing;
+    for (size_t i = 0; i < rects.size(); ++i) {
+        if (rects[i].Overlaps(window)) overlaps.push_back(i);
+        if (rects[i].Contains(p)) points.push_back(i);
+        if (window.Contains(rects[i])) contained.push_back(i);
+        if (rects[i].Contains(Rect<T>(0, 0, 2, 2))) containing.push_back(i);
+    }
+
+    auto sorted = [](std::vector<size_t> v) { std::sort(v.begin(), v.end()); return v; };
+    assert(sorted(tree.Search(window)) == overlaps);
+    assert(sorted(tree.SearchPoint(p)) == points);
+    assert(sorted(tree.SearchContained(window)) == contained);
+    assert(sorted(tree.SearchContaining(Rect<T>(0, 0, 2, 2))) == containing);
+    std::cout << "testRTreeMatchesLinearScan<" << name << "> passed." << std::endl;
+}
+
+void testDistances() {
+    Rect<int> r(0, 0, 10, 5);
+    assert(r.Distance(Point<int>(3, 3)) == 0 && r.ChebyshevDistance(Point<int>(10, 5)) == 0);
+    assert(r.Distance(Point<int>(13, 9)) == 5 && r.DistanceSquared(Point<int>(13, 9)) == 25);
+    assert(r.ChebyshevDistance(Point<int>(13, 9)) == 4);
+    assert(r.Distance(Point<int>(-2, 2)) == 2 && r.ChebyshevDistance(Point<int>(5, -7)) == 7);
+
+    assert(r.Distance(Rect<int>(5, 2, 20, 20)) == 0);
+    assert(r.Distance(Rect<int>(13, 9, 1, 1)) == 5 && Rect<int>(13, 9, 1, 1).Distance(r) == 5);
+    assert(r.ChebyshevDistance(Rect<int>(-8, -3, 5, 1)) == 3);
+    assert(r.ChebyshevDistance(Rect<int>(10, 0, 1, 1)) == 0); // Touching
+
+    Rect<double> d(-1.5, -1.5, 1, 1);
+    assert(std::abs(d.Distance(Point<double>(0.5, 0.5)) - std::sqrt(2.0)) < 1e-12);
+    assert(d.ChebyshevDistance(Rect<double>(1, -1, 1, 1)) == 1.5);
+
+    // Unsigned coordinates: differences are never taken below zero
+    Rect<unsigned> u(2, 2, 3, 3);
+    assert(u.ChebyshevDistance(Point<unsigned>(0, 3)) == 2 && u.ChebyshevDistance(Point<unsigned>(9, 1)) == 4);
+    assert(u.ChebyshevDistance(Rect<unsigned>(0, 0, 1, 1)) == 1 && Rect<unsigned>(0, 0, 1, 1).ChebyshevDistance(u) == 1);
+    assert(u.ChebyshevDistance(Rect<unsigned>(8, 0, 1, 10)) == 3);
+    assert(u.DistanceSquared(Rect<unsigned>(0, 0, 1, 1)) == 2 && u.DistanceSquared(Point<unsigned>(0, 0)) == 8);
+    std::cout << "testDistances passed." << std::endl;
+}
+
+template<typename T>
+void testRTreeNearestMatchesBruteForce(const char* name) {
+    auto rects = randomRects<T>(2000, 7);
+    RTree<T> tree(rects, 8);
+    typename RTree<T>::NearestScratch scratch;
+    std::vector<typename RTree<T>::Neighbor> found;
+
+    std::mt19937 gen(8);
+    std::uniform_int_distribution<int> coord(-60, 60);
+    for (int q = 0; q < 200; ++q) {
+        Point<T> p(T(coord(gen)), T(coord(gen)));
+        size_t k = size_t(q % 20);
+
+        std::vector<double> expected;
+        for (decltype(auto) r : rects) expected.push_back(r.Distance(p));
+        std::sort(expected.begin(), expected.end());
+        expected.resize(k);
+
+        tree.Nearest(p, k, scratch, found);
+        assert(found.size() == k);
+        for (size_t i = 0; i < k; ++i) {
+            assert(found[i].distance == expected[i]);
+            assert(rects[found[i].index].Distance(p) == found[i].distance);
+        }
+    }
+
+    assert(tree.Nearest(Point<T>(0, 0), rects.size() + 5).size() == rects.size());
+    assert(RTree<T>(std::vector<Rect<T>>{}).Nearest(Point<T>(0, 0), 3).empty());
+    std::cout << "testRTreeNearestMatchesBruteForce<" << name << "> passed." << std::endl;
+}
+
+template<typename T>
+void testStabbingMatchesBruteForce(const char* name) {
+    auto rects = randomRects<T>(500, 9);
+    StabbingIndex<T> index(rects);
+
+    // Random points plus every corner, so closed edges are exercised
+    std::mt19937 gen(10);
+    std::uniform_int_distribution<int> coord(-60, 90);
+    std::vector<Point<T>> points;
+    for (int i = 0; i < 5000; ++i) points.emplace_back(T(coord(gen)), T(coord(gen)));
+    for (decltype(auto) r : rects) {
+        points.emplace_back(r.Left(), r.Bottom());
+        points.emplace_back(r.Right(), r.Top());
+    }
+
+    for (size_t threads : { 1, 4 }) {
+        StabbingResult result = index.Query(points, threads);
+        std::vector<uint32_t> counts;
+        index.Count(points, counts, threads);
+        assert(result.offsets.size() == points.size() + 1);
+
+        for (size_t i = 0; i < points.size(); ++i) {
+            std::vector<uint32_t> expected;
+            for (size_t j = 0; j < rects.size(); ++j) {
+                if (rects[j].Contains(points[i])) expected.push_back(uint32_t(j));
+            }
+            std::vector<uint32_t> found(result[i].begin(), result[i].end());
+            std::sort(found.begin(), found.end());
+            assert(found == expected);
+            assert(counts[i] == expected.size());
+        }
+    }
+
+    assert(StabbingIndex<T>(std::vector<Rect<T>>{}).Query(points).ids.empty());
+    std::cout << "testStabbingMatchesBruteForce<" << name << "> passed." << std::endl;
+}
+
+template<typename T>
+void testDynamicTreeMatchesBruteForce(const char* name) {
+    for (bool rotate : { true, false }) {
+        DynamicTree<T> tree(T(2), rotate);
+        std::vector<std::optional<Rect<T>>> live;
+        auto insert = [&](const Rect<T>& r) {
+            size_t id = tree.Insert(r);
+            if (id >= live.size()) live.resize(id + 1);
+            assert(!live[id]);
+            live[id] = r;
+            return id;
+        };
+        for (decltype(auto) r : randomRects<T>(500, 31)) insert(r);
+
+        std::mt19937 gen(32);
+        std::uniform_int_distribution<int> step(-3, 3);
+        auto windows = randomRects<T>(30, 33);
+        size_t reinserted = 0;
+        for (int tick = 0; tick < 20; ++tick) {
+            for (size_t id = 0; id < live.size(); ++id) {
+                if (!live[id]) continue;
+                Point<T> movement(T(step(gen)), T(step(gen)));
+                live[id]->Move(movement);
+                reinserted += tree.Move(id, movement);
+                assert(tree.Get(id) == *live[id] && tree.FatBox(id).Contains(*live[id]));
+            }
+
+            // Freed nodes are reused, so a removed id comes back with the next insertion
+            for (size_t k = 0; k < 10; ++k) {
+                size_t id = (tick * 37 + k * 53) % live.size();
+                if (!live[id]) continue;
+                tree.Remove(id);
+                live[id].reset();
+                assert(insert(Rect<T>(T(k), T(tick), T(5), T(5))) == id);
+            }
+
+            for (decltype(auto) w : windows) {
+                std::vector<size_t> expected, points;
+                for (size_t id = 0; id < live.size(); ++id) {
+                    if (live[id] && live[id]->Overlaps(w)) expected.push_back(id);
+                    if (live[id] && live[id]->Contains(w.origin)) points.push_back(id);
+                }
+                auto found = tree.Search(w);
+                auto stabbed = tree.SearchPoint(w.origin);
+                std::sort(found.begin(), found.end());
+                std::sort(stabbed.begin(), stabbed.end());
+                assert(found == expected && stabbed == points);
+            }
+        }
+        assert(tree.Size() == 500);
+        assert(reinserted > 0 && reinserted < 500 * 20); // Small moves stay inside the fat boxes
+        if (rotate) assert(tree.Height() <= 2 * 9 + 2);
+    }
+
+    DynamicTree<T> tree;
+    assert(tree.Empty() && tree.Height() == 0 && tree.Search(Rect<T>(0, 0, 10, 10)).empty());
+    size_t id = tree.Insert(Rect<T>(0, 0, 1, 1));
+    tree.Remove(id);
+    bool thrown = false;
+    try {
+        tree.Remove(id);
+    }
+    catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown && tree.Empty());
+    std::cout << "testDynamicTreeMatchesBruteForce<" << name << "> passed." << std::endl;
+}
+
+template<typename T>
+void testSpatialGridMatchesBruteForce(const char* name) {
+    for (double cell : { 0.0, 7.0, 1e-3 }) {
+        SpatialGrid<T> grid(randomRects<T>(500, 41), cell);
+        std::vector<std::optional<Rect<T>>> live;
+        for (decltype(auto) r : randomRects<T>(500, 41)) live.push_back(r);
+        assert(grid.Size() == 500 && grid.CellSize() > 0 && grid.Columns() * grid.Rows() <= 4 * 500);
+
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<int> step(-4, 4), far(-200, 200);
+        auto windows = randomRects<T>(30, 43);
+        windows.push_back(Rect<T>(T(-1000), T(-1000), T(3000), T(3000))); // Covers the border cells too
+        for (int tick = 0; tick < 20; ++tick) {
+            for (size_t id = 0; id < live.size(); ++id) {
+                if (!live[id]) continue;
+                // A few rectangles jump outside the frame and into the border cells
+                Point<T> movement = id % 50 == 0 ? Point<T>(T(far(gen)), T(far(gen))) : Point<T>(T(step(gen)), T(step(gen)));
+                live[id]->Move(movement);
+                grid.Move(id, movement);
+                assert(grid.Get(id) == *live[id]);
+            }
+
+            for (size_t k = 0; k < 10; ++k) {
+                size_t id = (tick * 37 + k * 53) % live.size();
+                if (!live[id]) continue;
+                grid.Remove(id);
+                live[id].reset();
+                Rect<T> r(T(k), T(tick), T(5), T(5));
+                size_t added = grid.Insert(r);
+                assert(added == id);
+                live[added] = r;
+            }
+
+            for (decltype(auto) w : windows) {
+                std::vector<size_t> expected, points;
+                for (size_t id = 0; id < live.size(); ++id) {
+                    if (live[id] && live[id]->Overlaps(w)) expected.push_back(id);
+                    if (live[id] && live[id]->Contains(w.origin)) points.push_back(id);
+                }
+                auto found = grid.Search(w);
+                auto stabbed = grid.SearchPoint(w.origin);
+                std::sort(found.begin(), found.end());
+                std::sort(stabbed.begin(), stabbed.end());
+                assert(found == expected && stabbed == points); // Also no duplicates
+            }
+        }
+        assert(grid.Size() == 500);
+    }
+
+    SpatialGrid<T> grid;
+    assert(grid.Empty() && grid.Search(Rect<T>(0, 0, 10, 10)).empty());
+    // Insertions into an empty grid, then a rebuild that lays the grid out for them
+    for (int i = 0; i < 1000; ++i) grid.Insert(Rect<T>(T(i % 40 * 10), T(i / 40 * 10), T(8), T(8)));
+    assert(grid.Search(Rect<T>(T(0), T(0), T(395), T(5))).size() == 40);
+    assert(grid.SearchPoint(Point<T>(T(1), T(1))).size() == 1);
+    bool thrown = false;
+    try {
+        grid.Remove(5000);
+    }
+    catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown && grid.Size() == 1000);
+    std::cout << "testSpatialGridMatchesBruteForce<" << name << "> passed." << std::endl;
+}
+
+template<typename T, typename Code>
+void testQuantizedConservative(const char* name) {
+    auto rects = randomRects<T>(2000, 21);
+    // A frame narrower than the number of levels exercises codes that decode to the same edge
+    for (decltype(auto) r : randomRects<T>(200, 22)) rects.emplace_back(r.Left() / T(20), r.Bottom() / T(20), r.width / T(10), r.height / T(10));
+
+    QuantizedRects<T, Code> quantized(rects);
+    static_assert(sizeof(typename QuantizedRects<T, Code>::Box) == 4 * sizeof(Code));
+    assert(quantized.Size() == rects.size() && quantized.MemoryBytes() == rects.size() * 4 * sizeof(Code));
+
+    Rect<T> frame = quantized.Frame();
+    double step = double(frame.width) / double(QuantizedRects<T, Code>::Levels());
+    auto decoded = quantized.Decode();
+    for (size_t i = 0; i < rects.size(); ++i) {
+        assert(decoded[i].Contains(rects[i]));
+        assert(quantized.Decode(i) == decoded[i]);
+        assert(double(decoded[i].width) <= double(rects[i].width) + 2 * step + 2);
+    }
+
+    auto windows = randomRects<T>(300, 23);
+    for (size_t k = 0; k < 50; ++k) windows.emplace_back(windows[k].Left() + T(200), windows[k].Bottom(), windows[k].width, windows[k].height);
+    windows.emplace_back(T(-1000), T(-1000), T(3000), T(3000));
+    for (decltype(auto) w : windows) {
+        // Exactly the decoded answer, hence never missing an original rectangle
+        std::vector<size_t> overlap, contain, point;
+        Point<T> p = w.origin;
+        for (size_t i = 0; i < rects.size(); ++i) {
+            if (decoded[i].Overlaps(w)) overlap.push_back(i);
+            if (decoded[i].Contains(w)) contain.push_back(i);
+            if (decoded[i].Contains(p)) point.push_back(i);
+            if (rects[i].Overlaps(w)) assert(decoded[i].Overlaps(w));
+        }
+        assert(quantized.Search(w) == overlap);
+        assert(quantized.SearchContaining(w) == contain);
+        assert(quantized.SearchPoint(p) == point);
+    }
+
+    bool thrown = false;
+    try {
+        quantized.Push(Rect<T>(frame.Right(), frame.Top(), T(1), T(1)));
+    }
+    catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown);
+    quantized.Push(rects[0]);
+    assert(quantized.Size() == rects.size() + 1 && quantized.Decode(rects.size()) == decoded[0]);
+    std::cout << "testQuantizedConservative<" << name << "> passed." << std::endl;
+}
+
+void testParallelFor() {
+    // Very uneven tasks: the first ones are slow, so idle workers must steal them
+    std::vector<std::atomic<int>> hits(10000);
+    std::atomic<long long> sum{ 0 };
+    ParallelFor(hits.size(), 4, [&](size_t t, size_t worker) {
+        assert(worker < 4);
+        long long local = 0;
+        for (size_t k = 0; k < (t < 8 ? 200000 : 10); ++k) local += k % 3;
+        sum += local > 0 ? 1 : 0;
+        ++hits[t];
+
+        // Nested loops run serially on the calling worker
+        if (t == 5) ParallelFor(3, 4, [&](size_t, size_t w) { assert(w == 0); });
+    });
+    for (decltype(auto) h : hits) assert(h == 1);
+    assert(sum == 10000);
+
+    bool thrown = false;
+    try {
+        ParallelFor(1000, 4, [](size_t t, size_t) {
+            if (t == 700) throw std::runtime_error("task failed");
+        });
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // The pool is reusable after an exception
+    std::atomic<size_t> count{ 0 };
+    ParallelFor(100, 3, [&](size_t, size_t) { ++count; });
+    assert(count == 100);
+    std::cout << "testParallelFor passed." << std::endl;
+}
+
+void testReductionsMatchSerial() {
+    auto ints = randomRects<int>(200000, 11);
+    auto doubles = randomRects<double>(200000, 12);
+
+    Rect<int> box = ints[0];
+    int64_t area = 0, perimeter = 0;
+    size_t wide = 0;
+    for (decltype(auto) r : ints) {
+        box = box.Union(r);
+        area += r.Area();
+        perimeter += r.Perimeter();
+        wide += r.width > r.height;
+    }
+    double darea = 0;
+    for (decltype(auto) r : doubles) darea += r.Area();
+
+    auto is_wide = [](const Rect<int>& r) { return r.width > r.height; };
+    for (size_t threads : { 1, 4 }) {
+        assert(BoundingBox(ints, threads) == box);
+        assert(SumArea(ints, threads) == area);
+        assert(SumPerimeter(ints, threads) == perimeter);
+        assert(CountIf(ints, is_wide, threads) == wide);
+
+        auto selected = SelectIf(ints, is_wide, threads);
+        assert(selected.size() == wide && std::is_sorted(selected.begin(), selected.end()));
+        for (size_t i : selected) assert(is_wide(ints[i]));
+
+        // A predicate with state: called once per rectangle, every true answer is kept and nothing more
+        std::atomic<size_t> calls{ 0 };
+        auto every_third = [&](const Rect<int>&) { return calls++ % 3 == 0; };
+        auto thirds = SelectIf(ints, every_third, threads);
+        assert(calls == ints.size() && thirds.size() == (ints.size() + 2) / 3);
+        assert(std::adjacent_find(thirds.begin(), thirds.end(), std::greater_equal<size_t>()) == thirds.end());
+
+        assert(std::abs(SumArea(doubles, threads) - darea) < 1e-6 * darea);
+    }
+    assert(SumArea(doubles, 1) == SumArea(doubles, 4)); // Same blocks, same order
+
+    std::vector<Rect<int>> none;
+    assert(BoundingBox(none) == Rect<int>() && SumArea(none) == 0 && SelectIf(none, is_wide).empty());
+    std::cout << "testReductionsMatchSerial passed." << std::endl;
+}
+
+void testCurveKeys() {
+    assert(MortonKey(1, 0) == 1 && MortonKey(0, 1) == 2 && MortonKey(3, 3) == 15);
+    assert(MortonKey(UINT32_MAX, 0) == 0x5555555555555555ull && MortonKey(0, UINT32_MAX) == 0xAAAAAAAAAAAAAAAAull);
+
+    // The 16x16 corner of the grid is the start of the Hilbert curve, walked one neighbouring cell at a time
+    std::vector<std::pair<uint32_t, uint32_t>> walk(256);
+    for (uint32_t x = 0; x < 16; ++x)
+        for (uint32_t y = 0; y < 16; ++y) {
+            uint64_t d = HilbertKey(x, y);
+            assert(d < 256);
+            walk[d] = { x + 1, y + 1 };
+        }
+    for (size_t d = 1; d < walk.size(); ++d) {
+        auto [x0, y0] = walk[d - 1];
+        auto [x1, y1] = walk[d];
+        assert(x0 != 0 && (x0 > x1 ? x0 - x1 : x1 - x0) + (y0 > y1 ? y0 - y1 : y1 - y0) == 1);
+    }
+    assert(HilbertKey(UINT32_MAX, 0) == UINT64_MAX);
+
+    // The branchless key against the textbook walk down the quadrants
+    auto reference = [](uint32_t x, uint32_t y) {
+        uint64_t d = 0;
+        for (uint32_t s = 1u << 31; s > 0; s >>= 1) {
+            uint32_t rx = (x & s) ? 1 : 0, ry = (y & s) ? 1 : 0;
+            d += uint64_t(s) * s * ((3 * rx) ^ ry);
+            if (ry == 0) {
+                if (rx == 1) x = ~x, y = ~y;
+                std::swap(x, y);
+            }
+        }
+        return d;
+    };
+    std::mt19937 gen(62);
+    for (int i = 0; i < 100000; ++i) {
+        uint32_t x = gen(), y = gen();
+        assert(HilbertKey(x, y) == reference(x, y));
+    }
+
+    // More rectangles than one radix block, with repeated centers
+    auto rects = randomRects<double>(150000, 61);
+    for (Curve curve : { Curve::Morton, Curve::Hilbert }) {
+        auto keys = CurveKeys(rects, curve);
+        std::vector<size_t> expected(rects.size());
+        for (size_t i = 0; i < expected.size(); ++i) expected[i] = i;
+        std::stable_sort(expected.begin(), expected.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+        assert(CurveOrder(rects, curve, 1) == expected);
+        assert(CurveOrder(rects, curve, 4) == expected);
+
+        auto sorted = rects;
+        assert(SortAlongCurve(sorted, curve) == expected);
+        for (size_t k = 0; k < sorted.size(); ++k) assert(sorted[k] == rects[expected[k]]);
+    }
+
+    // The lower-left and upper-right corners of the bounding box get the first and last cells
+    std::vector<Rect<int>> corners{ Rect<int>(10, 10, 0, 0), Rect<int>(20, 20, 0, 0), Rect<int>(10, 20, 0, 0) };
+    auto morton = CurveKeys(corners, Curve::Morton);
+    assert(morton[0] == 0 && morton[1] == UINT64_MAX && morton[2] == 0xAAAAAAAAAAAAAAAAull);
+    assert(CurveOrder(corners, Curve::Morton) == (std::vector<size_t>{ 0, 2, 1 }));
+
+    std::vector<Rect<int>> none;
+    assert(CurveKeys(none).empty() && CurveOrder(none).empty());
+    std::cout << "testCurveKeys passed." << std::endl;
+}
+
+void testRTreeEdgeCases() {
+    RTree<int> empty(std::vector<Rect<int>>{});
+    assert(empty.Search(Rect<int>(0, 0, 10, 10)).empty());
+
+    RTree<int> single(std::vector<Rect<int>>{ Rect<int>(1, 1, 2, 2) });
+    assert(single.SearchPoint(Point<int>(2, 2)) == std::vector<size_t>{ 0 });
+    assert(single.Bounds() == Rect<int>(1, 1, 2, 2));
+    std::cout << "testRTreeEdgeCases passed." << std::endl;
+}
+
+void testSweepAndPruneMatchesBruteForce() {
+    auto rects = randomRects<double>(3000, 4);
+    std::vector<std::pair<size_t, size_t>> expected;
+    for (size_t i = 0; i < rects.size(); ++i)
+        for (size_t j = i + 1; j < rects.size(); ++j)
+            if (rects[i].Overlaps(rects[j])) expected.emplace_back(i, j);
+
+    std::vector<std::pair<size_t, size_t>> serial;
+    SweepAndPrune(rects, [&](size_t i, size_t j) { serial.emplace_back(i, j); });
+    auto parallel = OverlappingPairs(rects, 4);
+
+    std::sort(serial.begin(), serial.end());
+    std::sort(parallel.begin(), parallel.end());
+    assert(serial == expected);
+    assert(parallel == expected);
+    std::cout << "testSweepAndPruneMatchesBruteForce passed." << std::endl;
+}
+
+template<typename T>
+void testSpatialJoinMatchesBruteForce(const char* name) {
+    using Pairs = std::vector<std::pair<size_t, size_t>>;
+    auto check = [](const std::vector<Rect<T>>& a, const std::vector<Rect<T>>& b) {
+        Pairs expected;
+        for (size_t i = 0; i < a.size(); ++i)
+            for (size_t j = 0; j < b.size(); ++j)
+                if (a[i].Overlaps(b[j])) expected.emplace_back(i, j);
+
+        auto serial = SpatialJoin(a, b);
+        auto parallel = SpatialJoin(a, b, 4);
+        // The same pairs in the same order for any number of threads
+        assert(serial == parallel);
+        std::sort(serial.begin(), serial.end());
+        assert(serial == expected);
+    };
+
+    check(randomRects<T>(1500, 51), randomRects<T>(2000, 52));
+    // Spread out, so the join runs on many tiles and large rectangles cross tile borders
+    auto a = randomRects<T>(3000, 53), b = randomRects<T>(500, 54);
+    for (decltype(auto) r : a) r.origin = Point<T>(r.origin.x * 20, r.origin.y * 20);
+    for (decltype(auto) r : b) r.width *= 10;
+    check(a, b);
+
+    // Refinement sees the intersection and keeps only the pairs it accepts
+    auto c = randomRects<T>(800, 55), d = randomRects<T>(800, 56);
+    std::atomic<size_t> refined{ 0 };
+    auto large = SpatialJoin(c, d, 4, [&](size_t i, size_t j, const Rect<T>& overlap) {
+        assert(overlap == c[i].Intersect(d[j]));
+        ++refined;
+        return overlap.Area() > 50;
+    });
+    Pairs expected;
+    size_t overlapping = 0;
+    for (size_t i = 0; i < c.size(); ++i)
+        for (size_t j = 0; j < d.size(); ++j) {
+            if (!c[i].Overlaps(d[j])) continue;
+            ++overlapping;
+            if (c[i].Intersect(d[j]).Area() > 50) expected.emplace_back(i, j);
+        }
+    std::sort(large.begin(), large.end());
+    assert(large == expected);
+    assert(refined == overlapping);
+
+    // Empty inputs, disjoint bounding boxes and touching edges
+    assert(SpatialJoin(std::vector<Rect<T>>{}, d).empty());
+    assert(SpatialJoin(c, std::vector<Rect<T>>{}).empty());
+    assert(SpatialJoin(std::vector<Rect<T>>{ Rect<T>(0, 0, 1, 1) }, std::vector<Rect<T>>{ Rect<T>(5, 5, 1, 1) }).empty());
+    assert(SpatialJoin(std::vector<Rect<T>>{ Rect<T>(0, 0, 2, 2) }, std::vector<Rect<T>>{ Rect<T>(2, 2, 0, 0) }) == (Pairs{ { 0, 0 } }));
+    std::cout << "testSpatialJoinMatchesBruteForce<" << name << "> passed." << std::endl;
+}
+
+void testCoveredAreaMatchesGrid() {
+    // Rectangles on a 60x60 grid, compared against counting unit cells and unit boundary edges
+    std::mt19937 gen(5);
+    std::uniform_int_distribution<int> pos(0, 40), size(0, 20);
+    std::vector<Rect<int>> rects;
+    for (int i = 0; i < 40; ++i) rects.emplace_back(pos(gen), pos(gen), size(gen), size(gen));
+
+    constexpr int n = 62;
+    std::vector<std::vector<bool>> cell(n, std::vector<bool>(n, false));
+    for (decltype(auto) r : rects)
+        for (int x = r.Left(); x < r.Right(); ++x)
+            for (int y = r.Bottom(); y < r.Top(); ++y) cell[x + 1][y + 1] = true;
+
+    long long area = 0, perimeter = 0;
+    for (int x = 1; x < n - 1; ++x)
+        for (int y = 1; y < n - 1; ++y) {
+            if (!cell[x][y]) continue;
+            ++area;
+            perimeter += !cell[x - 1][y] + !cell[x + 1][y] + !cell[x][y - 1] + !cell[x][y + 1];
+        }
+
+    assert(CoveredArea(rects) == area);
+    assert(CoveredPerimeter(rects) == perimeter);
+    std::cout << "testCoveredAreaMatchesGrid passed." << std::endl;
+}
+
+void testCoveredAreaDouble() {
+    std::vector<Rect<double>> rects{ { 0.0, 0.0, 2.0, 2.0 }, { 1.0, 1.0, 2.0, 2.0 }, { 2.0, 0.0, 1.0, 1.0 } };
+    // Together they cover a 3x3 square without its top-left cell
+    assert(CoveredArea(rects) == 8.0);
+    assert(CoveredPerimeter(rects) == 12.0);
+    assert(CoveredArea(std::vector<Rect<double>>{}) == 0.0);
+    std::cout << "testCoveredAreaDouble passed." << std::endl;
+}
+
+void testRegionAlgebraMatchesGrid() {
+    auto a = Region<double>(randomRects<double>(30, 6));
+    auto b = Region<double>(randomRects<double>(30, 7));
+    auto both = a.Intersect(b), either = a.Union(b), diff = a.Subtract(b), exclusive = a.Xor(b);
+
+    // Probe the centers of a fine grid: fractional coordinates above are multiples of 0.25
+    for (double x = -60; x < 90; x += 0.5) {
+        for (double y = -60; y < 90; y += 0.5) {
+            Point<double> p(x + 0.125, y + 0.125);
+            bool inA = a.Contains(p), inB = b.Contains(p);
+            assert(both.Contains(p) == (inA && inB));
+            assert(either.Contains(p) == (inA || inB));
+            assert(diff.Contains(p) == (inA && !inB));
+            assert(exclusive.Contains(p) == (inA != inB));
+        }
+    }
+
+    assert(either.Area() == CoveredArea(either.Rects()));
+    assert(either.Area() == both.Area() + exclusive.Area());
+    std::cout << "testRegionAlgebraMatchesGrid passed." << std::endl;
+}
+
+void testRegionCoalesces() {
+    // Two halves of a square merge back into a single rectangle
+    Region<int> left(Rect<int>(0, 0, 5, 10)), right(Rect<int>(5, 0, 5, 10));
+    Region<int> square = left.Union(right);
+    assert(square.RectCount() == 1 && square.Rects()[0] == Rect<int>(0, 0, 10, 10));
+
+    // Cutting a hole and filling it again restores the square
+    Region<int> hole(Rect<int>(3, 3, 2, 2));
+    Region<int> ring = square.Subtract(hole);
+    assert(ring.BandCount() == 3 && ring.Area() == 96);
+    assert(!ring.Contains(Point<int>(4, 4)) && ring.Contains(Point<int>(3, 3)));
+    assert(ring.Union(hole) == square);
+    assert(square.Intersect(Region<int>(Rect<int>(20, 20, 1, 1))).Empty());
+    std::cout << "testRegionCoalesces passed." << std::endl;
+}
+
+void testBinaryStoreRoundTrip() {
+    namespace fs = std::filesystem;
+    fs::path text = fs::temp_directory_path() / "rectangle_test.txt";
+    fs::path binary = fs::temp_directory_path() / "rectangle_test.bin";
+    fs::path back = fs::temp_directory_path() / "rectangle_test_back.txt";
+
+    std::vector<std::pair<std::string, Rect<double>>> table{
+        { "beta", Rect<double>(1.5, -2.0, 3.0, 4.0) },
+        { "alpha", Rect<double>(0.1, 0.2, 0.3, 0.4) },
+        { "gamma", Rect<double>() } };
+    {
+        std::ofstream fout(text);
+        write_text(fout, table);
+    }
+
+    convert_text_to_binary(text, binary);
+    assert(is_binary_file(binary) && !is_binary_file(text));
+
+    BinaryTable mapped(binary);
+    assert(mapped.Size() == 3);
+    assert(mapped.Name(0) == "alpha");
+    assert(mapped.Get(*mapped.Find("beta")) == Rect<double>(1.5, -2.0, 3.0, 4.0));
+    assert(!mapped.Find("delta"));
+
+    convert_binary_to_text(binary, back);
+    std::vector<std::pair<std::string, Rect<double>>> loaded;
+    read_text_file(back, [&](std::string_view n, const Rect<double>& r) { loaded.emplace_back(n, r); });
+    assert(loaded.size() == 3 && loaded[2].first == "gamma" && loaded[2].second == Rect<double>());
+
+    fs::remove(text);
+    fs::remove(binary);
+    fs::remove(back);
+    std::cout << "testBinaryStoreRoundTrip passed." << std::endl;
+}
+
+void testTextParallelRoundTrip() {
+    namespace fs = std::filesystem;
+    fs::path text = fs::temp_directory_path() / "rectangle_test_large.txt";
+
+    // Enough records for several 1 MB chunks; values need all 17 digits to round-trip
+    std::mt19937_64 gen(8);
+    std::uniform_real_distribution<double> coord(-1e6, 1e6), size(0, 1e3);
+    std::vector<std::pair<std::string, Rect<double>>> table;
+    for (int i = 0; i < 40000; ++i) {
+        table.emplace_back("v" + std::to_string(i), Rect<double>(coord(gen), coord(gen), size(gen), size(gen)));
+    }
+    {
+        std::ofstream fout(text, std::ios::binary);
+        write_text(fout, table);
+    }
+
+    size_t i = 0;
+    read_text_file(text, [&](std::string_view n, const Rect<double>& r) {
+        assert(n == table[i].first && r == table[i].second);
+        ++i;
+    }, 4);
+    assert(i == table.size());
+
+    {
+        std::ofstream fout(text, std::ios::binary);
+        fout << "a 1 2 3 4\n\n  b\t+5 6 7 8\r\nc 1 x 3 4\n";
+    }
+    try {
+        read_text_file(text, [](std::string_view, const Rect<double>&) {});
+        std::cerr << "testTextParallelRoundTrip failed: exception not thrown." << std::endl;
+    }
+    catch (const std::runtime_error& e) {
+        assert(std::string(e.what()).find("строке 4 ") != std::string::npos);
+    }
+
+    fs::remove(text);
+    std::cout << "testTextParallelRoundTrip passed." << std::endl;
+}
+
+void testVariableTableMatchesMap() {
+    VariableTable table;
+    std::map<std::string, Rect<double>> reference;
+    std::mt19937 gen(9);
+    std::uniform_int_distribution<int> key(0, 2000), op(0, 2);
+
+    for (int i = 0; i < 50000; ++i) {
+        std::string name = "n" + std::to_string(key(gen));
+        Rect<double> r(i, -i, 1, 2);
+        switch (op(gen)) {
+        case 0:
+            table.InsertOrAssign(name, r);
+            reference.insert_or_assign(name, r);
+            break;
+        case 1:
+            assert(table.Erase(name) == (reference.erase(name) == 1));
+            break;
+        case 2: {
+            auto h = table.Find(name);
+            auto it = reference.find(name);
+            assert(h.has_value() == (it != reference.end()));
+            if (h) assert(table[*h] == it->second && table.Name(*h) == name);
+            break;
+        }
+        }
+    }
+
+    assert(table.Size() == reference.size());
+    size_t visited = 0;
+    for (decltype(auto) v : table) {
+        assert(reference.at(std::string(v.first)) == v.second);
+        ++visited;
+    }
+    assert(visited == reference.size());
+    std::cout << "testVariableTableMatchesMap passed." << std::endl;
+}
+
+void testVariableTableHandles() {
+    VariableTable table;
+    auto [a, inserted] = table.Insert("a", Rect<double>(1, 1, 1, 1));
+    assert(inserted && !table.Insert("a", Rect<double>()).second);
+
+    // Handles survive growth of the table and removal of other variables
+    for (int i = 0; i < 1000; ++i) table.Insert("tmp" + std::to_string(i), Rect<double>());
+    for (int i = 0; i < 1000; ++i) table.Erase("tmp" + std::to_string(i));
+    assert(table.Size() == 1 && table.Name(a) == "a" && table[a] == Rect<double>(1, 1, 1, 1));
+
+    table.InsertOrAssign(table.Name(a), Rect<double>(2, 2, 2, 2));
+    assert(table.At("a") == Rect<double>(2, 2, 2, 2));
+    std::cout << "testVariableTableHandles passed." << std::endl;
+}
+
+void testVersionedTableSnapshots() {
+    VersionedTable table(16);
+    auto empty = table.Read();
+    assert(empty.Empty() && empty.Number() == 0);
+
+    // A transaction is published whole; older snapshots keep their version
+    assert(table.Update([](VersionedTable::Transaction& tx) {
+        for (int i = 0; i < 1000; ++i) tx.InsertOrAssign("v" + std::to_string(i), Rect<double>(i, 0, 1, 1));
+        assert(tx.Find("v7") == Rect<double>(7, 0, 1, 1));
+    }) == 1);
+    auto first = table.Read();
+    table.InsertOrAssign("v7", Rect<double>(-1, -1, 2, 2));
+    assert(table.Erase("v8") && !table.Erase("v8"));
+    assert(empty.Empty() && !empty.Find("v7"));
+    assert(first.Size() == 1000 && first.Find("v7") == Rect<double>(7, 0, 1, 1) && first.Contains("v8"));
+    auto latest = table.Read();
+    assert(latest.Number() == 4 && latest.Size() == 999 && latest.Find("v7") == Rect<double>(-1, -1, 2, 2) && !latest.Contains("v8"));
+    size_t seen = 0;
+    latest.ForEach([&](std::string_view, const Rect<double>&) { ++seen; });
+    assert(seen == 999);
+
+    // Replaced versions live until the snapshots that may see them are gone
+    assert(table.Retained() == 4);
+    { auto released = std::move(empty); }
+    first = table.Read();
+    latest = table.Read();
+    assert(table.Retained() == 0);
+
+    // Concurrent readers never observe half of a transaction
+    std::atomic<bool> done{ false };
+    std::vector<std::thread> readers;
+    std::atomic<size_t> reads{ 0 };
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&] {
+            std::uint64_t last = 0;
+            while (!done.load()) {
+                auto snapshot = table.Read();
+                assert(snapshot.Number() >= last);
+                last = snapshot.Number();
+                auto x = snapshot.Find("x"), y = snapshot.Find("y");
+                assert(x.has_value() == y.has_value());
+                if (x) assert(*x == *y);
+                reads.fetch_add(1);
+            }
+        });
+    }
+    for (int i = 0; i < 2000; ++i) {
+        table.Update([&](VersionedTable::Transaction& tx) {
+            tx.InsertOrAssign("x", Rect<double>(i, i, 1, 1));
+            tx.InsertOrAssign("y", Rect<double>(i, i, 1, 1));
+        });
+        if (i % 64 == 0) std::this_thread::yield();
+    }
+    done = true;
+    for (auto& t : readers) t.join();
+    assert(reads.load() > 0 && table.Read().Find("x") == Rect<double>(1999, 1999, 1, 1));
+    std::cout << "testVersionedTableSnapshots passed." << std::endl;
+}
+
+void testJournalReplay() {
+    namespace fs = std::filesystem;
+    fs::path dir = fs::temp_directory_path() / "rectangle_journal_test";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    fs::path base = dir / "vars";
+
+    std::map<std::string, Rect<double>> expected;
+    {
+        VariableTable table;
+        Journal journal(base, 4096);
+        assert(journal.Open(table) == 0 && table.Empty());
+
+        std::mt19937 gen(41);
+        std::uniform_int_distribution<int> name(0, 299), op(0, 3), coord(-100, 100);
+        for (int i = 0; i < 5000; ++i) {
+            std::string n = "v" + std::to_string(name(gen));
+            if (op(gen) == 0) {
+                table.Erase(n);
+                expected.erase(n);
+                journal.Erase(n);
+            }
+            else {
+                Rect<double> r(coord(gen) / 4.0, coord(gen), std::abs(coord(gen)), 0.5);
+                table.InsertOrAssign(n, r);
+                expected[n] = r;
+                journal.Put(n, r);
+            }
+        }
+
+        // Saving one change costs one small record, whatever the size of the table
+        std::uintmax_t before = journal.JournalBytes();
+        journal.Put("v0", Rect<double>(1, 2, 3, 4));
+        table.InsertOrAssign("v0", Rect<double>(1, 2, 3, 4));
+        expected["v0"] = Rect<double>(1, 2, 3, 4);
+        assert(journal.JournalBytes() - before < 64);
+        journal.Close();
+    }
+
+    // Compaction left a snapshot and few journal files behind
+    size_t journals = 0;
+    for (decltype(auto) entry : fs::directory_iterator(dir)) journals += entry.path().extension() == ".journal";
+    assert(fs::exists(base.string() + ".snapshot") && journals <= 2);
+
+    auto check = [&](const VariableTable& table) {
+        assert(table.Size() == expected.size());
+        for (const auto& [n, r] : expected) assert(table.At(n) == r);
+    };
+    {
+        VariableTable table;
+        Journal journal(base);
+        journal.Open(table);
+        check(table);
+        table.Erase("v0");
+        journal.Erase("v0");
+        expected.erase("v0");
+        journal.Close();
+    }
+
+    // A record torn by a crash is dropped, the ones before it are kept
+    fs::path newest;
+    for (decltype(auto) entry : fs::directory_iterator(dir)) {
+        if (entry.path().extension() == ".journal" && (newest.empty() || entry.path().string().size() > newest.string().size() ||
+            (entry.path().string().size() == newest.string().size() && entry.path() > newest))) newest = entry.path();
+    }
+    {
+        std::ofstream fout(newest, std::ios::binary | std::ios::app);
+        const char torn[] = "\x30\x00\x00\x00\x01\x02\x03\x04\x01\x02\x00\x00\x00v0";
+        fout.write(torn, sizeof(torn) - 1);
+    }
+    {
+        VariableTable table;
+        Journal journal(base);
+        journal.Open(table);
+        check(table);
+    }
+
+    // A batch reaches the file with its single Flush and replays like separate records
+    auto on_disk = [&] {
+        std::uintmax_t bytes = 0;
+        for (decltype(auto) entry : fs::directory_iterator(dir))
+            if (entry.path().extension() == ".journal") bytes += fs::file_size(entry.path());
+        return bytes;
+    };
+    {
+        VariableTable table;
+        Journal journal(base);
+        journal.Open(table);
+        std::uintmax_t before = on_disk();
+        journal.BeginBatch();
+        for (int i = 0; i < 500; ++i) {
+            std::string n = "batch" + std::to_string(i);
+            Rect<double> r(i, -i, 1, 2);
+            table.InsertOrAssign(n, r);
+            expected[n] = r;
+            journal.Put(n, r);
+        }
+        assert(on_disk() == before);
+        journal.Flush();
+        assert(on_disk() > before);
+        journal.Close();
+    }
+    {
+        VariableTable table;
+        Journal journal(base);
+        journal.Open(table);
+        check(table);
+    }
+
+    fs::remove_all(dir);
+    std::cout << "testJournalReplay passed." << std::endl;
+}
+
+void testExpressionGraph() {
+    VariableTable table;
+    ExpressionGraph graph(table);
+    auto a = table.Insert("a", Rect<double>(0, 0, 4, 4)).first;
+    auto b = table.Insert("b", Rect<double>(2, 2, 4, 4)).first;
+    auto c = table.Insert("c", Rect<double>(1, 1, 2, 8)).first;
+    auto d = table.Insert("d", Rect<double>()).first;
+    auto e = table.Insert("e", Rect<double>()).first;
+
+    // d = (a | b) & c, e = move(d, 10, 0)
+    graph.Define(d, graph.Intersect(graph.Union(graph.Ref(a), graph.Ref(b)), graph.Ref(c)));
+    graph.Define(e, graph.Move(graph.Ref(d), Point<double>(10, 0)));
+    assert(graph.IsDerived(d) && graph.IsDerived(e) && !graph.IsDerived(a));
+    assert(graph.ToString(d) == "((a | b) & c)");
+    assert(graph.Get(e) == Rect<double>(11, 1, 2, 5));
+    assert(graph.Get(d) == Rect<double>(1, 1, 2, 5));
+    size_t computed = graph.Recomputed();
+    assert(graph.Get(e) == Rect<double>(11, 1, 2, 5) && graph.Recomputed() == computed);
+
+    // An edit only marks the dependents; the table keeps the old value until a read
+    table[c] = Rect<double>(0, 0, 1, 1);
+    graph.Assigned(c);
+    assert(table[e] == Rect<double>(11, 1, 2, 5));
+    assert(graph.Get(e) == Rect<double>(10, 0, 1, 1));
+    // Intersect, d, Move and e; the union does not depend on c
+    assert(graph.Recomputed() == computed + 4);
+
+    // Refresh brings every stale derived variable into the table
+    table[a] = Rect<double>(-1, -1, 1, 1);
+    graph.Assigned(a);
+    std::vector<ExpressionGraph::Handle> refreshed;
+    graph.Refresh([&](ExpressionGraph::Handle h) { refreshed.push_back(h); });
+    assert(refreshed.size() == 2 && table[d] == Rect<double>(0, 0, 1, 1) && table[e] == Rect<double>(10, 0, 1, 1));
+
+    // A cycle is rejected and leaves the variable as it was
+    bool thrown = false;
+    try {
+        graph.Define(d, graph.Union(graph.Ref(e), graph.Ref(a)));
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown && graph.ToString(d) == "((a | b) & c)");
+
+    // Used variables cannot be forgotten; an assigned derived variable becomes plain
+    assert(graph.Used(d) && !graph.Used(e));
+    thrown = false;
+    try {
+        graph.Erase(d);
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    table[d] = Rect<double>(5, 5, 1, 1);
+    graph.Assigned(d);
+    assert(!graph.IsDerived(d) && graph.Get(d) == Rect<double>(5, 5, 1, 1));
+    assert(graph.Get(e) == Rect<double>(15, 5, 1, 1));
+    graph.Erase(e);
+    assert(!graph.Used(d));
+
+    // A long chain costs nothing until read and is evaluated without recursion
+    const int chain = 100000;
+    auto previous = table.Insert("v0", Rect<double>(0, 0, 1, 1)).first;
+    auto first = previous;
+    for (int i = 1; i <= chain; ++i) {
+        auto h = table.Insert("v" + std::to_string(i), Rect<double>()).first;
+        graph.Define(h, graph.Move(graph.Ref(previous), Point<double>(1, 0)));
+        previous = h;
+    }
+    assert(graph.Get(previous) == Rect<double>(chain, 0, 1, 1));
+    table[first] = Rect<double>(0, 1, 1, 1);
+    graph.Assigned(first);
+    computed = graph.Recomputed();
+    assert(graph.Get(previous) == Rect<double>(chain, 1, 1, 1));
+    assert(graph.Recomputed() == computed + 2 * chain);
+    std::cout << "testExpressionGraph passed." << std::endl;
+}
+
+#ifdef __linux__
+void testQueryServer() {
+    using namespace server_protocol;
+    namespace fs = std::filesystem;
+
+    fs::path dir = fs::temp_directory_path() / "rectangle_server_test";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    VariableTable table;
+    Journal journal(dir / "vars");
+    journal.Open(table);
+    QueryServer server(table, &journal);
+    fs::path socket_path = fs::temp_directory_path() / "rectangle_test.sock";
+    server.Listen(socket_path);
+    std::thread loop([&] { server.Run(); });
+
+    auto connect_client = [&] {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::string p = socket_path.string();
+        std::memcpy(address.sun_path, p.data(), p.size());
+        int r = connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+        assert(fd >= 0 && r == 0);
+        return fd;
+    };
+    auto send_all = [](int fd, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t w = send(fd, data, size, MSG_NOSIGNAL);
+            assert(w > 0);
+            data += w;
+            size -= static_cast<size_t>(w);
+        }
+    };
+    struct Reply {
+        ResponseHeader header;
+        std::string payload;
+    };
+    auto receive = [](int fd, size_t n) {
+        std::vector<Reply> replies;
+        std::string buffer;
+        char chunk[4096];
+        while (replies.size() < n) {
+            ssize_t r = recv(fd, chunk, sizeof(chunk), 0);
+            assert(r > 0);
+            buffer.append(chunk, static_cast<size_t>(r));
+            std::string_view rest(buffer), payload;
+            ResponseHeader header;
+            while (NextFrame(rest, header, payload)) replies.push_back({ header, std::string(payload) });
+            buffer.erase(0, buffer.size() - rest.size());
+        }
+        assert(replies.size() == n);
+        return replies;
+    };
+    auto rect_of = [](const Reply& reply) {
+        Reader reader(reply.payload);
+        Rect<double> r = reader.Rectangle();
+        assert(reader.End());
+        return r;
+    };
+
+    // Every command in one write; the second write splits a frame header to check reassembly
+    int fd = connect_client();
+    std::vector<char> batch;
+    Request(batch, 1, Op::Create, std::string_view("a"), Rect<double>(0, 0, 4, 4));
+    Request(batch, 2, Op::Create, std::string_view("b"), Rect<double>(2, 2, 4, 4));
+    Request(batch, 3, Op::Get, std::string_view("a"));
+    Request(batch, 4, Op::Intersect, std::string_view("a"), std::string_view("b"));
+    Request(batch, 5, Op::Union, std::string_view("a"), std::string_view("b"));
+    Request(batch, 6, Op::Area, std::string_view("a"));
+    Request(batch, 7, Op::Window, Rect<double>(5, 5, 1, 1));
+    Request(batch, 8, Op::Delete, std::string_view("b"));
+    Request(batch, 9, Op::Get, std::string_view("b"));
+    Request(batch, 10, Op::Create, std::string_view("bad name"), Rect<double>());
+    Request(batch, 11, Op::Get);
+    Request(batch, 12, static_cast<Op>(42));
+    // Names the menu could not select: a digit, a tab
+    Request(batch, 13, Op::Create, std::string_view("a1"), Rect<double>());
+    Request(batch, 14, Op::Create, std::string_view("tab\tname"), Rect<double>());
+    send_all(fd, batch.data(), batch.size() - 7);
+    send_all(fd, batch.data() + batch.size() - 7, 7);
+
+    auto replies = receive(fd, 14);
+    for (size_t i = 0; i < replies.size(); ++i) assert(replies[i].header.id == i + 1);
+    assert(replies[0].header.status == Status::Ok && replies[0].payload.empty());
+    assert(rect_of(replies[2]) == Rect<double>(0, 0, 4, 4));
+    assert(rect_of(replies[3]) == Rect<double>(2, 2, 2, 2));
+    assert(rect_of(replies[4]) == Rect<double>(0, 0, 6, 6));
+    assert(Reader(replies[5].payload).Value<double>() == 16);
+    {
+        Reader reader(replies[6].payload);
+        assert(reader.Value<std::uint32_t>() == 1 && reader.Name() == "b" && reader.End());
+    }
+    assert(replies[7].header.status == Status::Ok && replies[8].header.status == Status::NotFound);
+    assert(replies[9].header.status == Status::Invalid && replies[10].header.status == Status::Invalid);
+    assert(replies[11].header.status == Status::Invalid);
+    assert(replies[12].header.status == Status::Invalid && replies[13].header.status == Status::Invalid);
+    assert(!table.Contains("a1") && !table.Contains("tab\tname"));
+    close(fd);
+
+    // Many clients pipelining at once
+    const int clients = 8, requests = 500;
+    std::vector<std::thread> threads;
+    for (int c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c] {
+            int fd = connect_client();
+            std::vector<char> out;
+            for (int i = 0; i < requests; ++i) {
+                // Names without digits, as the menu requires
+                std::string name = "c" + std::string(1, char('a' + c)) + "_";
+                for (int k = i; k > 0 || name.back() == '_'; k /= 10) name += char('a' + k % 10);
+                Request(out, 2 * i, Op::Create, std::string_view(name), Rect<double>(c, i, 1, 1));
+                Request(out, 2 * i + 1, Op::Get, std::string_view(name));
+            }
+            send_all(fd, out.data(), out.size());
+            auto replies = receive(fd, 2 * requests);
+            for (int i = 0; i < requests; ++i) {
+                assert(replies[2 * i].header.status == Status::Ok);
+                assert(rect_of(replies[2 * i + 1]) == Rect<double>(c, i, 1, 1));
+            }
+            close(fd);
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    // Window answers from the index, which follows creates, overwrites and deletes
+    fd = connect_client();
+    batch.clear();
+    Request(batch, 1, Op::Create, std::string_view("a"), Rect<double>(3, 120, 0.5, 0.5));
+    Request(batch, 2, Op::Delete, std::string_view("cd_acb"));
+    Request(batch, 3, Op::Window, Rect<double>(2.5, 100, 2, 50));
+    send_all(fd, batch.data(), batch.size());
+    {
+        auto window = receive(fd, 3);
+        Reader reader(window[2].payload);
+        std::vector<std::string> names(reader.Value<std::uint32_t>());
+        for (decltype(auto) n : names) n = reader.Name();
+        assert(reader.End());
+        std::vector<std::string> expected;
+        for (const auto& [name, r] : table)
+            if (r.Overlaps(Rect<double>(2.5, 100, 2, 50))) expected.emplace_back(name);
+        std::sort(names.begin(), names.end());
+        std::sort(expected.begin(), expected.end());
+        assert(names == expected && !names.empty());
+        assert(std::find(names.begin(), names.end(), "a") != names.end());
+        assert(std::find(names.begin(), names.end(), "cd_acb") == names.end());
+    }
+    close(fd);
+
+    // A frame cut short by the end of the stream: the server closes the connection instead of polling it forever
+    fd = connect_client();
+    {
+        RequestHeader header{ 100, 1, Op::Get, {} };
+        char partial[sizeof(header) + 10] = {};
+        std::memcpy(partial, &header, sizeof(header));
+        send_all(fd, partial, sizeof(partial));
+        shutdown(fd, SHUT_WR);
+        timeval timeout{ 5, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        char byte;
+        assert(recv(fd, &byte, 1, 0) == 0);
+    }
+    close(fd);
+
+    fd = connect_client();
+    batch.clear();
+    Request(batch, 0, Op::Stats);
+    send_all(fd, batch.data(), batch.size());
+    {
+        auto stats = receive(fd, 1);
+        Reader reader(stats[0].payload);
+        assert(reader.Value<std::uint64_t>() == 6 + clients * requests); // Create: calls, the rejected ones too
+        reader.Value<std::uint64_t>();
+        reader.Value<std::uint64_t>();
+        reader.Value<std::uint64_t>();
+        reader.Value<std::uint64_t>();
+    }
+    close(fd);
+
+    server.Stop();
+    loop.join();
+    assert(table.Size() == clients * requests);
+
+    // Every acknowledged change reached the journal
+    journal.Close();
+    {
+        VariableTable replayed;
+        Journal reopened(dir / "vars");
+        reopened.Open(replayed);
+        assert(replayed.Size() == table.Size());
+        for (const auto& [name, r] : table) assert(replayed.At(name) == r);
+    }
+    fs::remove_all(dir);
+    std::cout << "testQueryServer passed." << std::endl;
+}
+#endif
+
+void testScriptMode() {
+    std::istringstream in(
+        "# comment\n"
+        "let a = rect 0 0 5 5\n"
+        "let b = rect 3 3 5 5\n"
+        "let c = a & b\n"
+        "let d = a | b\n"
+        "area c\n"
+        "perimeter d\n"
+        "move c 1 -1\n"
+        "show c\n"
+        "unknown\n"
+        "delete d\n"
+        "count\n"
+        "clear\n");
+    std::ostringstream out;
+    int code = run_script(in, out);
+
+    assert(code == 1); // "unknown" is reported and skipped
+    assert(out.str() == "4\n32\nc 4 2 2 2\n3\n");
+    assert(vals.Empty());
+    std::cout << "testScriptMode passed." << std::endl;
+}
+
+void testPackingValid() {
+    std::mt19937 gen(12);
+    std::uniform_int_distribution<int> side(0, 24);
+    std::vector<PackSize> sizes(600);
+    for (decltype(auto) s : sizes) s = { side(gen), side(gen) };
+
+    auto check = [](const std::vector<std::optional<Rect<int>>>& rects, const std::vector<PackSize>& sizes, std::vector<Rect<int>>& placed) {
+        for (size_t i = 0; i < rects.size(); ++i) {
+            if (!rects[i]) continue;
+            const Rect<int>& r = *rects[i];
+            assert(r.width == sizes[i].width && r.height == sizes[i].height);
+            assert(r.Left() >= 0 && r.Bottom() >= 0 && r.Right() <= 256 && r.Top() <= 256);
+            if (r.Area() == 0) continue;
+            for (decltype(auto) p : placed) {
+                assert(r.Right() <= p.Left() || p.Right() <= r.Left() || r.Top() <= p.Bottom() || p.Top() <= r.Bottom());
+            }
+            placed.push_back(r);
+        }
+    };
+
+    for (PackMethod method : { PackMethod::MaxRectsBestShortSideFit, PackMethod::MaxRectsBestAreaFit, PackMethod::Skyline }) {
+        PackResult result = Pack(sizes, 256, 256, method);
+        std::vector<Rect<int>> placed;
+        check(result.rects, sizes, placed);
+
+        int64_t area = 0;
+        for (decltype(auto) r : placed) area += r.Area();
+        assert(result.packed > 0 && result.packed < sizes.size());
+        assert(std::abs(result.occupancy - area / 65536.0) < 1e-12);
+        assert(result.occupancy > 0.8);
+    }
+
+    // Incremental insertion keeps earlier placements intact
+    std::vector<PackSize> first(sizes.begin(), sizes.begin() + 100), second(sizes.begin() + 100, sizes.end());
+    MaxRectsBin maxrects(256, 256);
+    SkylineBin skyline(256, 256);
+    std::vector<Rect<int>> placed_maxrects, placed_skyline;
+    check(maxrects.Insert(first), first, placed_maxrects);
+    check(maxrects.Insert(second), second, placed_maxrects);
+    check(skyline.Insert(first), first, placed_skyline);
+    check(skyline.Insert(second), second, placed_skyline);
+    assert(maxrects.Occupancy() > 0.8 && skyline.Occupancy() > 0.8);
+    std::cout << "testPackingValid passed." << std::endl;
+}
+
+void testPackingEdgeCases() {
+    std::vector<PackSize> quarters(4, PackSize{ 50, 50 });
+    for (PackMethod method : { PackMethod::MaxRectsBestShortSideFit, PackMethod::MaxRectsBestAreaFit, PackMethod::Skyline }) {
+        PackResult exact = Pack(quarters, 100, 100, method);
+        assert(exact.packed == 4 && exact.occupancy == 1);
+
+        PackResult too_big = Pack(std::vector<PackSize>{ { 101, 1 }, { 1, 1 } }, 100, 100, method);
+        assert(!too_big.rects[0] && too_big.rects[1] && too_big.packed == 1);
+    }
+
+    MaxRectsBin full(10, 10);
+    assert(full.Insert(10, 10) == Rect<int>(0, 0, 10, 10));
+    assert(!full.Insert(1, 1) && full.FreeRects().empty());
+    assert(full.Insert(0, 5) == Rect<int>(0, 0, 0, 5)); // Zero area takes no space
+
+    bool thrown = false;
+    try {
+        SkylineBin(10, 10).Insert(-1, 2);
+    }
+    catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown);
+    std::cout << "testPackingEdgeCases passed." << std::endl;
+}
+
+void testDamageCoversInput() {
+    std::mt19937 gen(13);
+    std::uniform_int_distribution<int> pos(0, 180), side(0, 12), cluster(0, 3);
+
+    for (size_t k : { 1, 4, 16 }) {
+        DamageAccumulator<int> damage(k, 4);
+        std::vector<Rect<int>> input;
+        for (int i = 0; i < 2000; ++i) {
+            // Four far-apart clusters
+            int c = cluster(gen);
+            Rect<int> r((c % 2) * 1000 + pos(gen) / 4, (c / 2) * 1000 + pos(gen) / 4, side(gen), side(gen));
+            input.push_back(r);
+            damage.Insert(r);
+            assert(damage.Size() <= k);
+        }
+
+        auto boxes = damage.Flush();
+        assert(damage.Empty() && boxes.size() <= k);
+        for (decltype(auto) r : input) {
+            if (r.Area() == 0) continue;
+            assert(std::any_of(boxes.begin(), boxes.end(), [&](const Rect<int>& b) { return b.Contains(r); }));
+        }
+
+        int64_t area = 0;
+        for (decltype(auto) b : boxes) area += b.Area();
+        if (k >= 4) assert(area < 1056 * 1056 / 20); // Boxes stay inside the clusters instead of spanning the union
+    }
+    std::cout << "testDamageCoversInput passed." << std::endl;
+}
+
+void testDamageMerging() {
+    DamageAccumulator<int> damage(8);
+
+    // A row of touching tiles merges without waste
+    for (int i = 0; i < 10; ++i) damage.Insert(Rect<int>(i * 10, 0, 10, 10));
+    assert(damage.Size() == 1 && damage.Area() == 1000);
+
+    // Already covered, empty and far-away rectangles
+    damage.Insert(Rect<int>(5, 5, 3, 3));
+    damage.Insert(Rect<int>(500, 500, 0, 7));
+    assert(damage.Size() == 1);
+    damage.Insert(Rect<int>(500, 500, 5, 5));
+    assert(damage.Size() == 2 && damage.Area() == 1025);
+
+    std::vector<Rect<int>> frame;
+    damage.Flush(frame);
+    assert(frame.size() == 2 && damage.Empty());
+
+    DamageAccumulator<double> fractional(2);
+    fractional.Insert(Rect<double>(0.5, 0.5, 1, 1));
+    fractional.Insert(Rect<double>(1.5, 0.5, 1, 1));
+    assert(fractional.Size() == 1 && fractional.Area() == 2);
+    fractional.Insert(Rect<double>(-100, -100, 1, 1));
+    fractional.Insert(Rect<double>(100, 100, 1, 1));
+    assert(fractional.Size() == 2);
+
+    bool thrown = false;
+    try {
+        DamageAccumulator<int>(0);
+    }
+    catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown);
+    std::cout << "testDamageMerging passed." << std::endl;
+}
+
+void testInstrumentation() {
+    using instrumentation::Probe;
+    instrumentation::Reset();
+
+    Rect<int> a(0, 0, 10, 10), b(5, 5, 10, 10);
+    for (int i = 0; i < 10; ++i) a.Intersect(b);
+    std::thread worker([&] {
+        for (int i = 0; i < 5; ++i) a.Intersect(b);
+        a.Contains(Point<int>(1, 1));
+    });
+    worker.join(); // The worker's counters are merged when it exits
+
+    auto stats = instrumentation::Snapshot();
+    auto calls = [&](Probe p) { return stats[static_cast<size_t>(p)].calls; };
+    uint64_t expected = instrumentation::Enabled() ? 15 : 0;
+    assert(calls(Probe::RectIntersect) == expected);
+    assert(calls(Probe::RectContains) == (instrumentation::Enabled() ? 1 : 0));
+    assert(calls(Probe::RectConstruct) >= expected);
+    assert(calls(Probe::RectUnion) == 0);
+
+    const auto& intersect = stats[static_cast<size_t>(Probe::RectIntersect)];
+    uint64_t in_buckets = 0;
+    for (uint64_t n : intersect.histogram) in_buckets += n;
+    assert(in_buckets == intersect.calls);
+
+    std::ostringstream trace;
+    instrumentation::WriteChromeTrace(trace);
+    assert(trace.str().starts_with("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+    assert((trace.str().find("\"name\":\"Rect::Intersect\"") != std::string::npos) == instrumentation::Enabled());
+
+    instrumentation::Reset();
+    assert(instrumentation::Snapshot()[static_cast<size_t>(Probe::RectIntersect)].calls == 0);
+
+    // This thread zeroes its own counters on its next call; events from before the reset do not come back
+    a.Intersect(b);
+    assert(instrumentation::Snapshot()[static_cast<size_t>(Probe::RectIntersect)].calls == (instrumentation::Enabled() ? 1 : 0));
+    std::ostringstream after;
+    instrumentation::WriteChromeTrace(after);
+    size_t events = 0;
+    for (size_t at = after.str().find("\"name\":\"Rect::Intersect\""); at != std::string::npos;
+        at = after.str().find("\"name\":\"Rect::Intersect\"", at + 1)) ++events;
+    assert(events == (instrumentation::Enabled() ? 1 : 0));
+    std::cout << "testInstrumentation passed." << std::endl;
+}
+
 void all_tests() {
     // Positive int values
     testDefaultConstructor();
@@ -237,5 +1713,67 @@ void all_tests() {
     testNegativeIntersection();
     testContainsNegativePoint();
 
+    // Batch operations
+    testRectBatchMatchesScalar<int>("int");
+    testRectBatchMatchesScalar<float>("float");
+    testRectBatchMatchesScalar<double>("double");
+    testRectBatchSizeMismatch();
+
+    // Spatial index
+    testOverlaps();
+    testRTreeMatchesLinearScan<int>("int");
+    testRTreeMatchesLinearScan<double>("double");
+    testRTreeEdgeCases();
+    testDistances();
+    testStabbingMatchesBruteForce<int>("int");
+    testStabbingMatchesBruteForce<double>("double");
+    testDynamicTreeMatchesBruteForce<int>("int");
+    testDynamicTreeMatchesBruteForce<double>("double");
+    testSpatialGridMatchesBruteForce<int>("int");
+    testSpatialGridMatchesBruteForce<double>("double");
+    testQuantizedConservative<int, std::uint16_t>("int, uint16_t");
+    testQuantizedConservative<int, std::uint8_t>("int, uint8_t");
+    testQuantizedConservative<float, std::uint16_t>("float, uint16_t");
+    testQuantizedConservative<double, std::uint16_t>("double, uint16_t");
+    testQuantizedConservative<double, std::uint8_t>("double, uint8_t");
+    testRTreeNearestMatchesBruteForce<int>("int");
+    testRTreeNearestMatchesBruteForce<double>("double");
+    testSweepAndPruneMatchesBruteForce();
+    testSpatialJoinMatchesBruteForce<int>("int");
+    testSpatialJoinMatchesBruteForce<double>("double");
+    testParallelFor();
+    testReductionsMatchSerial();
+    testCurveKeys();
+    testCoveredAreaMatchesGrid();
+    testCoveredAreaDouble();
+
+    // Regions
+    testRegionAlgebraMatchesGrid();
+    testRegionCoalesces();
+
+    // Files
+    testBinaryStoreRoundTrip();
+    testTextParallelRoundTrip();
+    testVariableTableMatchesMap();
+    testVariableTableHandles();
+    testVersionedTableSnapshots();
+    testJournalReplay();
+    testExpressionGraph();
+#ifdef __linux__
+    testQueryServer();
+#endif
+    testScriptMode();
+
+    // Packing
+    testPackingValid();
+    testPackingEdgeCases();
+
+    // Damage tracking
+    testDamageCoversInput();
+    testDamageMerging();
+
+    // Instrumentation
+    testInstrumentation();
+
     std::cout << "All tests passed!" << std::endl;
 }
\ No newline at end of file
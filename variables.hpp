@@ -0,0 +1,324 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// <summary>
+/// Таблица переменных: имена хранятся в общем буфере, значения - подряд в плотном массиве,
+/// поиск - по хеш-таблице с открытой адресацией и линейным пробированием.
+/// Дескриптор (Handle) переменной не меняется, пока переменная не удалена
+/// </summary>
+class VariableTable {
+public:
+	using Handle = std::uint32_t;
+
+private:
+	struct Entry {
+		std::size_t name_offset;
+		std::uint32_t name_length;
+		std::uint32_t hash;
+		Rect<double> value;
+		bool alive;
+	};
+
+	// Ячейка хеш-таблицы: handle + 1 (0 - пусто) и часть хеша, чтобы не сравнивать строки зря
+	struct Slot {
+		std::uint32_t handle_plus_one;
+		std::uint32_t hash;
+	};
+
+	std::vector<char> names;
+	std::size_t dead_name_bytes = 0;
+	std::vector<Entry> entries;
+	std::vector<Handle> free_handles;
+	std::vector<Slot> slots;
+	std::size_t count = 0;
+
+	static std::uint32_t hash_of(std::string_view name) {
+		std::uint64_t h = std::hash<std::string_view>{}(name);
+		return static_cast<std::uint32_t>(h ^ (h >> 32));
+	}
+
+	std::size_t mask() const {
+		return slots.size() - 1;
+	}
+
+	std::string_view name_of(const Entry& e) const {
+		return { names.data() + e.name_offset, e.name_length };
+	}
+
+	/// <summary>
+	/// Индекс ячейки с именем или первой пустой ячейки на пути пробирования
+	/// </summary>
+	std::size_t probe(std::string_view name, std::uint32_t hash) const {
+		std::size_t i = hash & mask();
+		while (true) {
+			const Slot& s = slots[i];
+			if (s.handle_plus_one == 0) return i;
+			if (s.hash == hash && name_of(entries[s.handle_plus_one - 1]) == name) return i;
+			i = (i + 1) & mask();
+		}
+	}
+
+	void rehash(std::size_t capacity) {
+		std::size_t size = 16;
+		while (size < capacity) size *= 2;
+
+		slots.assign(size, Slot{ 0, 0 });
+		for (std::size_t h = 0; h < entries.size(); ++h) {
+			if (!entries[h].alive) continue;
+			std::size_t i = entries[h].hash & mask();
+			while (slots[i].handle_plus_one != 0) i = (i + 1) & mask();
+			slots[i] = { static_cast<std::uint32_t>(h + 1), entries[h].hash };
+		}
+	}
+
+	/// <summary>
+	/// Переупаковка буфера имен, когда больше половины его занято именами удаленных переменных
+	/// </summary>
+	void compact_names() {
+		std::vector<char> packed;
+		packed.reserve(names.size() - dead_name_bytes);
+		for (decltype(auto) e : entries) {
+			if (!e.alive) continue;
+			std::size_t offset = packed.size();
+			packed.insert(packed.end(), names.begin() + e.name_offset, names.begin() + e.name_offset + e.name_length);
+			e.name_offset = offset;
+		}
+		names = std::move(packed);
+		dead_name_bytes = 0;
+	}
+
+	template<bool Const>
+	class basic_iterator {
+		using Table = std::conditional_t<Const, const VariableTable, VariableTable>;
+		using Value = std::conditional_t<Const, const Rect<double>, Rect<double>>;
+
+		Table* table;
+		std::size_t index;
+
+		void skip_dead() {
+			while (index < table->entries.size() && !table->entries[index].alive) ++index;
+		}
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = std::pair<std::string_view, Value&>;
+		using difference_type = std::ptrdiff_t;
+		using reference = value_type;
+
+		basic_iterator(Table* table, std::size_t index)
+			: table{ table }, index{ index }
+		{
+			skip_dead();
+		}
+
+		value_type operator*() const {
+			decltype(auto) e = table->entries[index];
+			return { table->name_of(e), e.value };
+		}
+
+		basic_iterator& operator++() {
+			++index;
+			skip_dead();
+			return *this;
+		}
+
+		basic_iterator operator++(int) {
+			basic_iterator old = *this;
+			++*this;
+			return old;
+		}
+
+		/// <summary>
+		/// Дескриптор переменной, на которую указывает итератор
+		/// </summary>
+		Handle handle() const {
+			return static_cast<Handle>(index);
+		}
+
+		bool operator==(const basic_iterator& other) const {
+			return index == other.index;
+		}
+		bool operator!=(const basic_iterator& other) const {
+			return index != other.index;
+		}
+	};
+
+public:
+	using iterator = basic_iterator<false>;
+	using const_iterator = basic_iterator<true>;
+
+	VariableTable() {
+		rehash(16);
+	}
+
+	/// <summary>
+	/// Количество переменных
+	/// </summary>
+	std::size_t Size() const {
+		return count;
+	}
+
+	bool Empty() const {
+		return count == 0;
+	}
+
+	/// <summary>
+	/// Резервирование места под n переменных, чтобы избежать перестроений при массовой загрузке
+	/// </summary>
+	void Reserve(std::size_t n) {
+		entries.reserve(n);
+		if (n * 4 > slots.size() * 3) rehash(n * 4 / 3 + 1);
+	}
+
+	void Clear() {
+		names.clear();
+		dead_name_bytes = 0;
+		entries.clear();
+		free_handles.clear();
+		count = 0;
+		rehash(16);
+	}
+
+	/// <summary>
+	/// Поиск переменной по имени
+	/// </summary>
+	std::optional<Handle> Find(std::string_view name) const {
+		const Slot& s = slots[probe(name, hash_of(name))];
+		if (s.handle_plus_one == 0) return std::nullopt;
+		return s.handle_plus_one - 1;
+	}
+
+	bool Contains(std::string_view name) const {
+		return Find(name).has_value();
+	}
+
+	/// <summary>
+	/// Значение по дескриптору. Ссылка действительна до следующей вставки; удаление других переменных значения не перемещает
+	/// </summary>
+	Rect<double>& operator[](Handle h) {
+		return entries[h].value;
+	}
+
+	const Rect<double>& operator[](Handle h) const {
+		return entries[h].value;
+	}
+
+	/// <summary>
+	/// Имя по дескриптору. Строка действительна до следующей вставки или удаления: удаление может переупаковать буфер имен
+	/// </summary>
+	std::string_view Name(Handle h) const {
+		return name_of(entries[h]);
+	}
+
+	/// <summary>
+	/// Значение по имени; если переменной нет - исключение
+	/// </summary>
+	Rect<double>& At(std::string_view name) {
+		auto h = Find(name);
+		if (!h) throw std::runtime_error("Такой переменной нет: " + std::string(name));
+		return entries[*h].value;
+	}
+
+	const Rect<double>& At(std::string_view name) const {
+		return const_cast<VariableTable*>(this)->At(name);
+	}
+
+	/// <summary>
+	/// Добавление переменной. Возвращает дескриптор и false, если имя уже занято (значение не меняется)
+	/// </summary>
+	std::pair<Handle, bool> Insert(std::string_view name, const Rect<double>& value) {
+		if ((count + 1) * 4 > slots.size() * 3) rehash(slots.size() * 2);
+
+		std::uint32_t hash = hash_of(name);
+		std::size_t i = probe(name, hash);
+		if (slots[i].handle_plus_one != 0) return { slots[i].handle_plus_one - 1, false };
+
+		// Имя может указывать в собственный буфер (например, результат Name), который сейчас перераспределится
+		std::string copy;
+		if (!names.empty() && name.data() >= names.data() && name.data() < names.data() + names.size()) {
+			copy = name;
+			name = copy;
+		}
+
+		Entry e{ names.size(), static_cast<std::uint32_t>(name.size()), hash, value, true };
+		names.insert(names.end(), name.begin(), name.end());
+
+		Handle h;
+		if (!free_handles.empty()) {
+			h = free_handles.back();
+			free_handles.pop_back();
+			entries[h] = e;
+		}
+		else {
+			h = static_cast<Handle>(entries.size());
+			entries.push_back(e);
+		}
+
+		slots[i] = { h + 1, hash };
+		++count;
+		return { h, true };
+	}
+
+	/// <summary>
+	/// Добавление переменной или замена значения существующей
+	/// </summary>
+	Handle InsertOrAssign(std::string_view name, const Rect<double>& value) {
+		auto [h, inserted] = Insert(name, value);
+		if (!inserted) entries[h].value = value;
+		return h;
+	}
+
+	/// <summary>
+	/// Удаление переменной по имени; false, если ее нет
+	/// </summary>
+	bool Erase(std::string_view name) {
+		std::size_t i = probe(name, hash_of(name));
+		if (slots[i].handle_plus_one == 0) return false;
+
+		Handle h = slots[i].handle_plus_one - 1;
+		entries[h].alive = false;
+		dead_name_bytes += entries[h].name_length;
+		free_handles.push_back(h);
+		--count;
+
+		// Обратный сдвиг вместо надгробий: цепочки пробирования остаются короткими
+		std::size_t hole = i;
+		for (std::size_t j = (i + 1) & mask(); slots[j].handle_plus_one != 0; j = (j + 1) & mask()) {
+			std::size_t home = slots[j].hash & mask();
+			if (((j - home) & mask()) >= ((j - hole) & mask())) {
+				slots[hole] = slots[j];
+				hole = j;
+			}
+		}
+		slots[hole] = { 0, 0 };
+
+		if (dead_name_bytes > 4096 && dead_name_bytes * 2 > names.size()) compact_names();
+		return true;
+	}
+
+	/// <summary>
+	/// Обход в порядке хранения: пары (имя, значение)
+	/// </summary>
+	iterator begin() {
+		return { this, 0 };
+	}
+	iterator end() {
+		return { this, entries.size() };
+	}
+	const_iterator begin() const {
+		return { this, 0 };
+	}
+	const_iterator end() const {
+		return { this, entries.size() };
+	}
+};
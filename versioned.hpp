@@ -0,0 +1,287 @@
+﻿#pragma once
+#include "Rectangle.hpp"
+#include "variables.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/// <summary>
+/// Таблица переменных для многих читающих потоков и одного пишущего. Читатель берет снимок - неизменяемую
+/// версию таблицы - без блокировок: занимает ячейку читателя одной атомарной операцией и читает указатель
+/// на текущую версию. Запись никогда не задерживает чтение: изменения применяются к копии и публикуются
+/// новой версией целиком, так что снимок видит либо все изменения транзакции, либо ни одного.
+/// Таблица разбита на сегменты по хешу имени; новая версия копирует только затронутые сегменты,
+/// остальные разделяются с предыдущей. Старые версии освобождаются по эпохам: версия удаляется, когда
+/// не осталось снимков, взятых до ее замены. Снимок удерживает свою версию и все более новые,
+/// поэтому долгие снимки стоят памяти
+/// </summary>
+class VersionedTable {
+public:
+	// Сегментов: при обновлении одной переменной копируется примерно Size() / shard_count записей
+	static constexpr std::size_t shard_bits = 6;
+	static constexpr std::size_t shard_count = std::size_t{ 1 } << shard_bits;
+
+private:
+	struct Version {
+		std::uint64_t number;
+		std::size_t size;
+		std::array<std::shared_ptr<const VariableTable>, shard_count> shards;
+	};
+
+	// Эпоха, в которой читатель взял снимок; 0 - ячейка свободна
+	struct alignas(64) ReaderSlot {
+		std::atomic<std::uint64_t> epoch{ 0 };
+	};
+
+	struct Retired {
+		const Version* version;
+		std::uint64_t epoch; // Снимки, взятые в этой эпохе и позже, версию уже не видят
+	};
+
+	std::unique_ptr<ReaderSlot[]> slots;
+	std::size_t slot_count;
+	std::atomic<const Version*> current;
+	std::atomic<std::uint64_t> epoch{ 1 };
+
+	std::mutex writer;
+	std::vector<Retired> retired;
+
+	static std::size_t shard_of(std::string_view name) {
+		// Старшие биты: младшие выбирают ячейку внутри сегмента
+		return static_cast<std::size_t>(static_cast<std::uint64_t>(std::hash<std::string_view>{}(name)) >> (64 - shard_bits));
+	}
+
+	/// <summary>
+	/// Освобождение версий, которые не может видеть ни один снимок
+	/// </summary>
+	void reclaim() {
+		std::uint64_t oldest = UINT64_MAX;
+		for (std::size_t i = 0; i < slot_count; ++i) {
+			std::uint64_t e = slots[i].epoch.load();
+			if (e != 0) oldest = std::min(oldest, e);
+		}
+		std::erase_if(retired, [&](const Retired& r) {
+			if (r.epoch > oldest) return false;
+			delete r.version;
+			return true;
+		});
+	}
+
+public:
+	/// <summary>
+	/// Снимок таблицы. Не меняется, пока существует; должен быть уничтожен раньше таблицы
+	/// </summary>
+	class Snapshot {
+		friend class VersionedTable;
+
+		ReaderSlot* slot;
+		const Version* version;
+
+		Snapshot(ReaderSlot* slot, const Version* version)
+			: slot{ slot }, version{ version }
+		{ }
+
+	public:
+		Snapshot(Snapshot&& other) noexcept
+			: slot{ std::exchange(other.slot, nullptr) }, version{ other.version }
+		{ }
+
+		Snapshot& operator=(Snapshot&& other) noexcept {
+			if (this != &other) {
+				if (slot) slot->epoch.store(0, std::memory_order_release);
+				slot = std::exchange(other.slot, nullptr);
+				version = other.version;
+			}
+			return *this;
+		}
+
+		~Snapshot() {
+			if (slot) slot->epoch.store(0, std::memory_order_release);
+		}
+
+		/// <summary>
+		/// Значение переменной; std::nullopt, если ее нет
+		/// </summary>
+		std::optional<Rect<double>> Find(std::string_view name) const {
+			const VariableTable& shard = *version->shards[shard_of(name)];
+			auto h = shard.Find(name);
+			if (!h) return std::nullopt;
+			return shard[*h];
+		}
+
+		bool Contains(std::string_view name) const {
+			return version->shards[shard_of(name)]->Contains(name);
+		}
+
+		std::size_t Size() const {
+			return version->size;
+		}
+
+		bool Empty() const {
+			return version->size == 0;
+		}
+
+		/// <summary>
+		/// Номер версии: 0 у пустой таблицы, каждая транзакция увеличивает его на 1
+		/// </summary>
+		std::uint64_t Number() const {
+			return version->number;
+		}
+
+		/// <summary>
+		/// Вызывает f(name, rect) для каждой переменной; порядок не определен
+		/// </summary>
+		template<typename F>
+		void ForEach(F&& f) const {
+			for (decltype(auto) shard : version->shards) {
+				for (const auto& [name, r] : *shard) f(name, r);
+			}
+		}
+	};
+
+	/// <summary>
+	/// Изменения одной версии. Видит собственные изменения; публикуется по завершении Update
+	/// </summary>
+	class Transaction {
+		friend class VersionedTable;
+
+		Version& next;
+		std::array<VariableTable*, shard_count> copied{};
+
+		explicit Transaction(Version& next)
+			: next{ next }
+		{ }
+
+		VariableTable& writable(std::size_t s) {
+			if (!copied[s]) {
+				auto copy = std::make_shared<VariableTable>(*next.shards[s]);
+				copied[s] = copy.get();
+				next.shards[s] = std::move(copy);
+			}
+			return *copied[s];
+		}
+
+	public:
+		std::optional<Rect<double>> Find(std::string_view name) const {
+			const VariableTable& shard = *next.shards[shard_of(name)];
+			auto h = shard.Find(name);
+			if (!h) return std::nullopt;
+			return shard[*h];
+		}
+
+		/// <summary>
+		/// Добавление переменной или замена значения существующей
+		/// </summary>
+		void InsertOrAssign(std::string_view name, const Rect<double>& value) {
+			VariableTable& shard = writable(shard_of(name));
+			auto [h, inserted] = shard.Insert(name, value);
+			if (inserted) ++next.size;
+			else shard[h] = value;
+		}
+
+		/// <summary>
+		/// Удаление переменной; false, если ее нет
+		/// </summary>
+		bool Erase(std::string_view name) {
+			std::size_t s = shard_of(name);
+			if (!next.shards[s]->Contains(name)) return false;
+			writable(s).Erase(name);
+			--next.size;
+			return true;
+		}
+	};
+
+	/// <summary>
+	/// readers - наибольшее число одновременно существующих снимков
+	/// </summary>
+	explicit VersionedTable(std::size_t readers = 256)
+		: slots{ std::make_unique<ReaderSlot[]>(readers) }, slot_count{ readers }
+	{
+		auto empty = std::make_shared<const VariableTable>();
+		Version* first = new Version{ 0, 0, {} };
+		first->shards.fill(empty);
+		current.store(first);
+	}
+
+	VersionedTable(const VersionedTable&) = delete;
+	VersionedTable& operator=(const VersionedTable&) = delete;
+
+	~VersionedTable() {
+		for (decltype(auto) r : retired) delete r.version;
+		delete current.load();
+	}
+
+	/// <summary>
+	/// Снимок текущей версии; не блокируется записью. Если заняты все ячейки читателей,
+	/// выбрасывается исключение
+	/// </summary>
+	Snapshot Read() const {
+		std::uint64_t e = epoch.load();
+		// Начало поиска зависит от потока, чтобы читатели не спорили за первые ячейки
+		std::size_t start = std::hash<std::thread::id>{}(std::this_thread::get_id()) % slot_count;
+		for (std::size_t k = 0; k < slot_count; ++k) {
+			ReaderSlot& slot = slots[(start + k) % slot_count];
+			std::uint64_t expected = 0;
+			// Эпоха записывается до чтения указателя, поэтому писатель не освободит прочитанную версию
+			if (slot.epoch.compare_exchange_strong(expected, e)) return Snapshot(&slot, current.load());
+		}
+		throw std::runtime_error("Слишком много одновременных снимков");
+	}
+
+	/// <summary>
+	/// Транзакция: f(Transaction&) применяет изменения к новой версии, которая затем публикуется.
+	/// Писатели выполняются по очереди. Возвращает номер опубликованной версии; если f выбросит
+	/// исключение, версия не публикуется
+	/// </summary>
+	template<typename F>
+	std::uint64_t Update(F&& f) {
+		std::lock_guard lock(writer);
+
+		const Version* old = current.load();
+		auto next = std::make_unique<Version>(*old);
+		std::uint64_t number = ++next->number;
+		Transaction tx(*next);
+		f(tx);
+
+		current.store(next.release());
+		retired.push_back({ old, epoch.fetch_add(1) + 1 });
+		reclaim();
+		return number;
+	}
+
+	/// <summary>
+	/// Добавление переменной или замена значения существующей отдельной транзакцией
+	/// </summary>
+	std::uint64_t InsertOrAssign(std::string_view name, const Rect<double>& value) {
+		return Update([&](Transaction& tx) { tx.InsertOrAssign(name, value); });
+	}
+
+	/// <summary>
+	/// Удаление переменной отдельной транзакцией; false, если ее нет
+	/// </summary>
+	bool Erase(std::string_view name) {
+		bool erased = false;
+		Update([&](Transaction& tx) { erased = tx.Erase(name); });
+		return erased;
+	}
+
+	/// <summary>
+	/// Число замененных версий, которые еще удерживаются снимками
+	/// </summary>
+	std::size_t Retained() {
+		std::lock_guard lock(writer);
+		reclaim();
+		return retired.size();
+	}
+};